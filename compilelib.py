@@ -137,3 +137,129 @@ def detect_loadbalancer_def(header_file):
             if not m:
                 continue
             return m.group(1)
+
+_rx_elem_class_decl = re.compile(r'^class\s+[a-zA-Z0-9_]+\s*:\s*(?:(?:public|virtual)\s+)*([a-zA-Z0-9_]+)', re.M)
+_rx_elem_get_type   = re.compile(r'get_type\(\)\s*const\s*\{\s*return\s+([^;]+);')
+_rx_elem_type_term  = re.compile(r'ELEMTYPE_[A-Z_]+|([a-zA-Z0-9_]+)::get_type\(\)')
+_base_elem_types = {
+    'Element': {'ELEMTYPE_PER_PACKET'},
+    'PerBatchElement': {'ELEMTYPE_PER_BATCH'},
+    'SchedulableElement': {'ELEMTYPE_SCHEDULABLE'},
+    'OffloadableElement': {'ELEMTYPE_OFFLOADABLE', 'ELEMTYPE_SCHEDULABLE'},
+    'VectorElement': {'ELEMTYPE_VECTOR'},
+}
+def detect_element_type(header_file):
+    '''
+    Returns the set of ELEMTYPE_* flags that get_type() of the element
+    class in the given header returns, or None if it cannot be determined.
+    '''
+    with open(header_file, 'r', encoding='utf-8') as fin:
+        text = fin.read()
+    m = _rx_elem_get_type.search(text)
+    if m is None:
+        m = _rx_elem_class_decl.search(text)
+        return set(_base_elem_types[m.group(1)]) \
+               if m is not None and m.group(1) in _base_elem_types else None
+    flags = set()
+    for term in _rx_elem_type_term.finditer(m.group(1)):
+        if term.group(1) is None:
+            flags.add(term.group(0))
+        elif term.group(1) in _base_elem_types:
+            flags.update(_base_elem_types[term.group(1)])
+        else:
+            return None
+    return flags
+
+_rx_int_define = re.compile(r'^#define\s+([a-zA-Z0-9_]+)\s+\(?\s*(\d+)\s*\)?')
+def get_int_define(header_file, name):
+    '''
+    Returns the value of an integer constant macro in the given header.
+    '''
+    with open(header_file, 'r', encoding='utf-8') as fin:
+        for line in fin:
+            m = _rx_int_define.search(line)
+            if m and m.group(1) == name:
+                return int(m.group(2))
+    raise KeyError('{0} is not defined in {1}'.format(name, header_file))
+
+def _split_toplevel(text, sep):
+    '''
+    Splits the given text by the separator outside parentheses.
+    '''
+    parts, depth, start, i = [], 0, 0, 0
+    while i < len(text):
+        c = text[i]
+        if c == '(':
+            depth += 1
+        elif c == ')':
+            depth -= 1
+        elif depth == 0 and text.startswith(sep, i):
+            parts.append(text[start:i])
+            i += len(sep)
+            start = i
+            continue
+        i += 1
+    parts.append(text[start:])
+    return parts
+
+_rx_click_comment = re.compile(r'//[^\n]*')
+_rx_click_decl    = re.compile(r'^([a-zA-Z_][a-zA-Z0-9_]*)\s*::\s*([a-zA-Z_][a-zA-Z0-9_]*)')
+_rx_click_ref     = re.compile(r'^([a-zA-Z_][a-zA-Z0-9_]*)\s*(\(.*\))?$', re.S)
+_rx_click_port    = re.compile(r'^\s*\[\s*\d+\s*\]|\[\s*\d+\s*\]\s*$')
+def parse_click_graph(click_file):
+    '''
+    Parses the subset of Click configuration syntax used by NBA and
+    returns the list of element class names and the list of edges
+    as (src, dst) node index pairs.
+    '''
+    with open(click_file, 'r', encoding='utf-8') as fin:
+        text = _rx_click_comment.sub('', fin.read())
+    nodes, edges, names = [], [], {}
+    for stmt in _split_toplevel(text, ';'):
+        prev = None
+        for term in _split_toplevel(stmt, '->'):
+            term = term.strip()
+            while _rx_click_port.search(term):
+                term = _rx_click_port.sub('', term).strip()
+            if not term:
+                continue
+            m = _rx_click_decl.search(term)
+            if m:
+                names[m.group(1)] = cur = len(nodes)
+                nodes.append(m.group(2))
+            else:
+                m = _rx_click_ref.search(term)
+                if m is None:
+                    raise ValueError('Cannot parse "{0}" in {1}'.format(term, click_file))
+                if m.group(2) is None and m.group(1) in names:
+                    cur = names[m.group(1)]
+                else:
+                    cur = len(nodes)
+                    nodes.append(m.group(1))
+            if prev is not None:
+                edges.append((prev, cur))
+            prev = cur
+    return nodes, edges
+
+def find_linear_chains(nodes, edges):
+    '''
+    Returns the maximal paths of nodes where each node except the last
+    has a single output edge and each node except the first has a single
+    input edge, as lists of node indices.
+    '''
+    outs = [[] for _ in nodes]
+    ins  = [[] for _ in nodes]
+    for src, dst in edges:
+        outs[src].append(dst)
+        ins[dst].append(src)
+    def linked(src):
+        return len(outs[src]) == 1 and len(ins[outs[src][0]]) == 1
+    chains = []
+    for idx in range(len(nodes)):
+        if len(ins[idx]) == 1 and linked(ins[idx][0]):
+            continue  # not a head
+        chain = [idx]
+        while linked(chain[-1]) and outs[chain[-1]][0] != idx:
+            chain.append(outs[chain[-1]][0])
+        chains.append(chain)
+    return chains
@@ -27,6 +27,21 @@ system_params = {
     'COMP_BATCH_SIZE': int(os.environ.get('NBA_COMP_BATCH_SIZE', 64)),
     'COPROC_PPDEPTH': int(os.environ.get('NBA_COPROC_PPDEPTH', 32)),
     'COPROC_CTX_PER_COMPTHREAD': 1,
+    'BRANCHPRED_MISS_PERCENT': int(os.environ.get('NBA_BRANCHPRED_MISS_PERCENT', 25)),
+    'TX_BUFFER_SIZE': int(os.environ.get('NBA_TX_BUFFER_SIZE', 32)),
+    'TX_FLUSH_USEC': int(os.environ.get('NBA_TX_FLUSH_USEC', 100)),
+    'HW_CSUM_OFFLOAD': int(os.environ.get('NBA_HW_CSUM_OFFLOAD', 0)),
+    'RSS_REBALANCE': int(os.environ.get('NBA_RSS_REBALANCE', 0)),
+    'RSS_REBALANCE_THRESHOLD': int(os.environ.get('NBA_RSS_REBALANCE_THRESHOLD', 25)),
+    'RSS_REBALANCE_HOLDOFF': int(os.environ.get('NBA_RSS_REBALANCE_HOLDOFF', 5)),
+    'WORK_STEALING': int(os.environ.get('NBA_WORK_STEALING', 0)),
+    'IO_COMP_SPLIT': int(os.environ.get('NBA_IO_COMP_SPLIT', 0)),
+    'IDLE_POLL': int(os.environ.get('NBA_IDLE_POLL', 0)),
+    'ELEM_STAT_SAMPLE': int(os.environ.get('NBA_ELEM_STAT_SAMPLE', 0)),
+    'STATS_SHM': int(os.environ.get('NBA_STATS_SHM', 0)),
+    'TRACE': int(os.environ.get('NBA_TRACE', 0)),
+    'TRACE_EVENTS': int(os.environ.get('NBA_TRACE_EVENTS', 65536)),
+    'PERF_EVENTS': os.environ.get('NBA_PERF_EVENTS', ''),
 }
 print("IO batch size: {0[IO_BATCH_SIZE]}, computation batch size: {0[COMP_BATCH_SIZE]}".format(system_params))
 print("Coprocessor pipeline depth: {0[COPROC_PPDEPTH]}".format(system_params))
@@ -22,6 +22,7 @@ system_params = {
     'IO_BATCH_SIZE': int(os.environ.get('NBA_IO_BATCH_SIZE', 64)),
     'COMP_BATCH_SIZE': int(os.environ.get('NBA_COMP_BATCH_SIZE', 64)),
     'COPROC_PPDEPTH': int(os.environ.get('NBA_COPROC_PPDEPTH', 32)),
+    'IO_COMP_SPLIT': int(os.environ.get('NBA_IO_COMP_SPLIT', 1)),
 }
 print("# logical cores: {0}, # physical cores {1} (hyperthreading {2})".format(
     nba.num_logical_cores, nba.num_physical_cores,
@@ -0,0 +1,51 @@
+#! /usr/bin/env python3
+# This configuration is for DPDK virtual devices (e.g., net_pcap, net_null)
+# which report no NUMA node, as used by scripts/run_regression.py.
+# All ports are attached to NBA_VDEV_CORES IO/comp threads in node 0,
+# where the i-th thread takes the i-th RX queue of every port.
+
+import nba, os
+from pprint import pprint
+
+netdevices = nba.get_netdevices()
+for netdev in netdevices:
+    print(netdev)
+node_cpus = nba.get_cpu_node_mapping()
+for node_id, cpus in enumerate(node_cpus):
+    print('Cores in NUMA node {0}: [{1}]'.format(node_id, ', '.join(map(str, cpus))))
+
+system_params = {
+    'IO_BATCH_SIZE': int(os.environ.get('NBA_IO_BATCH_SIZE', 32)),
+    'COMP_BATCH_SIZE': int(os.environ.get('NBA_COMP_BATCH_SIZE', 64)),
+    'COPROC_PPDEPTH': int(os.environ.get('NBA_COPROC_PPDEPTH', 32)),
+    'COPROC_CTX_PER_COMPTHREAD': 1,
+    'TX_BUFFER_SIZE': int(os.environ.get('NBA_TX_BUFFER_SIZE', 32)),
+    'TX_FLUSH_USEC': int(os.environ.get('NBA_TX_FLUSH_USEC', 100)),
+    'IDLE_POLL': int(os.environ.get('NBA_IDLE_POLL', 0)),
+    'ELEM_STAT_SAMPLE': int(os.environ.get('NBA_ELEM_STAT_SAMPLE', 0)),
+    'STATS_SHM': int(os.environ.get('NBA_STATS_SHM', 1)),
+    'TRACE': int(os.environ.get('NBA_TRACE', 0)),
+    'PERF_EVENTS': os.environ.get('NBA_PERF_EVENTS', ''),
+}
+print("IO batch size: {0[IO_BATCH_SIZE]}, computation batch size: {0[COMP_BATCH_SIZE]}".format(system_params))
+
+num_cores = int(os.environ.get('NBA_VDEV_CORES', 1))
+# Skip the first core, where the main thread is pinned.
+io_cores = node_cpus[0][1:1 + num_cores]
+assert len(io_cores) == num_cores, 'Not enough cores in node 0.'
+
+io_threads = []
+comp_threads = []
+comp_input_queues = []
+thread_connections = []
+for thread_idx, core_id in enumerate(io_cores):
+    rxqs = [(netdev.device_id, thread_idx) for netdev in netdevices]
+    io_threads.append(nba.IOThread(core_id=core_id, attached_rxqs=rxqs, mode='normal'))
+    comp_threads.append(nba.CompThread(core_id=core_id))
+    comp_input_queues.append(nba.Queue(node_id=0, template='swrx'))
+    thread_connections.append((io_threads[-1], comp_threads[-1], comp_input_queues[-1]))
+
+coproc_threads = []
+pprint(io_threads)
+
+queues = comp_input_queues
@@ -54,20 +54,20 @@ int L2Forward::process(int input_port, Packet *pkt)
           {
             unsigned iface_in = anno_get(&pkt->anno, NBA_ANNO_IFACE_IN);
             unsigned iface_out = iface_in + ((iface_in % 2) ? -1 : +1);
-            anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, iface_out);
+            pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, iface_out);
             break;
           }
           case ECHOBACK_NUMA_CROSS:
           {
             unsigned iface_in = anno_get(&pkt->anno, NBA_ANNO_IFACE_IN);
             unsigned iface_out = (iface_in + ctx->num_tx_ports/ctx->num_nodes) % (ctx->num_tx_ports);
-            anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, iface_out);
+            pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, iface_out);
             break;
           }
           case RR_PER_PACKET:
           {
             next_port = (next_port + 1) % (ctx->num_tx_ports);
-            anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, next_port);
+            pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, next_port);
             break;
           }
           case RR_PER_BATCH:
@@ -75,7 +75,7 @@ int L2Forward::process(int input_port, Packet *pkt)
             uint64_t batch_id = anno_get(&pkt->anno, NBA_ANNO_BATCH_ID);
             if (last_batch_id != batch_id)
                 next_port = (next_port + 1) % (ctx->num_tx_ports);
-            anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, next_port);
+            pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, next_port);
             last_batch_id = batch_id;
             break;
           }
@@ -83,7 +83,7 @@ int L2Forward::process(int input_port, Packet *pkt)
           {
             unsigned iface_in = anno_get(&pkt->anno, NBA_ANNO_IFACE_IN);
             unsigned iface_out = iface_in - (iface_in % 2);
-            anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, iface_out);
+            pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, iface_out);
             break;
           }
         }
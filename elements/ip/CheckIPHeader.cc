@@ -22,40 +22,105 @@ int CheckIPHeader::configure(comp_thread_context *ctx, std::vector<std::string>
     return 0;
 }
 
-int CheckIPHeader::process(int input_port, Packet *pkt)
+static inline bool check_ipv4(Packet *pkt)
 {
-    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    struct iphdr *iph = (struct iphdr *)(ethh + 1);
-
-    if (ntohs(ethh->ether_type) != ETHER_TYPE_IPv4) {
-        RTE_LOG(DEBUG, ELEM, "CheckIPHeader: invalid packet type - %x\n", ntohs(ethh->ether_type));
-        pkt->kill();
-        return 0;
+    if (pkt->network_type() != NBA_L3_IPV4) {
+        NBA_LOG_DEBUG(ELEM, "CheckIPHeader: invalid packet type - %d\n", pkt->network_type());
+        return false;
     }
 
+    const struct iphdr *iph = (const struct iphdr *) pkt->network_header();
+
     if ( (iph->version != 4) || (iph->ihl < 5) ) {
-        RTE_LOG(DEBUG, ELEM, "CheckIPHeader: invalid packet - ver %d, ihl %d\n", iph->version, iph->ihl);
-        pkt->kill();
-        return 0;
+        NBA_LOG_DEBUG(ELEM, "CheckIPHeader: invalid packet - ver %d, ihl %d\n", iph->version, iph->ihl);
+        return false;
         // return SLOWPATH;
     }
 
     if ( (iph->ihl * 4) > ntohs(iph->tot_len)) {
-        RTE_LOG(DEBUG, ELEM, "CheckIPHeader: invalid packet - total len %d, ihl %d\n", iph->tot_len, iph->ihl);
-        pkt->kill();
-        return 0;
+        NBA_LOG_DEBUG(ELEM, "CheckIPHeader: invalid packet - total len %d, ihl %d\n", iph->tot_len, iph->ihl);
+        return false;
         // return SLOWPATH;
     }
 
     // TODO: Discard illegal source addresses.
 
-    if (ip_fast_csum(iph, iph->ihl) != 0) {
+    /* Trust the NIC if it has verified the checksum. */
+    const int hw_csum = pkt->rx_ip_csum_status();
+    if (hw_csum < 0)
+        return false;
+    if (hw_csum == 0 && ip_fast_csum(iph, iph->ihl) != 0)
+        return false;
+
+    return true;
+}
+
+int CheckIPHeader::process(int input_port, Packet *pkt)
+{
+    if (!check_ipv4(pkt)) {
         pkt->kill();
         return 0;
     }
-
     output(0).push(pkt);
     return 0;
 }
 
+int CheckIPHeader::_process_batch(int input_port, PacketBatch *batch)
+{
+    reset_output_counts();
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    batch->has_dropped = false;
+    batch->drop_count = 0;
+    #endif
+    unsigned indices[NBA_MAX_COMP_BATCH_SIZE];
+    unsigned num_valid = 0, i = 0;
+    FOR_EACH_PACKET(batch) {
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+        if (pkt->rx_ip_csum_status() == 0) {
+            /* Checksums unknown to the NIC are validated below. */
+            indices[num_valid ++] = pkt_idx;
+        } else if (check_ipv4(pkt)) {
+            pass_packet(batch, pkt_idx);
+        } else {
+            drop_packet(batch, pkt_idx);
+        }
+    } END_FOR;
+
+    #ifdef __AVX2__
+    for (; i + 8 <= num_valid; i += 8) {
+        Packet *pkts[8];
+        const void *iphs[8];
+        for (unsigned j = 0; j < 8; j++) {
+            pkts[j] = Packet::from_base(batch->packets[indices[i + j]]);
+            iphs[j] = pkts[j]->network_header();
+        }
+        unsigned passed = ipv4_validate_x8(iphs);
+        for (unsigned j = 0; j < 8; j++) {
+            const unsigned pkt_idx = indices[i + j];
+            /* Failed lanes may just have IP options.
+             * Non-IPv4 lanes are also rejected by the scalar check. */
+            if (likely((passed & (1u << j)) && pkts[j]->network_type() == NBA_L3_IPV4)
+                || check_ipv4(pkts[j]))
+                pass_packet(batch, pkt_idx);
+            else
+                drop_packet(batch, pkt_idx);
+        }
+    }
+    #endif
+    for (; i < num_valid; i++) {
+        const unsigned pkt_idx = indices[i];
+        if (check_ipv4(Packet::from_base(batch->packets[pkt_idx])))
+            pass_packet(batch, pkt_idx);
+        else
+            drop_packet(batch, pkt_idx);
+    }
+
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    if (batch->has_dropped)
+        batch->collect_excluded_packets();
+    #endif
+    batch->tracker.has_results = true;
+    return 0;
+}
+
 // vim: ts=8 sts=4 sw=4 et
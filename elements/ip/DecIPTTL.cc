@@ -1,4 +1,6 @@
 #include "DecIPTTL.hh"
+#include <nba/core/checksum.hh>
+#include <cstring>
 #include <rte_ether.h>
 #include <netinet/ip.h>
 
@@ -16,23 +18,55 @@ int DecIPTTL::configure(comp_thread_context *ctx, std::vector<std::string> &args
     return 0;
 }
 
+/* Returns false if the packet should be dropped. */
+static inline bool dec_ttl(struct iphdr *iph)
+{
+    uint16_t old_word, new_word;
+
+    if (iph->ttl <= 1)
+        return false;
+
+    /* TTL shares a 16-bit word with the protocol field.
+     * Update the checksum incrementally as in RFC 1624. */
+    memcpy(&old_word, &iph->ttl, sizeof(old_word));
+    iph->ttl --;
+    memcpy(&new_word, &iph->ttl, sizeof(new_word));
+    iph->check = ip_csum_update16(iph->check, old_word, new_word);
+    return true;
+}
+
 int DecIPTTL::process(int input_port, Packet *pkt)
 {
-    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    struct iphdr *iph      = (struct iphdr *)(ethh + 1);
-    uint32_t sum;
+    struct iphdr *iph = (struct iphdr *) pkt->network_header();
 
-    if (iph->ttl <= 1) {
+    if (!dec_ttl(iph)) {
         pkt->kill();
         return 0;
     }
-
-    // Decrement TTL.
-    iph->ttl --;
-    sum = (~ntohs(iph->check) & 0xFFFF) + 0xFEFF;
-    iph->check = ~htons(sum + (sum >> 16));
     output(0).push(pkt);
     return 0;
 }
 
+int DecIPTTL::_process_batch(int input_port, PacketBatch *batch)
+{
+    reset_output_counts();
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    batch->has_dropped = false;
+    batch->drop_count = 0;
+    #endif
+    FOR_EACH_PACKET(batch) {
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+        if (likely(dec_ttl((struct iphdr *) pkt->network_header())))
+            pass_packet(batch, pkt_idx);
+        else
+            drop_packet(batch, pkt_idx);
+    } END_FOR;
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    if (batch->has_dropped)
+        batch->collect_excluded_packets();
+    #endif
+    batch->tracker.has_results = true;
+    return 0;
+}
+
 // vim: ts=8 sts=4 sw=4 et
@@ -19,6 +19,7 @@ public:
 
     const char *class_name() const { return "DecIPTTL"; }
     const char *port_count() const { return "1/1"; }
+    int get_type() const { return ELEMTYPE_PER_PACKET | ELEMTYPE_BATCH_LOOP; }
 
     int initialize();
     int initialize_global() { return 0; };      // per-system configuration
@@ -26,6 +27,7 @@ public:
     int configure(comp_thread_context *ctx, std::vector<std::string> &args);
 
     int process(int input_port, Packet *pkt);
+    int _process_batch(int input_port, PacketBatch *batch);
 };
 
 EXPORT_ELEMENT(DecIPTTL);
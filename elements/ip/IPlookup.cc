@@ -65,6 +65,8 @@ int IPlookup::initialize_global()
     // Loading IP forwarding table from file.
     // TODO: load it from parsed configuration.
 
+    if (ctx->node_local_storage->has("TBL24"))
+        return 0;  // The FIBs are kept from the previous element graph.
     const char *filename = "configs/routing_info.txt";  // TODO: remove it or change it to configuration..
     printf("element::IPlookup: Loading the routing table entries from %s\n", filename);
 
@@ -74,6 +76,8 @@ int IPlookup::initialize_global()
 
 int IPlookup::initialize_per_node()
 {
+    if (ctx->node_local_storage->has("TBL24"))
+        return 0;
     /* Storage for routing table. */
     ctx->node_local_storage->alloc("TBL24", sizeof(uint16_t) * ipv4route::get_TBL24_size());
     ctx->node_local_storage->alloc("TBLlong", sizeof(uint16_t) * ipv4route::get_TBLlong_size());
@@ -123,8 +127,7 @@ int IPlookup::configure(comp_thread_context *ctx, std::vector<std::string> &args
 /* The CPU version */
 int IPlookup::process(int input_port, Packet *pkt)
 {
-    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    struct ipv4_hdr *iph   = (struct ipv4_hdr *)(ethh + 1);
+    struct ipv4_hdr *iph = (struct ipv4_hdr *) pkt->network_header();
     uint32_t dest_addr = ntohl(iph->dst_addr);
     uint16_t lookup_result = 0xffff;
 
@@ -142,7 +145,7 @@ int IPlookup::process(int input_port, Packet *pkt)
     #else
     rr_port = (rr_port + 1) % (num_tx_ports);
     #endif
-    anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, rr_port);
+    pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, rr_port);
     output(0).push(pkt);
     return 0;
 }
@@ -163,7 +166,7 @@ int IPlookup::postproc(int input_port, void *custom_output, Packet *pkt)
     #else
     rr_port = (rr_port + 1) % (num_tx_ports);
     #endif
-    anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, rr_port);
+    pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, rr_port);
     output(0).push(pkt);
     return 0;
 }
@@ -21,8 +21,8 @@ public:
 
     void get_read_roi(struct read_roi_info *roi) const
     {
-        roi->type = READ_PARTIAL_PACKET;
-        roi->offset = 14 + 16;  /* offset of IPv4 destination address */
+        roi->type = READ_PARTIAL_NETWORK;
+        roi->offset = 16;  /* offset of IPv4 destination address */
         roi->length = 4;
         roi->align = 0;
     }
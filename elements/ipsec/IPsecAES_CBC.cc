@@ -43,6 +43,8 @@ int IPsecAES_CBC::initialize_global()
     struct aes_sa_entry *entry;
     unsigned char fake_iv[AES_BLOCK_SIZE] = {0};
 
+    if (ctx->node_local_storage->has("h_aes_cbc_key_array"))
+        return 0;  // The SA tables are kept from the previous element graph.
     assert(num_tunnels != 0);
     aes_cbc_sa_entry_array = (struct aes_sa_entry *) malloc (sizeof(struct aes_sa_entry) *num_tunnels);
     for (int i = 0; i < num_tunnels; i++) {
@@ -77,6 +79,9 @@ int IPsecAES_CBC::initialize_per_node()
     struct ipaddr_pair key;
     int value, size;
 
+    if (ctx->node_local_storage->has("h_aes_cbc_key_array"))
+        return 0;
+
     /* Storage for host ipsec tunnel index table */
     size = sizeof(unordered_map<struct ipaddr_pair, int>);
     ctx->node_local_storage->alloc("h_aes_cbc_sa_table", size);
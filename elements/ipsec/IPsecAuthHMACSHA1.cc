@@ -80,6 +80,8 @@ int IPsecAuthHMACSHA1::initialize_global()
     struct ipaddr_pair pair;
     struct hmac_sa_entry *entry;
 
+    if (ctx->node_local_storage->has("h_hmac_flows"))
+        return 0;  // The SA tables are kept from the previous element graph.
     assert(num_tunnels != 0);
     hmac_sa_entry_array = (struct hmac_sa_entry *) malloc(sizeof(struct hmac_sa_entry)*num_tunnels);
 
@@ -104,6 +106,9 @@ int IPsecAuthHMACSHA1::initialize_per_node()
     struct ipaddr_pair key;
     int value, size;
 
+    if (ctx->node_local_storage->has("h_hmac_flows"))
+        return 0;
+
     /* Storage for host ipsec tunnel index table */
     size = sizeof(unordered_map<struct ipaddr_pair, int>);
     ctx->node_local_storage->alloc("h_hmac_sa_table", size);
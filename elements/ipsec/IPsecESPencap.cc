@@ -73,12 +73,13 @@ int IPsecESPencap::process(int input_port, Packet *pkt)
     // TODO: make it to handle IPv6 also.
     // TODO: Set src & dest of encapped pkt to ip addrs from configuration.
 
-    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    if (ntohs(ethh->ether_type) != ETHER_TYPE_IPv4) {
+    // The IPsec datablocks use fixed offsets, so VLAN-tagged frames are not supported.
+    if (pkt->network_type() != NBA_L3_IPV4
+        || pkt->network_header_offset() != sizeof(struct ether_hdr)) {
         pkt->kill();
         return 0;
     }
-    struct iphdr *iph = (struct iphdr *) (ethh + 1);
+    struct iphdr *iph = (struct iphdr *) pkt->network_header();
 
     struct ipaddr_pair pair;
     pair.src_addr = ntohl(iph->saddr);
@@ -87,7 +88,7 @@ int IPsecESPencap::process(int input_port, Packet *pkt)
     struct espencap_sa_entry *sa_entry = NULL;
     if (likely(sa_item != sa_table.end())) {
         sa_entry = sa_item->second;
-        anno_set(&pkt->anno, NBA_ANNO_IPSEC_FLOW_ID, sa_entry->entry_idx);
+        pkt_anno_set(pkt, NBA_ANNO_IPSEC_FLOW_ID, sa_entry->entry_idx);
         assert(sa_entry->entry_idx < 1024u);
     } else {
         pkt->kill();
@@ -154,7 +155,11 @@ int IPsecESPencap::process(int input_port, Packet *pkt)
     iph->tot_len = htons(extended_ip_len);
     iph->protocol = 0x32;               // mark that this packet contains a secured payload.
     iph->check = 0;                     // ignoring previous checksum.
-    iph->check = ip_fast_csum(iph, iph->ihl);
+    pkt->set_transport_header(pkt->network_header_offset() + sizeof(struct iphdr), iph->protocol);
+    if (ctx->hw_csum_offload)
+        pkt->request_tx_ip_csum();
+    else
+        iph->check = ip_fast_csum(iph, iph->ihl);
     output(0).push(pkt);
     return 0;
 }
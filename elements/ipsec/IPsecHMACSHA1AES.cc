@@ -43,6 +43,8 @@ int IPsecHMACSHA1AES::initialize_global()
     struct hmac_aes_sa_entry *entry;
     unsigned char fake_iv[AES_BLOCK_SIZE] = {0};
 
+    if (ctx->node_local_storage->has("h_hmac_aes_key_array"))
+        return 0;  // The SA tables are kept from the previous element graph.
     assert(num_tunnels != 0);
     hmac_aes_sa_entry_array = (struct hmac_aes_sa_entry *) malloc (sizeof(struct hmac_aes_sa_entry) *num_tunnels);
     for (int i = 0; i < num_tunnels; i++) {
@@ -80,6 +82,9 @@ int IPsecHMACSHA1AES::initialize_per_node()
     struct ipaddr_pair key;
     int value, size;
 
+    if (ctx->node_local_storage->has("h_hmac_aes_key_array"))
+        return 0;
+
     /* Storage for host ipsec tunnel index table */
     size = sizeof(unordered_map<struct ipaddr_pair, int>);
     ctx->node_local_storage->alloc("h_hmac_aes_sa_table", size);
@@ -20,14 +20,12 @@ int CheckIP6Header::configure(comp_thread_context *ctx, std::vector<std::string>
 
 int CheckIP6Header::process(int input_port, Packet *pkt)
 {
-    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    struct ip6_hdr *iph = (struct ip6_hdr *)(ethh + 1);
-
     // Validate the packet header.
-    if (ntohs(ethh->ether_type) != ETHER_TYPE_IPv6) {
+    if (pkt->network_type() != NBA_L3_IPV6) {
         pkt->kill();
         return 0;
     }
+    struct ip6_hdr *iph = (struct ip6_hdr *) pkt->network_header();
 
     if ((iph->ip6_vfc & 0xf0) >> 4 != 6) {  // get the first 4 bits.
         pkt->kill();
@@ -18,8 +18,7 @@ int DecIP6HLIM::configure(comp_thread_context *ctx, std::vector<std::string> &ar
 
 int DecIP6HLIM::process(int input_port, Packet *pkt)
 {
-    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    struct ip6_hdr *iph    = (struct ip6_hdr *)(ethh + 1);
+    struct ip6_hdr *iph = (struct ip6_hdr *) pkt->network_header();
     uint32_t checksum;
 
     if (iph->ip6_hlim <= 1) {
@@ -23,8 +23,8 @@ public:
     void get_read_roi(struct read_roi_info *roi) const
     {
         // Dest IPv6 addr, whose format is in6_addr struct, is converted to uint128_t in preproc().
-        roi->type = READ_PARTIAL_PACKET;
-        roi->offset = 14 + 24;  /* offset of IPv6 destination address. */
+        roi->type = READ_PARTIAL_NETWORK;
+        roi->offset = 24;  /* offset of IPv6 destination address. */
         roi->length = sizeof(uint128_t);
         roi->align = 0;
     }
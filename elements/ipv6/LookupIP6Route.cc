@@ -77,6 +77,8 @@ int LookupIP6Route::configure(comp_thread_context *ctx, std::vector<std::string>
 
 int LookupIP6Route::initialize_global()
 {
+    if (ctx->node_local_storage->has("ipv6_table"))
+        return 0;  // The tables are kept from the previous element graph.
     // Generate table randomly..
     int seed = 7659243;
     int count = 200000;
@@ -87,6 +89,8 @@ int LookupIP6Route::initialize_global()
 
 int LookupIP6Route::initialize_per_node()
 {
+    if (ctx->node_local_storage->has("ipv6_table"))
+        return 0;
     /* Storage for routing table. */
     ctx->node_local_storage->alloc("ipv6_table", sizeof(RoutingTableV6));
     RoutingTableV6 *table = (RoutingTableV6*)ctx->node_local_storage->get_alloc("ipv6_table");
@@ -119,8 +123,7 @@ int LookupIP6Route::initialize()
 /* The CPU version */
 int LookupIP6Route::process(int input_port, Packet *pkt)
 {
-    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
-    struct ip6_hdr *ip6h   = (struct ip6_hdr *)(ethh + 1);
+    struct ip6_hdr *ip6h = (struct ip6_hdr *) pkt->network_header();
     uint128_t dest_addr;
     uint16_t lookup_result = 0xffff;
     std::swap(dest_addr.u64[0], dest_addr.u64[1]);
@@ -146,7 +149,7 @@ int LookupIP6Route::process(int input_port, Packet *pkt)
     #else
     rr_port = (rr_port + 1) % (num_tx_ports);
     #endif
-    anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, rr_port);
+    pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, rr_port);
     output(0).push(pkt);
     return 0;
 }
@@ -166,7 +169,7 @@ int LookupIP6Route::postproc(int input_port, void *custom_output, Packet *pkt)
     #else
     rr_port = (rr_port + 1) % (num_tx_ports);
     #endif
-    anno_set(&pkt->anno, NBA_ANNO_IFACE_OUT, rr_port);
+    pkt_anno_set(pkt, NBA_ANNO_IFACE_OUT, rr_port);
     output(0).push(pkt);
     return 0;
 }
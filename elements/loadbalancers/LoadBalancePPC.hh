@@ -47,6 +47,8 @@ public:
 
     int initialize_per_node()
     {
+        if (ctx->node_local_storage->has("LBPPC.cpu_weight"))
+            return 0;  // The running graph keeps updating it.
         ctx->node_local_storage->alloc("LBPPC.cpu_weight", sizeof(rte_atomic64_t));
         rte_atomic64_t *node_cpu_ratio = (rte_atomic64_t *)
                 ctx->node_local_storage->get_alloc("LBPPC.cpu_weight");
@@ -2,6 +2,11 @@
 #define __NBA_CHECKSUM_HH__
 
 #include <cstdint>
+#ifdef __AVX2__
+extern "C" {
+#include <immintrin.h>
+}
+#endif
 
 namespace nba {
 
@@ -35,6 +40,77 @@ static inline uint16_t ip_fast_csum(const void *iph, unsigned int ihl)
     return (uint16_t)sum;
 }
 
+/**
+ * Incrementally updates a one's complement checksum when a 16-bit word
+ * covered by it changes from old_word to new_word (RFC 1624, Eqn. 3):
+ *   HC' = ~(~HC + ~m + m')
+ * Unlike the RFC 1141 form, this never produces -0 (0xFFFF) from a
+ * non-zero sum.  All arguments are taken as-is, so they only need to be
+ * in the same byte order as the checksum field.
+ */
+static inline uint16_t ip_csum_update16(uint16_t check, uint16_t old_word, uint16_t new_word)
+{
+    uint32_t sum = (uint16_t) ~check;
+    sum += (uint16_t) ~old_word;
+    sum += new_word;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+#ifdef __AVX2__
+/**
+ * Validates 8 IPv4 headers at once.
+ * A lane passes if its version/IHL is exactly 4/5, tot_len covers the
+ * header, and the header checksum is correct.
+ * Returns a bitmask of the passing lanes.
+ *
+ * Headers with IP options (IHL > 5) never pass here; callers should
+ * re-check the failed lanes with the scalar path to tell them apart from
+ * really broken packets.  The gathers read 20 bytes from each header,
+ * which is always within the mbuf data room.
+ */
+static inline unsigned ipv4_validate_x8(const void *const iphs[8])
+{
+    const __m256i addr_lo = _mm256_loadu_si256((const __m256i *) &iphs[0]);
+    const __m256i addr_hi = _mm256_loadu_si256((const __m256i *) &iphs[4]);
+    #define _GATHER32_X8(ofs) \
+        _mm256_set_m128i(_mm256_i64gather_epi32((const int *) (ofs), addr_hi, 1), \
+                         _mm256_i64gather_epi32((const int *) (ofs), addr_lo, 1))
+    /* The 20-byte IPv4 header as five 32-bit words. */
+    const __m256i w0 = _GATHER32_X8(0);
+    const __m256i w1 = _GATHER32_X8(4);
+    const __m256i w2 = _GATHER32_X8(8);
+    const __m256i w3 = _GATHER32_X8(12);
+    const __m256i w4 = _GATHER32_X8(16);
+    #undef _GATHER32_X8
+
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+    /* ver_ihl == 0x45 (the first byte, read in little endian). */
+    __m256i ok = _mm256_cmpeq_epi32(_mm256_and_si256(w0, _mm256_set1_epi32(0xff)),
+                                    _mm256_set1_epi32(0x45));
+
+    /* tot_len (big endian, bytes 2..3 of w0) >= 20 */
+    __m256i tot_len = _mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(w0, 8), _mm256_set1_epi32(0xff00)),
+            _mm256_srli_epi32(w0, 24));
+    ok = _mm256_and_si256(ok, _mm256_cmpgt_epi32(tot_len, _mm256_set1_epi32(19)));
+
+    /* Sum up all 16-bit words into 32-bit lanes (no overflow for 10 words),
+     * then fold twice.  A correct header sums up to 0xffff. */
+    __m256i sum = _mm256_add_epi32(_mm256_and_si256(w0, lo16), _mm256_srli_epi32(w0, 16));
+    sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_and_si256(w1, lo16), _mm256_srli_epi32(w1, 16)));
+    sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_and_si256(w2, lo16), _mm256_srli_epi32(w2, 16)));
+    sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_and_si256(w3, lo16), _mm256_srli_epi32(w3, 16)));
+    sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_and_si256(w4, lo16), _mm256_srli_epi32(w4, 16)));
+    sum = _mm256_add_epi32(_mm256_and_si256(sum, lo16), _mm256_srli_epi32(sum, 16));
+    sum = _mm256_add_epi32(_mm256_and_si256(sum, lo16), _mm256_srli_epi32(sum, 16));
+    ok = _mm256_and_si256(ok, _mm256_cmpeq_epi32(sum, lo16));
+
+    return (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+}
+#endif
+
 }
 
 #endif
@@ -0,0 +1,93 @@
+#ifndef __NBA_CORE_FREELIST_HH__
+#define __NBA_CORE_FREELIST_HH__
+
+#include <nba/core/intrinsic.hh>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <rte_config.h>
+#include <rte_mempool.h>
+
+namespace nba {
+
+/**
+ * A thread-private LIFO cache of objects in front of an rte_mempool.
+ *
+ * The most recently freed object is handed out first, so it is likely
+ * still in the CPU cache.  The backing mempool is accessed only in bulk,
+ * when the cache is empty (refill) or full (flush half).
+ * It is NOT thread-safe; all get/put calls must come from the same thread.
+ */
+template<unsigned N>
+class FreeList {
+    static_assert(N >= 2 && (N % 2) == 0, "FreeList size must be an even number >= 2.");
+
+public:
+    FreeList() : pool(nullptr), top(0) { }
+
+    virtual ~FreeList() { }
+
+    void init(struct rte_mempool *mp)
+    {
+        pool = mp;
+        top = 0;
+    }
+
+    inline int get(void **obj)
+    {
+        if (unlikely(top == 0) && refill() != 0)
+            return -ENOENT;
+        *obj = objs[-- top];
+        return 0;
+    }
+
+    /** All-or-nothing like rte_mempool_get_bulk(). */
+    inline int get_bulk(void **out, unsigned n)
+    {
+        for (unsigned i = 0; i < n; i++) {
+            if (unlikely(get(&out[i]) != 0)) {
+                while (i > 0)
+                    put(out[-- i]);
+                return -ENOENT;
+            }
+        }
+        return 0;
+    }
+
+    inline void put(void *obj)
+    {
+        if (unlikely(top == N)) {
+            /* Return the colder bottom half to the mempool. */
+            rte_mempool_put_bulk(pool, &objs[0], N / 2);
+            memmove(&objs[0], &objs[N / 2], sizeof(void *) * (N / 2));
+            top = N / 2;
+        }
+        objs[top ++] = obj;
+    }
+
+    /** The number of objects cached in front of the mempool. */
+    inline unsigned count() const { return top; }
+
+private:
+    int refill()
+    {
+        if (rte_mempool_get_bulk(pool, &objs[0], N / 2) == 0) {
+            top = N / 2;
+            return 0;
+        }
+        /* The mempool has less than N / 2 objects left. */
+        while (top < N / 2 && rte_mempool_get(pool, &objs[top]) == 0)
+            top ++;
+        return (top > 0) ? 0 : -ENOENT;
+    }
+
+    struct rte_mempool *pool;
+    unsigned top;
+    void *objs[N];
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,116 @@
+#ifndef __NBA_CORE_HISTOGRAM_HH__
+#define __NBA_CORE_HISTOGRAM_HH__
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+namespace nba {
+
+/**
+ * A log-linear (HDR-style) histogram of unsigned 64-bit values.
+ *
+ * Values below 2^SubBits are counted exactly.  Each larger power-of-two
+ * range is split into 2^SubBits equal-width buckets, so a reported
+ * percentile exceeds the true value by less than 1/2^SubBits of it.
+ * Recording is a few integer operations without any allocation, and
+ * histograms with the same SubBits are merged by adding their buckets.
+ * It is NOT thread-safe.
+ */
+template<unsigned SubBits = 5>
+class LogHistogram {
+    static_assert(SubBits >= 1 && SubBits <= 16, "SubBits must be in [1, 16].");
+
+public:
+    static const unsigned NUM_SUB_BUCKETS = 1u << SubBits;
+    static const unsigned NUM_BUCKETS = (64 - SubBits + 1) * NUM_SUB_BUCKETS;
+
+    LogHistogram() { reset(); }
+
+    void reset()
+    {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        max_value = 0;
+    }
+
+    inline void record(uint64_t value, uint64_t n = 1)
+    {
+        counts[bucket_of(value)] += n;
+        total += n;
+        if (value > max_value)
+            max_value = value;
+    }
+
+    void merge(const LogHistogram &other)
+    {
+        if (other.total == 0)
+            return;
+        for (unsigned b = 0; b < NUM_BUCKETS; b++)
+            counts[b] += other.counts[b];
+        total += other.total;
+        if (other.max_value > max_value)
+            max_value = other.max_value;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return max_value; }
+
+    /**
+     * Returns the upper bound of the bucket holding the given percentile
+     * (0 < p <= 100), or zero if the histogram is empty.
+     */
+    uint64_t percentile(double p) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t) ceil(p / 100.0 * total);
+        if (rank == 0)
+            rank = 1;
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < NUM_BUCKETS; b++) {
+            seen += counts[b];
+            if (seen >= rank) {
+                uint64_t upper = bucket_upper(b);
+                return (upper < max_value) ? upper : max_value;
+            }
+        }
+        return max_value;
+    }
+
+    static inline unsigned bucket_of(uint64_t value)
+    {
+        if (value < NUM_SUB_BUCKETS)
+            return (unsigned) value;
+        unsigned msb = 63 - __builtin_clzll(value);
+        unsigned shift = msb - SubBits;
+        /* (value >> shift) is in [NUM_SUB_BUCKETS, 2 * NUM_SUB_BUCKETS). */
+        return (shift + 1) * NUM_SUB_BUCKETS + (unsigned) ((value >> shift) - NUM_SUB_BUCKETS);
+    }
+
+    static inline uint64_t bucket_upper(unsigned b)
+    {
+        unsigned group = b / NUM_SUB_BUCKETS;
+        uint64_t sub = b % NUM_SUB_BUCKETS;
+        if (group == 0)
+            return sub;
+        unsigned shift = group - 1;
+        return ((NUM_SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+private:
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t total;
+    uint64_t max_value;
+};
+
+template<unsigned SubBits>
+const unsigned LogHistogram<SubBits>::NUM_SUB_BUCKETS;
+template<unsigned SubBits>
+const unsigned LogHistogram<SubBits>::NUM_BUCKETS;
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,256 @@
+#ifndef __NBA_CORE_PERFCTR_HH__
+#define __NBA_CORE_PERFCTR_HH__
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#define NBA_PERF_MAX_EVENTS     (4u)
+#define NBA_PERF_NAME_LEN       (24u)
+
+namespace nba {
+
+struct perf_event_spec {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+#define _NBA_PERF_CACHE(cache, op, result) \
+    ((PERF_COUNT_HW_CACHE_ ## cache) | ((PERF_COUNT_HW_CACHE_OP_ ## op) << 8) \
+     | ((PERF_COUNT_HW_CACHE_RESULT_ ## result) << 16))
+
+static const struct perf_event_spec perf_known_events[] = {
+    {"cycles",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branches",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"stalled-cycles-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+    {"stalled-cycles-backend",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+    {"l1d-misses",      PERF_TYPE_HW_CACHE, _NBA_PERF_CACHE(L1D, READ, MISS)},
+    {"llc-loads",       PERF_TYPE_HW_CACHE, _NBA_PERF_CACHE(LL, READ, ACCESS)},
+    {"llc-misses",      PERF_TYPE_HW_CACHE, _NBA_PERF_CACHE(LL, READ, MISS)},
+    {"llc-store-misses", PERF_TYPE_HW_CACHE, _NBA_PERF_CACHE(LL, WRITE, MISS)},
+    {"dtlb-misses",     PERF_TYPE_HW_CACHE, _NBA_PERF_CACHE(DTLB, READ, MISS)},
+    {"itlb-misses",     PERF_TYPE_HW_CACHE, _NBA_PERF_CACHE(ITLB, READ, MISS)},
+};
+
+#undef _NBA_PERF_CACHE
+
+/**
+ * Finds an event by its name in perf_known_events, or parses a raw
+ * PMU event code written as "r<hex>" like perf-stat(1).
+ * Returns -EINVAL for unknown names.
+ */
+static inline int perf_lookup_event(const char *name, size_t len, uint32_t *type, uint64_t *config)
+{
+    for (const struct perf_event_spec &e : perf_known_events) {
+        if (strlen(e.name) == len && strncasecmp(e.name, name, len) == 0) {
+            *type = e.type;
+            *config = e.config;
+            return 0;
+        }
+    }
+    if (len >= 2 && len <= 17 && name[0] == 'r') {
+        uint64_t v = 0;
+        for (size_t i = 1; i < len; i++) {
+            char c = name[i];
+            unsigned d;
+            if (c >= '0' && c <= '9') d = c - '0';
+            else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+            else return -EINVAL;
+            v = (v << 4) | d;
+        }
+        *type = PERF_TYPE_RAW;
+        *config = v;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+/**
+ * A group of hardware performance counters of the calling thread,
+ * scheduled together on the PMU.
+ *
+ * read() uses the rdpmc instruction on the pages mapped from the
+ * counters, which takes tens of cycles without entering the kernel.
+ * If the kernel does not allow user-space rdpmc (see
+ * /sys/devices/cpu/rdpmc), it falls back to a single read() syscall
+ * of the whole group.  It is NOT thread-safe; only the thread that
+ * opened the group can read it.
+ */
+class PerfCounterGroup {
+public:
+    PerfCounterGroup() : num_events(0), use_rdpmc(false)
+    {
+        for (unsigned i = 0; i < NBA_PERF_MAX_EVENTS; i++) {
+            fds[i] = -1;
+            pages[i] = nullptr;
+            names[i][0] = '\0';
+        }
+    }
+
+    virtual ~PerfCounterGroup() { close(); }
+
+    /**
+     * Opens the comma-separated list of events (e.g.,
+     * "cycles,instructions,llc-misses") for the calling thread.
+     * Returns the number of events opened, or a negative errno.
+     */
+    int open(const char *spec)
+    {
+        uint32_t types[NBA_PERF_MAX_EVENTS];
+        uint64_t configs[NBA_PERF_MAX_EVENTS];
+        char parsed_names[NBA_PERF_MAX_EVENTS][NBA_PERF_NAME_LEN];
+        unsigned n = 0;
+        const char *p = spec;
+        while (*p != '\0') {
+            const char *end = strchr(p, ',');
+            size_t len = (end == nullptr) ? strlen(p) : (size_t) (end - p);
+            if (len > 0) {
+                if (n == NBA_PERF_MAX_EVENTS)
+                    return -E2BIG;
+                if (perf_lookup_event(p, len, &types[n], &configs[n]) != 0)
+                    return -EINVAL;
+                snprintf(parsed_names[n], NBA_PERF_NAME_LEN, "%.*s", (int) len, p);
+                n ++;
+            }
+            if (end == nullptr)
+                break;
+            p = end + 1;
+        }
+        if (n == 0)
+            return -EINVAL;
+        int ret = open(types, configs, n);
+        for (unsigned i = 0; ret > 0 && i < n; i++)
+            memcpy(names[i], parsed_names[i], NBA_PERF_NAME_LEN);
+        return ret;
+    }
+
+    int open(const uint32_t *types, const uint64_t *configs, unsigned n)
+    {
+        close();
+        if (n == 0 || n > NBA_PERF_MAX_EVENTS)
+            return -EINVAL;
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (unsigned i = 0; i < n; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = (i == 0);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1,
+                                   (i == 0) ? -1 : fds[0], 0);
+            if (fd < 0) {
+                int err = errno;
+                close();
+                return -err;
+            }
+            fds[i] = fd;
+            num_events = i + 1;
+            void *page = mmap(nullptr, page_size, PROT_READ, MAP_SHARED, fd, 0);
+            pages[i] = (page == MAP_FAILED) ? nullptr : (struct perf_event_mmap_page *) page;
+        }
+        use_rdpmc = true;
+        for (unsigned i = 0; i < n; i++)
+            if (pages[i] == nullptr || !pages[i]->cap_user_rdpmc)
+                use_rdpmc = false;
+        #if !defined(__x86_64__) && !defined(__i386__)
+        use_rdpmc = false;
+        #endif
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return (int) n;
+    }
+
+    void close()
+    {
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (unsigned i = 0; i < NBA_PERF_MAX_EVENTS; i++) {
+            if (pages[i] != nullptr)
+                munmap(pages[i], page_size);
+            if (fds[i] != -1)
+                ::close(fds[i]);
+            fds[i] = -1;
+            pages[i] = nullptr;
+            names[i][0] = '\0';
+        }
+        num_events = 0;
+        use_rdpmc = false;
+    }
+
+    unsigned size() const { return num_events; }
+    const char *event_name(unsigned i) const { return names[i]; }
+    bool uses_rdpmc() const { return num_events > 0 && use_rdpmc; }
+
+    /** Reads the current (monotonically increasing) counter values. */
+    inline void read(uint64_t *values) const
+    {
+        if (use_rdpmc) {
+            for (unsigned i = 0; i < num_events; i++)
+                values[i] = read_rdpmc(pages[i]);
+            return;
+        }
+        uint64_t buf[1 + NBA_PERF_MAX_EVENTS];
+        if (::read(fds[0], buf, sizeof(uint64_t) * (1 + num_events)) > 0) {
+            for (unsigned i = 0; i < num_events; i++)
+                values[i] = buf[1 + i];
+        } else {
+            for (unsigned i = 0; i < num_events; i++)
+                values[i] = 0;
+        }
+    }
+
+private:
+    static inline uint64_t read_rdpmc(const volatile struct perf_event_mmap_page *pc)
+    {
+        #if defined(__x86_64__) || defined(__i386__)
+        uint32_t seq, idx;
+        uint64_t count;
+        /* The kernel updates the page with a seqlock on context switches. */
+        do {
+            seq = pc->lock;
+            __asm__ __volatile__ ("" ::: "memory");
+            idx = pc->index;
+            count = pc->offset;
+            if (idx != 0) {
+                uint32_t lo, hi;
+                __asm__ __volatile__ ("rdpmc" : "=a" (lo), "=d" (hi) : "c" (idx - 1));
+                unsigned shift = 64 - pc->pmc_width;
+                int64_t pmc = (int64_t) (((uint64_t) hi << 32) | lo);
+                count += (uint64_t) ((pmc << shift) >> shift);
+            }
+            __asm__ __volatile__ ("" ::: "memory");
+        } while (pc->lock != seq);
+        return count;
+        #else
+        return 0;
+        #endif
+    }
+
+    int fds[NBA_PERF_MAX_EVENTS];
+    struct perf_event_mmap_page *pages[NBA_PERF_MAX_EVENTS];
+    char names[NBA_PERF_MAX_EVENTS][NBA_PERF_NAME_LEN];
+    unsigned num_events;
+    bool use_rdpmc;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,85 @@
+#ifndef __NBA_CORE_TRACERING_HH__
+#define __NBA_CORE_TRACERING_HH__
+
+#include <cstdint>
+#include <cassert>
+
+namespace nba {
+
+struct trace_event {
+    uint64_t tsc;
+    uint16_t type;
+    uint16_t _reserved;
+    uint32_t arg0;
+    uint64_t arg1;
+};
+static_assert(sizeof(struct trace_event) == 24, "trace_event layout must be fixed.");
+
+/**
+ * A fixed-size ring of binary trace events with a single writer.
+ *
+ * When full, the oldest events are overwritten so that the ring always
+ * keeps the latest history.  Recording is a few stores into memory
+ * given by the caller, without any atomic operations or allocation.
+ * Readers must run after the writer has stopped recording; otherwise
+ * they may see partially overwritten events.
+ */
+class TraceRing {
+public:
+    TraceRing() : events(nullptr), mask(0), head(0) { }
+
+    virtual ~TraceRing() { }
+
+    /** The capacity must be a power of two. */
+    void init(struct trace_event *buf, unsigned capacity)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+        events = buf;
+        mask = capacity - 1;
+        head = 0;
+    }
+
+    inline void push(uint16_t type, uint64_t tsc, uint32_t arg0, uint64_t arg1)
+    {
+        struct trace_event *e = &events[head & mask];
+        e->tsc = tsc;
+        e->type = type;
+        e->_reserved = 0;
+        e->arg0 = arg0;
+        e->arg1 = arg1;
+        head ++;
+    }
+
+    void clear() { head = 0; }
+
+    unsigned capacity() const { return mask + 1; }
+
+    /** The number of events recorded since init() or clear(). */
+    uint64_t recorded() const { return head; }
+
+    /** The number of events currently kept. */
+    unsigned size() const
+    {
+        return (head > mask) ? (mask + 1) : (unsigned) head;
+    }
+
+    /** The number of events lost by overwriting. */
+    uint64_t overwritten() const { return head - size(); }
+
+    /** Returns the i-th oldest event kept (i < size()). */
+    const struct trace_event &at(unsigned i) const
+    {
+        return events[(head - size() + i) & mask];
+    }
+
+private:
+    struct trace_event *events;
+    uint32_t mask;
+    uint64_t head;
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
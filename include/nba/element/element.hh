@@ -5,6 +5,7 @@
 #include <nba/core/queue.hh>
 #include <nba/core/offloadtypes.hh>
 #include <nba/core/vector.hh>
+#include <nba/core/perfctr.hh>
 #include <nba/framework/config.hh>
 #include <nba/framework/graphanalysis.hh>
 #include <nba/element/packet.hh>
@@ -21,6 +22,7 @@ namespace nba {
 /* Forward declarations. */
 class Element;
 class ElementGraph;
+class OffloadableElement;
 class OffloadTask;
 class comp_thread_context;
 class ComputeContext;
@@ -42,6 +44,28 @@ enum ElementType {
     ELEMTYPE_INPUT = 16,
     ELEMTYPE_OUTPUT = 32,
     ELEMTYPE_VECTOR = 64,
+    /* Per-packet elements that override _process_batch() with their own
+     * batch-wide loop.  Fused chains call it instead of process(). */
+    ELEMTYPE_BATCH_LOOP = 128,
+};
+
+/* Per-thread counters of an element.  Cycles are measured only for the
+ * sampled batches (1 in ELEM_STAT_SAMPLE), so the per-packet cost is
+ * num_sampled_cycles / num_sampled_pkts.  Packets that are not dropped
+ * are passed to the outputs (or kept pending).
+ * With branch prediction, the branch counters give how many packets of the
+ * batches split in place went to the predicted port (hits) or were copied
+ * out (misses), and how many batches were split in place or fully copied. */
+struct element_stat {
+    uint64_t num_batches;
+    uint64_t num_pkts_in;
+    uint64_t num_drops;
+    uint64_t num_sampled_pkts;
+    uint64_t num_sampled_cycles;
+    uint64_t num_branch_hits;
+    uint64_t num_branch_misses;
+    uint64_t num_branch_predicted;
+    uint64_t num_branch_copied;
 };
 
 struct element_info {
@@ -53,6 +77,32 @@ struct element_info {
 
 #define EXPORT_ELEMENT(...)
 
+/* A statically compiled per-packet loop over a fused element chain.
+ * (See nba/framework/staticgraph.hh) */
+typedef void (*static_chain_fn)(void *const *typed, const int *input_ports, PacketBatch *batch);
+
+/* A chain of elements that ElementGraph runs in a single per-packet loop.
+ * The members with their own batch loop (ELEMTYPE_BATCH_LOOP) split it into
+ * per-packet segments and run their _process_batch() in between. */
+struct fused_chain {
+    unsigned num_fused;     /* The number of subsequent elements fused. */
+    uint32_t batch_loops;   /* Bit k is set if the k-th member has its own batch loop. */
+    static_chain_fn run;    /* If nullptr, process() is called via vtables. */
+    void *typed[NBA_MAX_FUSED_ELEMENTS];    /* The elements cast for run. */
+};
+static_assert(NBA_MAX_FUSED_ELEMENTS <= 32, "fused_chain::batch_loops has 32 bits.");
+
+/* Per-element information precomputed by ElementGraph::validate() so that
+ * the per-batch path needs neither virtual calls nor dynamic_cast. */
+struct element_dispatch {
+    int type;                           /* Cached result of get_type(). */
+    OffloadableElement *offloadable;    /* Downcasted self, or nullptr. */
+    unsigned num_outputs;
+    Element *next_elems[NBA_MAX_ELEM_NEXTS];
+    int next_inputs[NBA_MAX_ELEM_NEXTS];
+    bool next_is_output[NBA_MAX_ELEM_NEXTS];
+};
+
 #define HANDLE_ALL_PORTS case 0: \
                          case 1: \
                          case 2: \
@@ -96,6 +146,13 @@ public:
 
     inline const OutputPort &output(int idx) const { return outputs[idx]; }
 
+    /* The chain fused from this element, when the batch is processed
+     * by CPU or may be offloaded. */
+    inline const struct fused_chain &get_fused_chain(bool offloading) const
+    {
+        return offloading ? fused_offl : fused_cpu;
+    }
+
     /* == User-defined properties and methods == */
     virtual const char *class_name() const = 0;
     virtual const char *port_count() const = 0;
@@ -123,6 +180,31 @@ protected:
     int num_nodes;
     int node_idx;
 
+    /* Subclasses that override _process_batch() to skip per-packet
+     * virtual calls use below to set the per-packet results directly,
+     * keeping output_counts in sync as OutputPort::push() does.
+     * (Cloned packets are not supported in this path.) */
+    inline void reset_output_counts()
+    {
+        memzero(output_counts, NBA_MAX_ELEM_NEXTS);
+    }
+
+    inline void pass_packet(PacketBatch *batch, unsigned pkt_idx, int output_port = 0)
+    {
+        batch->results[pkt_idx] = output_port;
+        output_counts[output_port] ++;
+    }
+
+    /* Dropped packets have no output port to count, same as Packet::kill(). */
+    inline void drop_packet(PacketBatch *batch, unsigned pkt_idx)
+    {
+        batch->results[pkt_idx] = PacketDisposition::DROP;
+        EXCLUDE_PACKET_MARK_ONLY(batch, pkt_idx);
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+        batch->has_dropped = true;
+        #endif
+    }
+
 private:
     friend class ElementGraph;
     friend class Element::OutputPort;
@@ -130,6 +212,23 @@ private:
     uint64_t branch_total = 0;
     uint64_t branch_miss = 0;
     uint64_t branch_count[NBA_MAX_ELEM_NEXTS];
+    /* Decayed output port histogram, used by the adaptive scheme. */
+    uint32_t branch_hist[NBA_MAX_ELEM_NEXTS];
+    /* Drops inside a fused chain are counted at its tail, and the
+     * cycles of a fused chain at its head. */
+    struct element_stat stat;
+    struct element_stat stat_exported;  /* The part already added to the node stats. */
+    /* Hardware counts of the sampled batches, in the order of io_thread_context::perf. */
+    uint64_t perf_sampled[NBA_PERF_MAX_EVENTS];
+    unsigned elem_idx;  /* The position in ElementGraph::elements, used in trace events. */
+
+    /* The element chains that ElementGraph runs in the same per-packet
+     * loop with this one, when the batch is processed by CPU
+     * (lb_decision == -1) or may be offloaded. */
+    struct fused_chain fused_cpu;
+    struct fused_chain fused_offl;
+
+    struct element_dispatch disp;
 
     FixedArray<Element*, NBA_MAX_ELEM_NEXTS> next_elems;
     FixedArray<int, NBA_MAX_ELEM_NEXTS> next_connected_inputs;
@@ -245,6 +344,15 @@ public:
     /** Resumes the element graph processing using the enqueued batches. */
     int dispatch(uint64_t loop_count, PacketBatch*& out_batch, uint64_t &next_delay);
 
+    /** Begins offloading the partially filled tasks.  It is used to
+     * drain the element graph retired by a reload, which receives no
+     * more batches to fill them up. */
+    int flush_offload(ElementGraph *mother);
+
+    /** Returns if there are batches waiting for offloading or for
+     * being resumed. */
+    bool has_pending_batches() const;
+
     /** Returns the list of supported devices for offloading. */
     virtual void get_supported_devices(std::vector<std::string> &device_names) const = 0;
     virtual size_t get_desired_workgroup_size(const char *device_name) const = 0;
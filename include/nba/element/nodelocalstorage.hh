@@ -33,6 +33,15 @@ class NodeLocalStorage {
      * of elements, and get_alloc() / get_rwlock() methods should be
      * called inside configure() method which is called per thread ( =
      * per element instance).
+     *
+     * The storage outlives element graphs.  When the graph is reloaded
+     * at runtime, alloc() with an existing key returns the existing
+     * entry with its contents intact, or -1 if it is smaller than the
+     * requested size (and then initialize_per_node() should fail so
+     * that the reload is rejected).  Such an entry is still in use by
+     * the running graph, so the elements of the new graph must treat it
+     * as read-only during initialization: check has() and skip
+     * rebuilding or resetting it.
      */
 public:
     NodeLocalStorage(unsigned node_id)
@@ -40,6 +49,7 @@ public:
         _node_id = node_id;
         for (int i = 0; i < NBA_MAX_NODELOCALSTORAGE_ENTRIES; i++) {
             _pointers[i] = NULL;
+            _sizes[i] = 0;
             //_rwlocks[i] = NULL;
         }
         rte_spinlock_init(&_node_lock);
@@ -53,6 +63,20 @@ public:
     int alloc(const char *key, size_t size)
     {
         rte_spinlock_lock(&_node_lock);
+        auto it = _keys.find(key);
+        if (it != _keys.end()) {
+            /* Reuse the state kept from the previous element graph. */
+            int kid = it->second;
+            size_t old_size = _sizes[kid];
+            rte_spinlock_unlock(&_node_lock);
+            if (size > old_size) {
+                RTE_LOG(ERR, ELEM, "NLS[%u]: cannot grow %s from %'lu to %'lu bytes\n",
+                        _node_id, key, old_size, size);
+                return -1;
+            }
+            RTE_LOG(DEBUG, ELEM, "NLS[%u]: reusing %s\n", _node_id, key);
+            return kid;
+        }
         size_t kid = _keys.size();
         assert(kid < NBA_MAX_NODELOCALSTORAGE_ENTRIES);
         _keys.insert(std::pair<std::string, int>(key, kid));
@@ -64,6 +88,7 @@ public:
         size_t real_size = 0;
         //assert(0 == rte_malloc_validate(ptr, &real_size));
         _pointers[kid] = ptr;
+        _sizes[kid] = size;
         RTE_LOG(DEBUG, ELEM, "NLS[%u]: malloc req size %'lu bytes, real size %'lu bytes\n", _node_id, size, real_size);
 
         //rte_rwlock_t *rwlock = (rte_rwlock_t *) rte_malloc_socket("nls_lock", sizeof(rte_rwlock_t), 64, _node_id);
@@ -75,6 +100,14 @@ public:
         return kid;
     }
 
+    bool has(const char *key)
+    {
+        rte_spinlock_lock(&_node_lock);
+        bool found = (_keys.find(key) != _keys.end());
+        rte_spinlock_unlock(&_node_lock);
+        return found;
+    }
+
     void* get_alloc(const char *key)
     {
         rte_spinlock_lock(&_node_lock);
@@ -117,6 +150,7 @@ protected:
     unsigned _node_id;
     //rte_rwlock_t *_rwlocks[NBA_MAX_NODELOCALSTORAGE_ENTRIES];
     void *_pointers[NBA_MAX_NODELOCALSTORAGE_ENTRIES];
+    size_t _sizes[NBA_MAX_NODELOCALSTORAGE_ENTRIES];
     std::unordered_map<std::string, int> _keys;
     rte_spinlock_t _node_lock;
 };
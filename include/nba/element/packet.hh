@@ -6,6 +6,7 @@
 #include <cassert>
 #include <rte_config.h>
 #include <rte_eal.h>
+#include <rte_byteorder.h>
 #include <rte_memcpy.h>
 #include <rte_mbuf.h>
 #include <rte_mempool.h>
@@ -23,6 +24,13 @@ enum PacketDisposition {
     PENDING,
 };
 
+/* Network-layer types cached by Packet::parse_headers(). */
+enum PacketL3Type : uint8_t {
+    NBA_L3_UNKNOWN = 0,
+    NBA_L3_IPV4,
+    NBA_L3_IPV6,
+};
+
 class PacketBatch;
 class Element;
 class VectorElement;
@@ -43,6 +51,11 @@ public:
 private:
     struct rte_mbuf *base;
     bool cloned;
+    /* Cached header offsets from data(), set by parse_headers(). */
+    uint8_t l3_type;
+    uint8_t l4_proto;
+    uint16_t l3_off;
+    uint16_t l4_off;
 public:
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST
     int prev_idx;
@@ -53,7 +66,9 @@ private:
 
     friend class Element;
     friend class VectorElement;
+    friend class ElementGraph;
     friend class DataBlock;
+    template<class... E> friend struct StaticChain;
 
 public:
     struct annotation_set anno;
@@ -93,12 +108,16 @@ public:
     magic(NBA_PACKET_MAGIC),
     #endif
     mother(mother), base((struct rte_mbuf *) base), cloned(false),
+    l3_type(NBA_L3_UNKNOWN), l4_proto(0), l3_off(0), l4_off(0),
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST
     prev_idx(-1), next_idx(-1),
     #endif
     bidx(-1)
     { }
 
+    /** The index in the mother batch, valid inside process(). */
+    inline int batch_index() const { return bidx; }
+
     ~Packet() {
         if (cloned && base != nullptr) {
             rte_pktmbuf_free(base);
@@ -107,6 +126,11 @@ public:
 
     void kill();
 
+    #if NBA_BATCH_SOA_META
+    /** Mirrors the cached header offsets to the mother batch's SoA metadata. */
+    void sync_header_meta();
+    #endif
+
     inline unsigned char *data() { return rte_pktmbuf_mtod(base, unsigned char *); }
     inline uint32_t length() { return rte_pktmbuf_data_len(base); }
     inline uint32_t headroom() { return rte_pktmbuf_headroom(base); }
@@ -118,10 +142,132 @@ public:
 
     inline bool shared() { return rte_mbuf_refcnt_read(base) > 1; }
 
-    inline void pull(uint32_t len) { rte_pktmbuf_adj(base, (uint16_t) len); }
+    inline void pull(uint32_t len)
+    {
+        rte_pktmbuf_adj(base, (uint16_t) len);
+        l3_off = (l3_off > len) ? l3_off - len : 0;
+        l4_off = (l4_off > len) ? l4_off - len : 0;
+        #if NBA_BATCH_SOA_META
+        sync_header_meta();
+        #endif
+    }
     inline void put(uint32_t len) { rte_pktmbuf_append(base, (uint16_t) len); }
     inline void take(uint32_t len) { rte_pktmbuf_trim(base, (uint16_t) len); }
 
+    /**
+     * Parses the L2/L3 headers and caches the offsets of the network and
+     * transport headers, skipping any number of VLAN/QinQ tags.
+     * The framework calls this once for every received packet, so
+     * elements should use the accessors below instead of assuming
+     * a fixed 14-byte Ethernet header.
+     * When the NIC has classified an untagged frame (packet_type),
+     * its result is used instead of reading the ether_type.
+     * Frames too short for their L3 header are left NBA_L3_UNKNOWN.
+     */
+    inline void parse_headers()
+    {
+        const unsigned char *p = data();
+        const uint32_t len = length();
+        uint16_t off = 14;  /* sizeof(struct ether_hdr) */
+        l3_type = NBA_L3_UNKNOWN;
+        #ifdef RTE_PTYPE_L2_MASK
+        const uint32_t ptype = base->packet_type;
+        if ((ptype & RTE_PTYPE_L2_MASK) == RTE_PTYPE_L2_ETHER
+            && (ptype & RTE_PTYPE_L3_MASK) != 0) {
+            if (RTE_ETH_IS_IPV4_HDR(ptype))
+                l3_type = NBA_L3_IPV4;
+            else if (RTE_ETH_IS_IPV6_HDR(ptype))
+                l3_type = NBA_L3_IPV6;
+        } else
+        #endif
+        {
+            uint16_t ether_type = (len >= off) ? *(const uint16_t *) (p + 12) : 0;
+            while ((ether_type == rte_cpu_to_be_16(0x8100)      /* 802.1Q */
+                    || ether_type == rte_cpu_to_be_16(0x88a8)   /* 802.1ad (QinQ) */
+                    || ether_type == rte_cpu_to_be_16(0x9100))
+                   && off + 4u <= len) {
+                ether_type = *(const uint16_t *) (p + off + 2);
+                off += 4;
+            }
+            if (ether_type == rte_cpu_to_be_16(0x0800))
+                l3_type = NBA_L3_IPV4;
+            else if (ether_type == rte_cpu_to_be_16(0x86dd))
+                l3_type = NBA_L3_IPV6;
+        }
+        if ((l3_type == NBA_L3_IPV4 && off + 20u > len)
+            || (l3_type == NBA_L3_IPV6 && off + 40u > len))
+            l3_type = NBA_L3_UNKNOWN;
+        l3_off = off;
+        switch (l3_type) {
+        case NBA_L3_IPV4:
+            l4_off = off + ((p[off] & 0x0f) << 2);
+            l4_proto = p[off + 9];
+            break;
+        case NBA_L3_IPV6:
+            /* Extension headers are not walked. */
+            l4_off = off + 40;
+            l4_proto = p[off + 6];
+            break;
+        default:
+            l4_off = off;
+            l4_proto = 0;
+            break;
+        }
+    }
+
+    inline PacketL3Type network_type() const { return (PacketL3Type) l3_type; }
+    inline bool has_network_header() const { return l3_type != NBA_L3_UNKNOWN; }
+    inline unsigned char *network_header() { return data() + l3_off; }
+    inline int network_header_offset() const { return l3_off; }
+    inline uint32_t network_header_length() const { return l4_off - l3_off; }
+
+    inline uint8_t transport_protocol() const { return l4_proto; }
+    inline unsigned char *transport_header() { return data() + l4_off; }
+    inline int transport_header_offset() const { return l4_off; }
+
+    /**
+     * Returns the NIC's verdict on the IPv4 header checksum:
+     * 1 if verified good, -1 if bad, and 0 if unknown (e.g., the port
+     * does not support it or HW_CSUM_OFFLOAD is disabled).
+     */
+    inline int rx_ip_csum_status() const
+    {
+        #ifdef PKT_RX_IP_CKSUM_GOOD
+        const uint64_t f = base->ol_flags & PKT_RX_IP_CKSUM_MASK;
+        if (f == PKT_RX_IP_CKSUM_GOOD)
+            return 1;
+        if (f == PKT_RX_IP_CKSUM_BAD)
+            return -1;
+        #else
+        if (base->ol_flags & PKT_RX_IP_CKSUM_BAD)
+            return -1;
+        #endif
+        return 0;
+    }
+
+    /**
+     * Requests the IPv4 header checksum to be computed at TX.
+     * The caller must zero the checksum field, and should use this only
+     * if comp_thread_context::hw_csum_offload is set.  For ports without
+     * the capability, the IO thread computes it in software.
+     */
+    inline void request_tx_ip_csum()
+    {
+        base->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+        base->l2_len = l3_off;
+        base->l3_len = l4_off - l3_off;
+    }
+
+    /** Updates the cached transport header after rewriting the network header. */
+    inline void set_transport_header(uint16_t offset, uint8_t protocol)
+    {
+        l4_off = offset;
+        l4_proto = protocol;
+        #if NBA_BATCH_SOA_META
+        sync_header_meta();
+        #endif
+    }
+
     Packet *clone() {
         Packet *q;
         struct rte_mbuf *q_base = rte_pktmbuf_clone(this->base, packet_pool);
@@ -138,8 +284,14 @@ public:
 
     Packet *push(uint32_t len) {
         char *new_start = rte_pktmbuf_prepend(base, len);
-        if (new_start != nullptr)
+        if (new_start != nullptr) {
+            l3_off += len;
+            l4_off += len;
+            #if NBA_BATCH_SOA_META
+            sync_header_meta();
+            #endif
             return this;
+        }
         return nullptr;
     }
 
@@ -155,18 +307,11 @@ public:
     inline void set_mac_header(unsigned char *p, uint32_t len);
     inline void clear_mac_header();
 
-    inline bool has_network_header();
-    inline unsigned char *network_header();
-    inline int network_header_offset();
-    inline uint32_t network_header_length();
     inline int network_length();
     inline void set_network_header(unsigned char *p, uint32_t len);
     inline void set_network_header_length(uint32_t len);
     inline void clear_network_header();
 
-    inline bool has_transport_header();
-    inline unsigned char *transport_header();
-    inline int transport_header_offset();
     inline int transport_length();
     inline void clear_transport_header();
 
@@ -5,6 +5,7 @@
 #include <nba/framework/datablock.hh>
 #include <nba/framework/task.hh>
 #include <nba/element/annotation.hh>
+#include <nba/element/packet.hh>
 #include <cstdint>
 #include <cstring>
 #include <vector>
@@ -12,6 +13,11 @@
 #include <rte_memory.h>
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
+#if defined(__AVX2__) && (NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR)
+extern "C" {
+#include <immintrin.h>
+}
+#endif
 
 extern "C" {
 struct rte_ring;
@@ -203,19 +209,30 @@ for (unsigned pkt_idx = 0; pkt_idx < batch->count; pkt_idx ++) { \
  * This scheme does not reorder packets.
  * The count includes both valid and invalid (excluded) packets.
  *
- * WARNING: the computation batch size must be <= 64.
+ * The mask is an array of 64-bit words so that the computation batch size
+ * may exceed 64.  Loops only visit the words covered by the batch count.
  */
 
-#define FOR_EACH_PACKET(batch) \
+#define NBA_BATCH_MASK_WORDS ((NBA_MAX_COMP_BATCH_SIZE + 63) / 64)
+
+/* Iterates over the set bits of the given mask words.
+ * (Compilers emit tzcnt/blsr for below when BMI is available.) */
+#define FOR_EACH_PACKET_IN_MASK(mask_words, count) \
 { \
-    uint64_t _mask = batch->mask; \
-    while (_mask != 0) { \
-        const unsigned pkt_idx = __builtin_ctzll(_mask); \
-        _mask &= ~(1llu << pkt_idx);
-#define END_FOR \
-    } /* endwhile(_mask) */ \
+    const unsigned _nw = ((count) + 63) >> 6; \
+    for (unsigned _w = 0; _w < _nw; _w++) { \
+        uint64_t _mask = (mask_words)[_w]; \
+        while (_mask != 0) { \
+            const unsigned pkt_idx = (_w << 6) + __builtin_ctzll(_mask); \
+            _mask &= _mask - 1;
+#define END_FOR_IN_MASK \
+        } /* endwhile(_mask) */ \
+    } /* endfor(_w) */ \
 }
 
+#define FOR_EACH_PACKET(batch) FOR_EACH_PACKET_IN_MASK(batch->mask, batch->count)
+#define END_FOR END_FOR_IN_MASK
+
 #define FOR_EACH_PACKET_ALL(batch) \
 { \
     for (unsigned pkt_idx = 0; pkt_idx < batch->count; pkt_idx ++) {
@@ -225,30 +242,25 @@ for (unsigned pkt_idx = 0; pkt_idx < batch->count; pkt_idx ++) { \
 
 #define FOR_EACH_PACKET_ALL_PREFETCH(batch, depth) \
 { \
-    uint64_t _pmask = batch->mask; \
-    uint64_t _mask = batch->mask; \
-    unsigned _cnt = 0; \
-    while (_pmask != 0 && _cnt < depth) { \
-        const unsigned pre_pkt_idx = __builtin_ctzll(_pmask); \
+    const unsigned _nw = (batch->count + 63) >> 6; \
+    unsigned _pw = 0, _w = 0; \
+    uint64_t _pmask = (_nw > 0) ? batch->mask[0] : 0; \
+    uint64_t _mask = _pmask; \
+    unsigned _cnt = 0, pre_pkt_idx, pkt_idx; \
+    while (_cnt < depth && nba::batch_mask_next(batch->mask, _nw, _pw, _pmask, pre_pkt_idx)) { \
         rte_prefetch0(rte_pktmbuf_mtod(batch->packets[pre_pkt_idx], void*)); \
-        _pmask &= ~(1llu << pre_pkt_idx); \
         _cnt ++; \
     } \
-    while (_mask != 0) { \
-        if (_pmask != 0) { \
-            const unsigned pre_pkt_idx = __builtin_ctzll(_pmask); \
-            rte_prefetch0(rte_pktmbuf_mtod(batch->packets[pre_pkt_idx], void*)); \
-            _pmask &= ~(1llu << pre_pkt_idx); \
-        } \
-        const unsigned pkt_idx = __builtin_ctzll(_mask); \
-        _mask &= ~(1llu << pkt_idx);
+    while (nba::batch_mask_next(batch->mask, _nw, _w, _mask, pkt_idx)) { \
+        if (nba::batch_mask_next(batch->mask, _nw, _pw, _pmask, pre_pkt_idx)) \
+            rte_prefetch0(rte_pktmbuf_mtod(batch->packets[pre_pkt_idx], void*));
 #define END_FOR_ALL_PREFETCH \
     } /* endwhile(batch) */ \
 }
 
 #define FOR_EACH_PACKET_ALL_INIT_PREFETCH(batch, depth) \
 { \
-    assert(batch->count <= 64); \
+    assert(batch->count <= NBA_MAX_COMP_BATCH_SIZE); \
     for (unsigned pkt_idx = 0; pkt_idx < RTE_MIN(depth, batch->count); pkt_idx++) { \
         rte_prefetch0(rte_pktmbuf_mtod(batch->packets[pkt_idx], void*)); \
         rte_prefetch0(Packet::from_base_nocheck(batch->packets[pkt_idx])); \
@@ -264,26 +276,31 @@ for (unsigned pkt_idx = 0; pkt_idx < batch->count; pkt_idx ++) { \
 
 #define INIT_BATCH_MASK(batch) \
 { \
-    batch->mask = (0xFFFFffffFFFFffffllu >> (64 - batch->count)); \
+    for (unsigned _w = 0; _w < NBA_BATCH_MASK_WORDS; _w++) { \
+        const unsigned _base = _w << 6; \
+        batch->mask[_w] = (batch->count >= _base + 64) ? ~0llu \
+                          : (batch->count <= _base) ? 0llu \
+                          : (~0llu >> (64 - (batch->count - _base))); \
+    } \
 }
 #define IS_PACKET_VALID(batch, pkt_idx) \
-    (likely((batch->mask & (1llu << pkt_idx)) == 1))
+    (likely(((batch->mask[(pkt_idx) >> 6] >> ((pkt_idx) & 63)) & 1llu) != 0))
 #define IS_PACKET_INVALID(batch, pkt_idx) \
-    (unlikely((batch->mask & (1llu << pkt_idx)) == 0))
+    (unlikely(((batch->mask[(pkt_idx) >> 6] >> ((pkt_idx) & 63)) & 1llu) == 0))
 #define EXCLUDE_PACKET(batch, pkt_idx) \
 { \
-    batch->mask &= ~(1llu << pkt_idx); \
+    batch->mask[(pkt_idx) >> 6] &= ~(1llu << ((pkt_idx) & 63)); \
     batch->packets[pkt_idx] = nullptr; \
 }
 #define EXCLUDE_PACKET_MARK_ONLY(batch, pkt_idx) \
 { \
-    batch->mask &= ~(1llu << pkt_idx); \
+    batch->mask[(pkt_idx) >> 6] &= ~(1llu << ((pkt_idx) & 63)); \
 }
 #define ADD_PACKET(batch, pkt) \
 { \
     int cnt = batch->count ++; \
     batch->packets[cnt] = pkt; \
-    batch->mask |= (1llu << cnt); \
+    batch->mask[cnt >> 6] |= (1llu << (cnt & 63)); \
     Packet::from_base(pkt)->mother = batch; \
 }
 
@@ -405,26 +422,142 @@ enum BatchDisposition {
     CONTINUE_TO_PROCESS = 0,
 };
 
+#if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
+/**
+ * Advances the cursor (w, m) to the next set bit over the given mask words
+ * and stores its index to idx.  Returns false at the end.
+ */
+static inline bool batch_mask_next(const uint64_t *mask, unsigned num_words,
+                                   unsigned &w, uint64_t &m, unsigned &idx)
+{
+    while (m == 0) {
+        if (++w >= num_words)
+            return false;
+        m = mask[w];
+    }
+    idx = (w << 6) + __builtin_ctzll(m);
+    m &= m - 1;
+    return true;
+}
+
+/**
+ * Returns the bitmask of the w-th 64 packets whose results are equal to
+ * the given value.  It does not take the batch mask into account.
+ * ElementGraph uses this to split the batches by output ports.
+ */
+static inline uint64_t batch_results_mask(const int *results, unsigned w, int value)
+{
+    const int *r = &results[w << 6];
+    uint64_t m = 0;
+    #if defined(__AVX2__) && (NBA_MAX_COMP_BATCH_SIZE % 64 == 0)
+    const __m256i v = _mm256_set1_epi32(value);
+    for (unsigned i = 0; i < 64; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) &r[i]), v);
+        m |= (uint64_t) (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+    #else
+    const unsigned n = RTE_MIN(64u, NBA_MAX_COMP_BATCH_SIZE - (w << 6));
+    for (unsigned i = 0; i < n; i++)
+        m |= (uint64_t) (r[i] == value) << i;
+    #endif
+    return m;
+}
+
+/**
+ * Splits the first num_words of the given mask by the packets whose
+ * results are equal to the given value: sel gets the matching packets and
+ * rest gets the others.  Both may alias mask.
+ * ElementGraph uses this to move packets out of or between batches.
+ */
+static inline void batch_mask_split(const uint64_t *mask, const int *results, unsigned num_words,
+                                    int value, uint64_t *sel, uint64_t *rest)
+{
+    unsigned w = 0;
+    #if defined(__AVX2__) && (NBA_MAX_COMP_BATCH_SIZE % 64 == 0)
+    for (; w + 4 <= num_words; w += 4) {
+        const __m256i r = _mm256_set_epi64x(batch_results_mask(results, w + 3, value),
+                                            batch_results_mask(results, w + 2, value),
+                                            batch_results_mask(results, w + 1, value),
+                                            batch_results_mask(results, w, value));
+        const __m256i m = _mm256_loadu_si256((const __m256i *) &mask[w]);
+        _mm256_storeu_si256((__m256i *) &rest[w], _mm256_andnot_si256(r, m));
+        _mm256_storeu_si256((__m256i *) &sel[w], _mm256_and_si256(r, m));
+    }
+    #endif
+    for (; w < num_words; w++) {
+        const uint64_t m = mask[w], r = batch_results_mask(results, w, value);
+        rest[w] = m & ~r;
+        sel[w] = m & r;
+    }
+}
+#endif
+
+#if NBA_BATCH_SOA_META
+#define NBA_META_NONE16 (0xffffu)
+#define NBA_META_NONE32 (0xffffffffu)
+
+/**
+ * A structure-of-arrays copy of hot per-packet metadata, indexed by pkt_idx.
+ * Batch-level loops and vector elements can read it with unit-stride loads
+ * instead of touching a separate annotation cacheline for each packet.
+ * The per-packet annotations remain authoritative; update them with
+ * pkt_anno_set() (or PacketBatch::meta_store()) to keep both in sync.
+ * Unset values are NBA_META_NONE16/NBA_META_NONE32.
+ */
+struct batch_meta {
+    bool valid;         /* The annotation arrays below are up-to-date. */
+    bool hdrs_valid;    /* The header offsets below are up-to-date. */
+    uint16_t iface_in[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
+    uint16_t iface_out[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
+    uint32_t flow_id[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
+    uint64_t timestamp[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
+    uint16_t l3_offset[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
+    uint16_t l4_offset[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
+};
+#endif
+
 class PacketBatch {
 public:
     PacketBatch()
-        : count(0),
-          #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
-          drop_count(0),
-          #endif
-          #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
-          mask(0),
-          #endif
-          #if NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST
-          first_idx(-1), last_idx(-1), slot_count(0),
-          #endif
-          datablock_states(nullptr), recv_timestamp(0),
-          generation(0), batch_id(0),
-          #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
-          has_dropped(false),
-          #endif
-          delay_start(0), compute_time(0)
     {
+        reset();
+    }
+
+    /**
+     * Re-initializes the per-batch header fields of a recycled batch.
+     * Unlike the constructor, it does not rewrite the vtable pointer, and
+     * the packets/results/excluded arrays are left untouched since they
+     * are only valid up to count and written when packets are added.
+     * (Only the bitvector mask is cleared because ADD_PACKET ORs into it.
+     * DEBUG builds still poison the whole arrays to catch stale reads.)
+     */
+    inline void reset()
+    {
+        count = 0;
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+        drop_count = 0;
+        has_dropped = false;
+        #endif
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
+        for (unsigned w = 0; w < NBA_BATCH_MASK_WORDS; w++)
+            mask[w] = 0;
+        #endif
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST
+        first_idx = -1;
+        last_idx = -1;
+        slot_count = 0;
+        #endif
+        datablock_states = nullptr;
+        recv_timestamp = 0;
+        generation = 0;
+        batch_id = 0;
+        delay_start = 0;
+        delay_time = 0;
+        compute_time = 0;
+        #if NBA_BATCH_SOA_META
+        meta.valid = false;
+        meta.hdrs_valid = false;
+        #endif
         #ifdef DEBUG
         memset(&results[0], 0xdd, sizeof(int) * NBA_MAX_COMP_BATCH_SIZE);
         #if (NBA_BATCHING_SCHEME == NBA_BATCHING_TRADITIONAL) \
@@ -455,12 +588,51 @@ public:
      * This may be called multiple times until reaching the next element.
      */
     void collect_excluded_packets();
+    #endif
 
+    #if NBA_BATCH_SOA_META
     /**
-     * Moves the collected excluded packets at the tail to drop_queue,
-     * and resets drop_count to zero.
+     * Returns the SoA metadata, gathering it from the per-packet
+     * annotations and header offsets first if it is not valid.  New batches created by
+     * branch splits start invalid; the RX path fills it directly.
      */
-    void clean_drops(struct rte_ring *drop_queue);
+    inline const struct batch_meta &load_meta()
+    {
+        if (unlikely(!meta.valid))
+            gather_meta();
+        return meta;
+    }
+
+    /** Mirrors an annotation update of the packet at pkt_idx. */
+    inline void meta_store(unsigned pkt_idx, unsigned anno_id, int64_t value)
+    {
+        if (!meta.valid)
+            return;
+        switch (anno_id) {
+        case NBA_ANNO_IFACE_IN:  meta.iface_in[pkt_idx] = (uint16_t) value; break;
+        case NBA_ANNO_IFACE_OUT: meta.iface_out[pkt_idx] = (uint16_t) value; break;
+        case NBA_ANNO_TIMESTAMP: meta.timestamp[pkt_idx] = (uint64_t) value; break;
+        case NBA_ANNO_IPSEC_FLOW_ID: meta.flow_id[pkt_idx] = (uint32_t) value; break;
+        default: break;
+        }
+    }
+
+    /** Moves the metadata row when a packet is moved inside the batch. */
+    inline void meta_move(unsigned dst_idx, unsigned src_idx)
+    {
+        if (meta.valid) {
+            meta.iface_in[dst_idx]  = meta.iface_in[src_idx];
+            meta.iface_out[dst_idx] = meta.iface_out[src_idx];
+            meta.flow_id[dst_idx]   = meta.flow_id[src_idx];
+            meta.timestamp[dst_idx] = meta.timestamp[src_idx];
+        }
+        if (meta.hdrs_valid) {
+            meta.l3_offset[dst_idx] = meta.l3_offset[src_idx];
+            meta.l4_offset[dst_idx] = meta.l4_offset[src_idx];
+        }
+    }
+
+    void gather_meta();
     #endif
 
     unsigned count;
@@ -468,7 +640,7 @@ public:
     unsigned drop_count;
     #endif
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
-    uint64_t mask;
+    uint64_t mask[NBA_BATCH_MASK_WORDS];
     #endif
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST
     int first_idx;
@@ -494,8 +666,25 @@ public:
     #endif
     struct rte_mbuf *packets[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
     int results[NBA_MAX_COMP_BATCH_SIZE] __cache_aligned;
+    #if NBA_BATCH_SOA_META
+    struct batch_meta meta __cache_aligned;
+    #endif
 };
 
+/**
+ * Sets a per-packet annotation and its copy in the mother batch's SoA
+ * metadata.  Use this instead of anno_set() inside process(), where
+ * the packet's batch index is current.
+ */
+static inline void pkt_anno_set(Packet *pkt, unsigned anno_id, int64_t value)
+{
+    anno_set(&pkt->anno, anno_id, value);
+    #if NBA_BATCH_SOA_META
+    if (pkt->mother != nullptr && pkt->batch_index() >= 0)
+        pkt->mother->meta_store((unsigned) pkt->batch_index(), anno_id, value);
+    #endif
+}
+
 }
 
 #endif
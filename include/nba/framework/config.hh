@@ -26,12 +26,28 @@
 #define NBA_BRANCHPRED_DISABLED     (0)    // disabled
 #define NBA_BRANCHPRED_ENABLED      (1)    // conditionally perform branch-pred
 #define NBA_BRANCHPRED_ALWAYS       (2)    // always perform branch-pred
+#define NBA_BRANCHPRED_ADAPTIVE     (3)    // choose per batch using decayed output histograms
+                                           // (the BRANCHPRED_SCHEME system parameter may
+                                           //  select any other scheme at runtime)
+#define NBA_BRANCHPRED_DECAY_SHIFT  (3)    // keep 7/8 of the histogram per batch
 
 #ifndef NBA_BRANCHPRED_SCHEME
 #define NBA_BRANCHPRED_SCHEME       NBA_BRANCHPRED_DISABLED
 #endif
 
 
+#define NBA_BRANCH_SPLIT_COPY       (0)    // copy packets of every branch to new batches
+#define NBA_BRANCH_SPLIT_INPLACE    (1)    // keep the largest branch in the original batch
+
+#ifndef NBA_BRANCH_SPLIT
+#define NBA_BRANCH_SPLIT            NBA_BRANCH_SPLIT_COPY
+#endif
+#if (NBA_BRANCH_SPLIT == NBA_BRANCH_SPLIT_INPLACE) \
+    && (NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST)
+#error "In-place branch split does not support the linked-list batching scheme."
+#endif
+
+
 #define NBA_REUSE_DATABLOCKS_DISABLED  (0)
 #define NBA_REUSE_DATABLOCKS_ENABLED   (1)
 
@@ -40,18 +56,29 @@
 #endif
 
 
+#define NBA_FUSE_ELEMENTS_DISABLED  (0)
+#define NBA_FUSE_ELEMENTS_ENABLED   (1)    // fuse linear groups of per-packet elements
+
+#ifndef NBA_FUSE_ELEMENTS
+#define NBA_FUSE_ELEMENTS           NBA_FUSE_ELEMENTS_DISABLED
+#endif
+
+
+#define NBA_BATCH_SOA_META_DISABLED (0)
+#define NBA_BATCH_SOA_META_ENABLED  (1)    // keep hot per-packet metadata as arrays in PacketBatch
+
+#ifndef NBA_BATCH_SOA_META
+#define NBA_BATCH_SOA_META          NBA_BATCH_SOA_META_DISABLED
+#endif
+
+
 #define NBA_MAX_PACKET_SIZE         (2048)
 #ifdef NBA_NO_HUGE
   #define NBA_MAX_IO_BATCH_SIZE      (4u)
   #define NBA_MAX_COMP_BATCH_SIZE    (4u)
 #else
-  #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
-    #define NBA_MAX_IO_BATCH_SIZE    (64u)
-    #define NBA_MAX_COMP_BATCH_SIZE  (64u)
-  #else
-    #define NBA_MAX_IO_BATCH_SIZE    (256u)
-    #define NBA_MAX_COMP_BATCH_SIZE  (256u)
-  #endif
+  #define NBA_MAX_IO_BATCH_SIZE    (256u)
+  #define NBA_MAX_COMP_BATCH_SIZE  (256u)
 #endif
 #define NBA_MAX_COMP_PREPKTQ_LENGTH (256u)
 #if defined(NBA_PMD_MLX4) || defined(NBA_PMD_MLNX_UIO)
@@ -69,6 +96,34 @@
 
 #define NBA_MAX_TASKPOOL_SIZE       (2048u)
 #define NBA_MAX_BATCHPOOL_SIZE      (2048u)
+#define NBA_FREELIST_SIZE           (64u)   // Per-thread object cache in front of batch/task pools.
+#define NBA_MAX_BRANCHPRED_SCHEME   NBA_BRANCHPRED_ADAPTIVE
+#define NBA_MAX_BRANCHPRED_MISS_PERCENT (100u)
+#define NBA_MAX_TX_BUFFER_SIZE      (256u)
+#define NBA_MAX_TX_FLUSH_USEC       (10000u)
+#define NBA_DROP_BUFFER_SIZE        (256u)  // Dropped mbufs freed together per IO thread.
+#define NBA_MAX_ELEMENTS            (128u)  // Elements per ElementGraph.
+#define NBA_MAX_ELEM_STAT_SAMPLE    (65536u)
+#define NBA_MAX_STATS_SHM           (1)
+#define NBA_MAX_TRACE               (1)
+#define NBA_MAX_TRACE_EVENTS        (1u << 22)  // Per-thread trace ring capacity.
+#define NBA_MAX_HW_CSUM_OFFLOAD     (1)
+#define NBA_MAX_RSS_RETA_SIZE       (512u)  // ETH_RSS_RETA_SIZE_512; must be a power of two.
+#define NBA_MAX_RSS_REBALANCE       (1)
+#define NBA_MAX_RSS_REBALANCE_THRESHOLD (1000u)
+#define NBA_MAX_RSS_REBALANCE_HOLDOFF   (3600u)
+#define NBA_MAX_WORK_STEALING       (1)
+#define NBA_STEAL_QUEUES            (16u)   // Flow partitions shared by the IO threads in a node; must be a power of two.
+#define NBA_STEAL_RING_SIZE         (256u)  // Max bundles queued per partition.
+#define NBA_STEAL_HYSTERESIS        (64u)   // Loop iterations to confirm (un)overloading before (un)shedding a partition.
+#define NBA_MAX_IO_COMP_SPLIT       (1)
+#define NBA_SPLIT_RING_SIZE         (64u)   // Bundles in flight between a split IO thread and its comp thread, per direction.
+#define NBA_MAX_IDLE_POLL           (2)     // 0: busy polling, 1: idle backoff, 2: idle backoff with RX interrupts.
+#define NBA_IDLE_PAUSE_POLLS        (64u)   // Empty polls before pausing between polls.
+#define NBA_IDLE_SLEEP_POLLS        (1024u) // Empty polls before sleeping between polls.
+#define NBA_IDLE_INTR_POLLS         (4096u) // Empty polls before waiting for RX interrupts.
+#define NBA_IDLE_SLEEP_USEC         (50u)
+#define NBA_IDLE_INTR_TIMEOUT_MS    (10)    // Bounds the interrupt wait so that timers and async events are served.
 #ifdef USE_KNAPP
 #define NBA_MAX_IO_BASES    (7)
 #else
@@ -78,9 +133,9 @@
 #define NBA_MAX_NODELOCALSTORAGE_ENTRIES    (16)
 #define NBA_MAX_KERNEL_OVERLAP      (8)
 #define NBA_MAX_DATABLOCKS          (12)    // If too large (e.g., 64), batch_pool can not be allocated.
+#define NBA_MAX_FUSED_ELEMENTS      (16)    // Max length of a fused element chain.
 
 #define NBA_OQ                      (true)  // Use output-queuing semantics when possible.
-#undef NBA_CPU_MICROBENCH                  // Enable support for PAPI library for microbenchmarks.
 
 #undef NBA_IPFWD_RR_NODE_LOCAL
 
@@ -149,6 +204,8 @@ extern std::vector<struct queue_conf> queue_confs;
  * the initialization code of io/comp/coproc threads. */
 extern std::unordered_map<void*, int> queue_idx_map;
 extern bool dummy_device;
+/* Comma-separated hardware counters to collect per thread (empty: none). */
+extern std::string perf_events;
 
 bool load_config(const char* pyfilename);
 int get_ht_degree(void);
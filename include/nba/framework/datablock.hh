@@ -44,6 +44,8 @@ enum ReadROIType {
     READ_PARTIAL_PACKET = 1,  // Packet segment with fixed size.
     READ_WHOLE_PACKET   = 2,  // Whole packet. (whose size can be dynamic)
     READ_USER_PREPROC   = 3,  // Uses preproc_batch() instead of direct copy.
+    READ_PARTIAL_NETWORK = 4, // Same as READ_PARTIAL_PACKET, but the offset is
+                              // from each packet's network header.
 };
 
 enum WriteROIType {
@@ -26,6 +26,7 @@ enum ElementOffloadingActions : int {
 class Element;
 class OffloadTask;
 class PacketBatch;
+struct io_node_stat;
 
 struct offload_action_key {
     void *elemptr;
@@ -35,8 +36,10 @@ struct offload_action_key {
 
 class ElementGraph {
 public:
-    ElementGraph(comp_thread_context *ctx);
-    virtual ~ElementGraph() {}
+    /* The generation distinguishes the graphs built by reloads from
+     * the first one in the same comp thread. */
+    ElementGraph(comp_thread_context *ctx, unsigned generation = 0);
+    virtual ~ElementGraph();
 
     int count()
     {
@@ -66,6 +69,18 @@ public:
     /* Start processing with the given batch and the entry point. */
     void feed_input(int entry_point_idx, PacketBatch *batch, uint64_t loop_count);
 
+    /* Pushes out all batches and offload tasks left in the graph after
+     * it is replaced by a reload.  Returns true when none of them
+     * remains in flight so that the graph can be destroyed. */
+    bool drain(uint64_t loop_count);
+
+    /* Called when an offload task sent by this graph has returned from
+     * the device. */
+    void finish_offload_task()
+    {
+        num_running_tasks --;
+    }
+
     void add_offload_action(struct offload_action_key *key);
     bool check_preproc(OffloadableElement *oel, int dbid);
     bool check_postproc(OffloadableElement *oel, int dbid);
@@ -84,11 +99,41 @@ public:
 
     /**
      * Validate the element graph.
-     * Currently, this checks the writer-reader pairs of structured
-     * annotations.
+     * Currently, this precomputes the dispatch information of each
+     * element used by process_batch().  It must be called after all
+     * elements are added and linked.
      */
     int validate();
 
+    /**
+     * Fuses each linear group of per-packet elements so that
+     * process_batch() runs their process() handlers back-to-back for
+     * each packet, and scans the results only at the group boundaries.
+     * Elements with their own batch loop run it in place inside the chain.
+     * This requires the graph analysis results (linear groups).
+     */
+    void fuse_linear_groups();
+
+    #ifdef NBA_STATIC_GRAPH
+    /**
+     * Replaces the generic per-packet loops of fused chains with the ones
+     * compiled from the configuration at build time, if their element
+     * types match.  This must be called after fuse_linear_groups().
+     */
+    void bind_static_chains();
+    #endif
+
+    #if NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE
+    /* Logs how many times each branch split path has run per element. */
+    void print_branch_stats();
+    #endif
+
+    /* Adds the element counters since the last call to the node stats. */
+    void export_stats(struct io_node_stat *node_stat);
+
+    /* Logs the element counters of this thread. */
+    void print_elem_stats();
+
     /**
      * Returns the list of all elements.
      */
@@ -128,11 +173,28 @@ private:
      * (e.g., completion of offloading or release of resources), it moves
      * the batch to the delayed_batches queue. */
     void process_batch(PacketBatch *batch);
+
+    /* Runs the head element and its fused subsequent elements in a
+     * single per-packet loop.  Returns the last element of the chain. */
+    Element *process_fused(Element *head, const struct fused_chain &fc,
+                           int input_port, PacketBatch *batch,
+                           bool &has_offloadable);
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    /* Frees the excluded packets collected at the tail of the batch,
+     * counting them as dropped by elem if given. */
+    void drop_excluded(Element *elem, PacketBatch *batch);
+    #endif
     void process_offload_task(OffloadTask *otask);
     void send_offload_task_to_device(OffloadTask *task);
 
     struct rte_hash *offl_actions;
 
+    /* Batches left until the next one whose cycles are measured. */
+    unsigned elem_stat_countdown;
+
+    /* Offload tasks sent to the device and not returned yet. */
+    unsigned num_running_tasks;
+
     /* The entry point of packet processing pipeline (graph). */
     SchedulableElement *input_elem;
 };
@@ -31,6 +31,9 @@ public:
      *  individual elements that are already instantiated. */
     void analyze(ParseInfo* pi);
 
+    /** Same as above, for the elements linked by GraphMetaData::link(). */
+    void analyze(const std::vector<GraphMetaData*> &roots);
+
     const std::vector<std::vector<GraphMetaData*> > &get_linear_groups();
 
 private:
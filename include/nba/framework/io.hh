@@ -2,8 +2,14 @@
 #define __NBA_IO_HH__
 
 #include <nba/core/intrinsic.hh>
+#include <nba/core/histogram.hh>
 #include <nba/framework/config.hh>
+#include <nba/framework/shmstats.hh>
 #include <rte_atomic.h>
+#include <rte_spinlock.h>
+#include <rte_mempool.h>
+#include <rte_ring.h>
+#include <rte_mbuf.h>
 
 namespace nba {
 
@@ -37,6 +43,46 @@ struct io_thread_stat {
     struct io_port_stat port_stats[NBA_MAX_PORTS];
 } __cache_aligned;
 
+/* Per-element counters summed over the comp threads in a node,
+ * indexed by the element's position in ElementGraph.
+ * (See struct element_stat.) */
+struct io_elem_stat_atomic {
+    rte_atomic64_t num_batches;
+    rte_atomic64_t num_pkts_in;
+    rte_atomic64_t num_drops;
+    rte_atomic64_t num_sampled_pkts;
+    rte_atomic64_t num_sampled_cycles;
+    rte_atomic64_t num_branch_hits;
+    rte_atomic64_t num_branch_misses;
+    rte_atomic64_t num_branch_predicted;
+    rte_atomic64_t num_branch_copied;
+};
+
+struct io_elem_stat {
+    uint64_t num_batches;
+    uint64_t num_pkts_in;
+    uint64_t num_drops;
+    uint64_t num_sampled_pkts;
+    uint64_t num_sampled_cycles;
+    uint64_t num_branch_hits;
+    uint64_t num_branch_misses;
+    uint64_t num_branch_predicted;
+    uint64_t num_branch_copied;
+};
+
+/* Per-port RSS load samples and the shadow of the NIC's redirection
+ * table (RETA), maintained by the node master for rebalancing. */
+struct io_rss_port_state {
+    uint16_t reta_size;         /* 0 if this node does not rebalance the port. */
+    unsigned holdoff;           /* Remaining stat periods to skip after an update. */
+    bool rxq_polled[NBA_MAX_QUEUES_PER_PORT];
+    uint16_t rxq_owner[NBA_MAX_QUEUES_PER_PORT];   /* local_thread_idx of the polling IO thread */
+    rte_atomic64_t rxq_pkts[NBA_MAX_QUEUES_PER_PORT];
+    rte_atomic64_t rxq_busy_cycles[NBA_MAX_QUEUES_PER_PORT];
+    rte_atomic64_t bucket_pkts[NBA_MAX_RSS_RETA_SIZE];  /* indexed by (rss hash % NBA_MAX_RSS_RETA_SIZE) */
+    uint16_t reta[NBA_MAX_RSS_RETA_SIZE];
+} __cache_aligned;
+
 struct io_node_stat {
     unsigned node_id;
     uint64_t last_time;
@@ -44,9 +90,56 @@ struct io_node_stat {
     unsigned num_threads;
     unsigned num_ports;
     struct io_port_stat_atomic port_stats[NBA_MAX_PORTS];
+
+    bool rss_rebalance;
+    unsigned rss_threshold;     /* in percent of the coldest queue's load */
+    unsigned rss_holdoff;       /* in stat periods */
+    struct io_rss_port_state rss[NBA_MAX_PORTS];
+    rte_atomic64_t thread_busy_cycles[NBA_MAX_CORES];   /* indexed by local_thread_idx */
+
+    unsigned elem_stat_sample;  /* 0 if element stats are not exported. */
+    unsigned num_elems;
+    const char *elem_names[NBA_MAX_ELEMENTS];
+    struct io_elem_stat_atomic elem_stats[NBA_MAX_ELEMENTS];
+    struct io_elem_stat elem_totals[NBA_MAX_ELEMENTS];  /* cumulative, only for the node master */
+
+    /* Merged from SystemInspector of the comp threads. */
+    rte_spinlock_t latency_lock;
+    LogHistogram<> pkt_latency_hist;
+    LogHistogram<> task_latency_hist;
+    LogHistogram<> queue_delay_hist;
+
+    struct shm_section *shm_section;    /* nullptr if not exported */
+} __cache_aligned;
+
+/* Packets of the same flow partition, published by an overloaded IO
+ * thread for others in the same node to process. */
+struct io_steal_bundle {
+    unsigned count;
+    struct rte_mbuf *pkts[NBA_MAX_COMP_BATCH_SIZE];
+};
+
+struct io_steal_queue {
+    struct rte_ring *ring;      /* FIFO of io_steal_bundle */
+    rte_atomic32_t owner;       /* 1 while a thread is draining the ring. */
 } __cache_aligned;
 
+struct io_node_steal {
+    struct rte_mempool *bundle_pool;
+    struct io_steal_queue queues[NBA_STEAL_QUEUES];
+} __cache_aligned;
+
+/* Packets handed between a split IO thread and its comp thread.
+ * (See IO_ROLE_RXTX and IO_ROLE_COMP.) */
+struct io_split_bundle {
+    unsigned count;
+    uint16_t out_ports[NBA_MAX_COMP_BATCH_SIZE];    /* used for TX only */
+    struct rte_mbuf *pkts[NBA_MAX_COMP_BATCH_SIZE];
+};
+
 void io_tx_batch(struct io_thread_context *ctx, PacketBatch *batch);
+void io_tx_flush(struct io_thread_context *ctx, bool force);
+void io_drop_flush(struct io_thread_context *ctx);
 //void *io_loop(void *arg);
 int io_loop(void *arg);
 
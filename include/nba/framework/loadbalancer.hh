@@ -1,6 +1,7 @@
 #ifndef __LOADBALANCER_HH__
 #define __LOADBALANCER_HH__
 
+#include <nba/core/histogram.hh>
 #include <nba/framework/config.hh>
 #include <nba/framework/computedevice.hh>
 #include <vector>
@@ -59,6 +60,12 @@ public:
     uint64_t batch_proc_time;
     double pkt_proc_cycles[NBA_MAX_COPROCESSOR_TYPES + 1];
 
+    /* Latency distributions in TSC cycles since the last stat period.
+     * The IO stat timer merges them into the node stats and resets them. */
+    LogHistogram<> pkt_latency_hist;    // from recv_timestamp to TX, per packet
+    LogHistogram<> task_latency_hist;   // offload task completion, per task
+    LogHistogram<> queue_delay_hist;    // waiting for a room in offload tasks, per batch
+
     //const unsigned PPC_HISTORY_SIZES[2] = {128, 2048};
     const unsigned PPC_HISTORY_SIZES[2] = {512, 512};
 };
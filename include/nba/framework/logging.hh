@@ -12,6 +12,15 @@
 #define RTE_LOGTYPE_ELEM    RTE_LOGTYPE_USER5
 #define RTE_LOGTYPE_LB      RTE_LOGTYPE_USER6
 
+/* RTE_LOG() filters by level only at runtime, so the arguments are still
+ * evaluated and rte_log() is still called in release builds.
+ * Use this one for debug messages in per-packet paths. */
+#ifdef DEBUG
+#define NBA_LOG_DEBUG(t, ...) RTE_LOG(DEBUG, t, __VA_ARGS__)
+#else
+#define NBA_LOG_DEBUG(t, ...) do { } while (0)
+#endif
+
 #endif // __NBA_LOG_HH__
 
 // vim: ts=8 sts=4 sw=4 et
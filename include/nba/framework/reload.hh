@@ -0,0 +1,42 @@
+#ifndef __NBA_RELOAD_HH__
+#define __NBA_RELOAD_HH__
+
+/**
+ * Hot reconfiguration of the element graph.
+ *
+ * On SIGHUP, a background thread re-reads the pipeline configuration
+ * given at startup (replace the file or the symlink it points to) and
+ * builds a new ElementGraph for each comp thread, while the current
+ * graphs keep processing packets.  Node-local storage is shared by key
+ * across graphs, so elements keep their tables (e.g., FIBs) instead of
+ * rebuilding them.  The new graph must not modify them while it is
+ * being initialized, as the running graph is still reading them.  Each comp thread swaps in its new graph between
+ * batches and destroys the old one once the batches and offload tasks
+ * in flight there have drained.
+ *
+ * A configuration that fails to parse or to initialize (e.g., needs a
+ * larger table than the kept one) is rejected and the current graph
+ * stays.  With coprocessor threads, it cannot add offloadable
+ * element classes that are not running yet, because their device-side
+ * initialization happens only at startup.
+ */
+
+#include <vector>
+
+namespace nba {
+
+class comp_thread_context;
+
+/* Spawns the reload thread for the given comp threads.
+ * Call it after their first element graphs are initialized. */
+int reload_setup(const std::vector<comp_thread_context *> &ctxs,
+                 const char *config_path, bool use_coprocessors);
+
+/* Requests a reload.  It is async-signal-safe. */
+void reload_request();
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,83 @@
+#ifndef __NBA_SHMSTATS_HH__
+#define __NBA_SHMSTATS_HH__
+
+/**
+ * Live statistics exported to a POSIX shared memory segment.
+ *
+ * The segment has a fixed header followed by sections.  Each section
+ * has exactly one writer: the node master for per-node counters and
+ * each IO thread for its own counters, all updated once a stat period.
+ * A writer makes seq odd while rewriting the section, so readers retry
+ * their copy if seq was odd or has changed meanwhile (seqlock).
+ * Readers only map the segment read-only and never block the writers.
+ * It is enabled by the STATS_SHM system parameter (off by default).
+ * An instance never takes over the segment of another live one.
+ *
+ * Counter names are Prometheus metric names with labels, e.g.,
+ * 'nba_port_rx_packets{node="0",port="1"}'.
+ * scripts/nba-stat.py parses this layout; bump NBA_SHM_STATS_VERSION
+ * whenever it changes.
+ */
+
+#include <cstdint>
+
+#define NBA_SHM_STATS_NAME      "/nba-stats"
+#define NBA_SHM_STATS_MAGIC     (0x5341424eu)   // "NBAS" in little endian
+#define NBA_SHM_STATS_VERSION   (1u)
+#define NBA_SHM_NAME_LEN        (112u)
+#define NBA_SHM_MAX_COUNTERS    (1024u)         // per section
+
+namespace nba {
+
+enum shm_counter_type : uint32_t {
+    SHM_COUNTER = 0,    // monotonically increasing
+    SHM_GAUGE = 1,
+};
+
+struct shm_counter {
+    char name[NBA_SHM_NAME_LEN];
+    uint32_t type;
+    uint32_t _reserved;
+    uint64_t value;
+};
+static_assert(sizeof(struct shm_counter) == 128, "shm_counter layout must be fixed.");
+
+struct shm_section {
+    volatile uint32_t seq;
+    uint32_t num_counters;
+    uint64_t update_usec;       // CLOCK_MONOTONIC time of the last update
+    char _reserved[48];
+    struct shm_counter counters[NBA_SHM_MAX_COUNTERS];
+};
+static_assert(sizeof(struct shm_section) == 64 + 128 * NBA_SHM_MAX_COUNTERS,
+              "shm_section layout must be fixed.");
+
+struct shm_stats {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_sections;
+    uint32_t pid;
+    uint64_t tsc_hz;
+    char _reserved[40];
+    struct shm_section sections[0];
+};
+static_assert(sizeof(struct shm_stats) == 64, "shm_stats layout must be fixed.");
+
+/**
+ * Creates (or replaces) the named segment with the given number of
+ * sections.  Returns nullptr if shared memory is not available.
+ */
+struct shm_stats *shmstats_create(const char *name, unsigned num_sections);
+void shmstats_destroy(const char *name, struct shm_stats *stats);
+
+/* A writer wraps its shmstats_add() calls with below. */
+void shmstats_begin(struct shm_section *sec);
+void shmstats_add(struct shm_section *sec, enum shm_counter_type type, uint64_t value,
+                  const char *name_fmt, ...) __attribute__((format(printf, 4, 5)));
+void shmstats_commit(struct shm_section *sec);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,89 @@
+#ifndef __NBA_STATICGRAPH_HH__
+#define __NBA_STATICGRAPH_HH__
+
+#include <nba/element/element.hh>
+#include <nba/element/packet.hh>
+#include <nba/element/packetbatch.hh>
+#include <cstddef>
+
+namespace nba {
+
+/* Casts the given chain of element instances to their concrete types
+ * into typed, the argument for static_chain_fn.
+ * Returns false if the types do not match. */
+typedef bool (*static_chain_binder)(Element *const *chain, void **typed);
+
+struct static_chain_info {
+    const char *signature;      /* Comma-separated class names of the chain. */
+    static_chain_binder bind;
+    static_chain_fn run;
+};
+
+/* Generated from the configuration given as NBA_STATIC_GRAPH at build time.
+ * (See the "staticgraph" rule in Snakefile.) */
+extern const struct static_chain_info static_chains[];
+extern const size_t num_static_chains;
+
+/**
+ * A per-packet loop over a fixed sequence of element types.
+ * Since the concrete types are known at compile time, process() of each
+ * element is called directly without vtable lookups.  The build compiles
+ * the elements with LTO so that these calls are inlined at link time.
+ */
+template<class... E>
+struct StaticChain;
+
+template<>
+struct StaticChain<> {
+    static inline bool cast(Element *const *chain, void **typed) { return true; }
+    static inline void process(void *const *typed, const int *input_ports,
+                               Packet *pkt, const int &result) { }
+};
+
+template<class Head, class... Tail>
+struct StaticChain<Head, Tail...> {
+
+    static inline bool cast(Element *const *chain, void **typed)
+    {
+        /* Elements may inherit Element virtually, so we need dynamic_cast
+         * here.  This is done only once when binding. */
+        Head *elem = dynamic_cast<Head *>(chain[0]);
+        if (elem == nullptr)
+            return false;
+        typed[0] = elem;
+        return StaticChain<Tail...>::cast(chain + 1, typed + 1);
+    }
+
+    static inline void process(void *const *typed, const int *input_ports,
+                               Packet *pkt, const int &result)
+    {
+        static_cast<Head *>(typed[0])->Head::process(input_ports[0], pkt);
+        /* Same as the generic fused loop: anything other than pushing
+         * to port 0 ends the chain for this packet. */
+        if (result != 0)
+            return;
+        StaticChain<Tail...>::process(typed + 1, input_ports + 1, pkt, result);
+    }
+
+    static bool bind(Element *const *chain, void **typed)
+    {
+        static_assert(1 + sizeof...(Tail) <= NBA_MAX_FUSED_ELEMENTS,
+                      "The chain is longer than NBA_MAX_FUSED_ELEMENTS.");
+        return cast(chain, typed);
+    }
+
+    static void run(void *const *typed, const int *input_ports, PacketBatch *batch)
+    {
+        FOR_EACH_PACKET(batch) {
+            Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+            pkt->bidx = pkt_idx;
+            process(typed, input_ports, pkt, batch->results[pkt_idx]);
+        } END_FOR;
+    }
+};
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -19,6 +19,11 @@ typedef std::function<void(size_t pkt_idx, struct Packet *p)>
 extern PacketBatch *create_batch(size_t num_pkts, size_t pkt_size,
                                  pkt_init_callback_t init_cb);
 
+/* Re-initializes the packets of a batch from create_batch() so that
+ * it can be processed again by elements, reusing the same mbufs. */
+extern void reset_batch(PacketBatch *batch, size_t num_pkts, size_t pkt_size,
+                        pkt_init_callback_t init_cb);
+
 extern void free_batch(PacketBatch *batch);
 
 } // endns(testing)
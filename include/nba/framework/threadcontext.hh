@@ -2,10 +2,13 @@
 #define __NBA_THREADCONTEXT_HH__
 
 #include <nba/core/intrinsic.hh>
+#include <nba/core/freelist.hh>
+#include <nba/core/perfctr.hh>
 #include <nba/core/queue.hh>
 #include <nba/framework/config.hh>
 #include <cstdint>
 #include <cstdbool>
+#include <atomic>
 #include <string>
 #include <set>
 #include <vector>
@@ -36,6 +39,7 @@ class NodeLocalStorage;
 class OffloadTask;
 class comp_thread_context;
 struct io_port_stat;
+struct shm_section;
 
 struct core_location {
     unsigned node_id;
@@ -56,6 +60,38 @@ struct new_packet
     int out_port;
 };
 
+/* Packets collected across computation batches for a TX port. */
+struct io_tx_buffer {
+    unsigned count;
+    uint64_t deadline;      /* TSC by which the buffer must be flushed. */
+    struct rte_mbuf *pkts[NBA_MAX_TX_BUFFER_SIZE];
+};
+
+/* Dropped packets whose mbufs are returned to their mempools in bulk.
+ * (See io_drop_flush().) */
+struct io_drop_buffer {
+    unsigned count;
+    struct rte_mbuf *pkts[NBA_DROP_BUFFER_SIZE];
+};
+
+/* What an io_loop() instance runs.  With IO_COMP_SPLIT, each IO thread
+ * is paired with a comp thread on a separate core. */
+enum io_thread_role {
+    IO_ROLE_ALL = 0,    /* RX, the element graph, and TX on the same core */
+    IO_ROLE_RXTX = 1,   /* RX and TX only, exchanging packets with the peer below */
+    IO_ROLE_COMP = 2,   /* the element graph only */
+};
+
+/* Where io_thread_context::perf_counts are attributed to.
+ * TX runs nested in the comp stage, so its counts are moved out of there
+ * when the comp stage of each loop iteration ends. */
+enum io_perf_stage {
+    IO_PERF_RX = 0,
+    IO_PERF_COMP = 1,
+    IO_PERF_TX = 2,
+    IO_PERF_NUM_STAGES = 3,
+};
+
 /* Thread arguments for each types of thread */
 
 struct io_thread_context {
@@ -69,40 +105,67 @@ struct io_thread_context {
     struct core_location loc;
     struct ev_loop *loop;
     bool loop_broken;
+    unsigned num_batch_waiters;  // nested ev_run() calls waiting for free batches
     unsigned num_hw_rx_queues;
     unsigned num_tx_ports;
     unsigned num_iobatch_size;
     unsigned num_io_threads;
     uint64_t last_tx_tick;
+    unsigned num_txbuf_size;     // flush a tx_buffer when it has this many packets
+    uint64_t tx_flush_cycles;    // ...or when its oldest packet has waited this long
+    uint32_t tx_pending_ports;   // bitmask of non-empty tx_buffers
+    static_assert(NBA_MAX_PORTS <= 32, "tx_pending_ports must have a bit for each port.");
+    uint32_t tx_csum_ports;      // bitmask of ports computing TX IPv4 checksums in hardware
     uint64_t global_tx_cnt;
     uint64_t tx_pkt_thruput;
     uint64_t LB_THRUPUT_WINDOW_SIZE;
     int emul_packet_size;
     int emul_ip_version;
     int mode;
+    enum io_thread_role role;
+    struct rte_ring *split_rx_ring;          // IO_ROLE_RXTX -> IO_ROLE_COMP, single-producer/consumer
+    struct rte_ring *split_tx_ring;          // IO_ROLE_COMP -> IO_ROLE_RXTX, single-producer/consumer
+    struct rte_mempool *split_bundle_pool;   // io_split_bundle objects shared by the pair
     struct hwrxq rx_hwrings[NBA_MAX_PORTS * NBA_MAX_QUEUES_PER_PORT];
     struct ev_timer *stat_timer;
     struct io_port_stat *port_stats;
     struct io_thread_context *node_master_ctx;
-#ifdef NBA_CPU_MICROBENCH
-    int papi_evset_rx;
-    int papi_evset_tx;
-    int papi_evset_comp;
-    long long papi_ctr_rx[5];
-    long long papi_ctr_tx[5];
-    long long papi_ctr_comp[5];
-#endif
+    bool rss_rebalance;
+    uint64_t busy_cycles;        // TSC cycles spent in loop iterations that received packets
+    uint32_t *rss_bucket_pkts;   // [port][NBA_MAX_RSS_RETA_SIZE], only if rss_rebalance
+    uint64_t rx_hwring_pkts[NBA_MAX_PORTS * NBA_MAX_QUEUES_PER_PORT];
+    bool work_stealing;
+    struct io_node_steal *node_steal;
+    uint32_t steal_shed_mask;    // steal queues published to instead of processed locally
+    static_assert(NBA_STEAL_QUEUES <= 32, "steal_shed_mask must have a bit for each steal queue.");
+    unsigned steal_streak;       // consecutive loop iterations in the current load state
+    bool steal_overloaded;       // the current load state
+    unsigned steal_next_queue;   // where to start looking for work to steal
+    int idle_poll_mode;          // 0: busy polling, 1: backoff, 2: backoff and RX interrupts
+    unsigned idle_polls;         // consecutive loop iterations without any work
+    uint32_t rx_intr_ports;      // bitmask of ports configured with RX interrupts
+    bool rx_intr_ready;          // all rx_hwrings are registered to this thread's epoll instance
+    struct shm_section *shm_section;  // this thread's live stats, or nullptr
+    uint64_t total_recv_pkts;    // cumulative over all ports, for shm_section
+    uint64_t total_sent_pkts;
+    uint64_t total_sw_drop_pkts;
+    uint64_t total_tx_drop_pkts;
+    PerfCounterGroup *perf;      // hardware counters of this thread, or nullptr
+    uint64_t perf_counts[IO_PERF_NUM_STAGES][NBA_PERF_MAX_EVENTS];  // cumulative
+    uint64_t perf_reported[IO_PERF_NUM_STAGES][NBA_PERF_MAX_EVENTS];
+    uint64_t perf_tx_nested[NBA_PERF_MAX_EVENTS];  // TX counts not yet moved out of comp
 
     char _reserved1[64];
 
     struct rte_ring *rx_queue;
     struct ev_async *rx_watcher;
     struct port_info tx_ports[NBA_MAX_PORTS];
+    struct io_tx_buffer tx_buffers[NBA_MAX_PORTS];
     comp_thread_context *comp_ctx;
 
     char _reserved2[64]; // to prevent false-sharing
 
-    struct rte_ring *drop_queue;
+    struct io_drop_buffer drop_buffer;
     struct rte_ring *tx_queues[NBA_MAX_PORTS];
 
     struct rte_mempool* rx_pools[NBA_MAX_PORTS];
@@ -133,11 +196,12 @@ public:
     void stop_rx();
     void resume_rx();
 
-    void build_element_graph(const char* config);       // builds element graph
-    void initialize_graph_global();
-    void initialize_graph_per_node();
-    void initialize_graph_per_thread();
+    int build_element_graph(const char* config, ElementGraph *graph);    // builds element graph
+    void initialize_graph_global(ElementGraph *graph);
+    int initialize_graph_per_node(ElementGraph *graph);
+    void initialize_graph_per_thread(ElementGraph *graph);
     void initialize_offloadables_per_node(ComputeDevice *device);
+    void update_element_graph(uint64_t loop_count);     // swaps in a reloaded graph
     void io_tx_new(void* data, size_t len, int out_port);
 public:
     struct ev_async *terminate_watcher;
@@ -158,13 +222,24 @@ public:
     unsigned num_batchpool_size;
     unsigned num_taskpool_size;
     unsigned task_completion_queue_size;
+    unsigned branchpred_scheme;     // NBA_BRANCHPRED_*, used only by the adaptive build
+    unsigned branchpred_miss_percent;
     bool preserve_latency;
+    bool hw_csum_offload;   // elements may request TX checksum offloads
+    unsigned elem_stat_sample;  // measure element cycles for 1 in this many batches (0: never)
 
     struct rte_mempool *batch_pool;
     struct rte_mempool *dbstate_pool;
     struct rte_mempool *task_pool;
     struct rte_mempool *packet_pool;
+    /* Thread-private caches of the above pools.  Always use these instead
+     * of the pools directly in the comp thread. */
+    FreeList<NBA_FREELIST_SIZE> batch_freelist;
+    FreeList<NBA_FREELIST_SIZE> dbstate_freelist;
+    FreeList<NBA_FREELIST_SIZE> task_freelist;
     ElementGraph *elem_graph;
+    std::atomic<ElementGraph *> pending_graph;  // built by the reload thread
+    ElementGraph *retiring_graph;               // draining after a reload
     SystemInspector *inspector;
     FixedRing<ComputeContext *> *cctx_list;
     PacketBatch *input_batch;
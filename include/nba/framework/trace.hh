@@ -0,0 +1,110 @@
+#ifndef __NBA_TRACE_HH__
+#define __NBA_TRACE_HH__
+
+/**
+ * Binary event tracing of the batch and offload lifecycles.
+ *
+ * Each IO/comp and coproc thread records TSC-stamped events into its
+ * own TraceRing, keeping the latest events only.  Recording is always
+ * compiled in and costs a single branch while tracing is disabled.
+ * Tracing starts enabled if the TRACE system parameter is set and is
+ * toggled by SIGUSR2 at runtime.  All rings are dumped to a file at
+ * exit, which scripts/nba-trace.py converts to the Chrome trace format
+ * viewable in chrome://tracing or Perfetto.
+ *
+ * File layout (little endian):
+ *   trace_file_header
+ *   char[NBA_TRACE_NAME_LEN] * num_elements  (indexed by TRACE_ELEM_* arg0)
+ *   { trace_file_thread, trace_event * num_events } * num_threads
+ * Bump NBA_TRACE_FILE_VERSION whenever it changes.
+ */
+
+#include <nba/core/intrinsic.hh>
+#include <nba/core/tracering.hh>
+#include <cstdint>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+
+#define NBA_TRACE_FILE_MAGIC    "NBATRACE"
+#define NBA_TRACE_FILE_VERSION  (1u)
+#define NBA_TRACE_NAME_LEN      (32u)
+
+namespace nba {
+
+enum trace_event_type : uint16_t {
+    TRACE_RX_BURST = 0,         // arg0: #packets, arg1: port << 16 | rxq
+    TRACE_BATCH_ALLOC,          // arg0: #packets, arg1: batch
+    TRACE_ELEM_ENTER,           // arg0: element index, arg1: batch
+    TRACE_ELEM_EXIT,            // arg0: element index, arg1: batch
+    TRACE_OFFLOAD_ENQUEUE,      // arg0: #batches, arg1: task
+    TRACE_H2D_BEGIN,            // arg1: task (same for below)
+    TRACE_H2D_END,
+    TRACE_KERNEL_BEGIN,         // kernel launch
+    TRACE_KERNEL_END,
+    TRACE_KERNEL_DONE,          // the kernel is seen finished
+    TRACE_D2H_BEGIN,
+    TRACE_D2H_END,
+    TRACE_TASK_DONE,            // the results are seen copied back
+    TRACE_COMPLETION_BEGIN,     // postprocessing in the comp thread
+    TRACE_COMPLETION_END,
+    TRACE_TX,                   // arg0: #packets, arg1: batch
+    NUM_TRACE_EVENT_TYPES
+};
+
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_threads;
+    uint64_t tsc_hz;
+    uint32_t num_elements;
+    uint32_t num_event_types;
+};
+
+struct trace_file_thread {
+    char name[NBA_TRACE_NAME_LEN];
+    uint32_t tid;
+    uint32_t num_events;
+    uint64_t num_overwritten;
+};
+
+extern volatile bool trace_enabled;
+extern thread_local TraceRing *trace_ring;
+extern rte_atomic32_t trace_toggled;
+
+static inline void trace_record(enum trace_event_type type, uint32_t arg0, uint64_t arg1)
+{
+    if (unlikely(trace_enabled) && trace_ring != nullptr)
+        trace_ring->push(type, rte_rdtsc(), arg0, arg1);
+}
+
+/** Called once by the main thread before spawning any threads. */
+void trace_setup(bool enabled, unsigned events_per_thread);
+
+/** Allocates and registers the calling thread's ring. */
+void trace_init_thread(const char *name, unsigned node_id);
+
+/** Registers the element names of the running ElementGraph.
+ *  Called again when a reloaded graph is swapped in. */
+void trace_set_element_names(unsigned num_elements, const char *const *names);
+
+/** Starts or stops tracing.  It is async-signal-safe, so the change is
+ *  logged later by trace_report_toggle(). */
+void trace_toggle();
+
+void trace_report_toggle();
+
+/** Logs the last trace_toggle(), once, from the IO loops. */
+static inline void trace_poll()
+{
+    if (unlikely(rte_atomic32_read(&trace_toggled) != 0))
+        trace_report_toggle();
+}
+
+/** Writes all rings to the file.  Call after all threads have stopped. */
+int trace_dump(const char *path);
+
+}
+
+#endif
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,151 @@
+#! /usr/bin/env python3
+
+'''
+This script reads the live statistics that a running NBA process exports
+to POSIX shared memory (see include/nba/framework/shmstats.hh).
+It maps the segment read-only, so it never blocks nor perturbs the
+datapath.  With "--prometheus" option, it prints the text exposition
+format which can be served by the node exporter's textfile collector.
+'''
+
+import argparse
+import mmap
+import os
+import re
+import struct
+import sys
+import time
+
+SHM_MAGIC = 0x5341424e
+SHM_VERSION = 1
+HEADER_FMT = '<IIIIQ'
+HEADER_SIZE = 64
+SECTION_HEADER_FMT = '<IIQ'
+SECTION_HEADER_SIZE = 64
+NAME_LEN = 112
+COUNTER_FMT = '<{0}sIIQ'.format(NAME_LEN)
+COUNTER_SIZE = 128
+MAX_COUNTERS = 1024
+SECTION_SIZE = SECTION_HEADER_SIZE + COUNTER_SIZE * MAX_COUNTERS
+TYPE_NAMES = {0: 'counter', 1: 'gauge'}
+MAX_RETRIES = 100
+
+
+def open_segment(name):
+    path = '/dev/shm/' + name.lstrip('/')
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        return mmap.mmap(fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+    finally:
+        os.close(fd)
+
+
+def read_header(mm):
+    magic, version, num_sections, pid, tsc_hz = struct.unpack_from(HEADER_FMT, mm, 0)
+    if magic != SHM_MAGIC:
+        raise RuntimeError('The segment is not initialized yet (bad magic).')
+    if version != SHM_VERSION:
+        raise RuntimeError('Unsupported layout version {0} (expected {1}).'
+                           .format(version, SHM_VERSION))
+    if len(mm) < HEADER_SIZE + SECTION_SIZE * num_sections:
+        raise RuntimeError('The segment is truncated.')
+    return num_sections, pid, tsc_hz
+
+
+def read_section(mm, idx):
+    '''Takes a consistent copy of a section using its seqlock.'''
+    base = HEADER_SIZE + SECTION_SIZE * idx
+    for _ in range(MAX_RETRIES):
+        seq, num_counters, update_usec = struct.unpack_from(SECTION_HEADER_FMT, mm, base)
+        if seq & 1:
+            time.sleep(0.0001)
+            continue
+        num_counters = min(num_counters, MAX_COUNTERS)
+        start = base + SECTION_HEADER_SIZE
+        raw = mm[start:start + COUNTER_SIZE * num_counters]
+        seq2, = struct.unpack_from('<I', mm, base)
+        if seq2 != seq:
+            continue
+        counters = []
+        for i in range(num_counters):
+            name, ctype, _, value = struct.unpack_from(COUNTER_FMT, raw, COUNTER_SIZE * i)
+            name = name.split(b'\0', 1)[0].decode('ascii', 'replace')
+            counters.append((name, ctype, value))
+        return update_usec, counters
+    return None, []
+
+
+def read_all(mm):
+    num_sections, pid, tsc_hz = read_header(mm)
+    counters = []
+    for idx in range(num_sections):
+        update_usec, sec_counters = read_section(mm, idx)
+        if update_usec is None:
+            print('warning: section {0} is too busy; skipped.'.format(idx), file=sys.stderr)
+        counters.extend(sec_counters)
+    return pid, counters
+
+
+def print_plain(pid, counters):
+    print('# pid {0}, {1}'.format(pid, time.strftime('%Y-%m-%d %H:%M:%S')))
+    width = max((len(name) for name, _, _ in counters), default=0)
+    for name, _, value in counters:
+        print('{0:<{1}} {2}'.format(name, width, value))
+
+
+def print_prometheus(counters):
+    declared = set()
+    for name, ctype, value in counters:
+        family = name.split('{', 1)[0]
+        if family not in declared:
+            print('# TYPE {0} {1}'.format(family, TYPE_NAMES.get(ctype, 'untyped')))
+            declared.add(family)
+        print('{0} {1}'.format(name, value))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Read live statistics of a running NBA process.')
+    parser.add_argument('--name', default='/nba-stats',
+                        help='The shared memory segment name. (default: %(default)s)')
+    parser.add_argument('--prometheus', action='store_true', default=False,
+                        help='Print in the Prometheus text exposition format.')
+    parser.add_argument('--filter', default=None,
+                        help='Print only the counters whose names match the given regex.')
+    parser.add_argument('--watch', type=float, default=0, metavar='SEC',
+                        help='Repeat printing every given seconds.')
+    args = parser.parse_args()
+
+    pattern = re.compile(args.filter) if args.filter else None
+    try:
+        mm = open_segment(args.name)
+    except OSError as e:
+        print('Cannot open the segment {0}: {1}'.format(args.name, e), file=sys.stderr)
+        sys.exit(1)
+    try:
+        while True:
+            pid, counters = read_all(mm)
+            if pattern is not None:
+                counters = [c for c in counters if pattern.search(c[0])]
+            if args.prometheus:
+                print_prometheus(counters)
+            else:
+                print_plain(pid, counters)
+            sys.stdout.flush()
+            if args.watch <= 0:
+                break
+            time.sleep(args.watch)
+            if not args.prometheus:
+                print()
+    except RuntimeError as e:
+        print(e, file=sys.stderr)
+        sys.exit(1)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        mm.close()
+
+
+if __name__ == '__main__':
+    main()
+
+# vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,186 @@
+#! /usr/bin/env python3
+
+'''
+This script converts a binary trace dumped by NBA (see
+include/nba/framework/trace.hh) into the Chrome trace event format,
+which can be opened with chrome://tracing or https://ui.perfetto.dev.
+With "--summary" option, it also prints the average time each offload
+task spends in its stages, to find pipelining gaps between the comp
+and coproc threads.
+'''
+
+import argparse
+from collections import defaultdict
+import json
+import struct
+import sys
+
+TRACE_MAGIC = b'NBATRACE'
+TRACE_VERSION = 1
+NAME_LEN = 32
+HEADER_FMT = '<8sIIQII'
+THREAD_FMT = '<{0}sIIQ'.format(NAME_LEN)
+EVENT_FMT = '<QHHIQ'
+
+(RX_BURST, BATCH_ALLOC, ELEM_ENTER, ELEM_EXIT, OFFLOAD_ENQUEUE,
+ H2D_BEGIN, H2D_END, KERNEL_BEGIN, KERNEL_END, KERNEL_DONE,
+ D2H_BEGIN, D2H_END, TASK_DONE, COMPLETION_BEGIN, COMPLETION_END, TX) = range(16)
+
+# Synchronous spans in a thread: begin type -> (end type, name)
+SPANS = {
+    H2D_BEGIN: (H2D_END, 'h2d-issue'),
+    KERNEL_BEGIN: (KERNEL_END, 'kernel-launch'),
+    D2H_BEGIN: (D2H_END, 'd2h-issue'),
+    COMPLETION_BEGIN: (COMPLETION_END, 'completion'),
+}
+# Asynchronous spans of a task across threads: begin type -> (end type, name)
+TASK_SPANS = {
+    OFFLOAD_ENQUEUE: (COMPLETION_END, 'task'),
+    KERNEL_END: (KERNEL_DONE, 'kernel'),
+    D2H_END: (TASK_DONE, 'd2h'),
+}
+# Offload task stages for the summary, in order.
+STAGES = [
+    (OFFLOAD_ENQUEUE, H2D_BEGIN, 'input queue'),
+    (H2D_BEGIN, KERNEL_END, 'h2d + launch'),
+    (KERNEL_END, KERNEL_DONE, 'kernel'),
+    (KERNEL_DONE, TASK_DONE, 'd2h'),
+    (TASK_DONE, COMPLETION_BEGIN, 'completion queue'),
+    (COMPLETION_BEGIN, COMPLETION_END, 'postprocessing'),
+]
+
+
+def read_trace(f):
+    data = f.read()
+    magic, version, num_threads, tsc_hz, num_elements, _ = struct.unpack_from(HEADER_FMT, data, 0)
+    if magic != TRACE_MAGIC:
+        raise RuntimeError('Not an NBA trace file.')
+    if version != TRACE_VERSION:
+        raise RuntimeError('Unsupported trace version {0} (expected {1}).'.format(version, TRACE_VERSION))
+    off = struct.calcsize(HEADER_FMT)
+    elem_names = []
+    for _ in range(num_elements):
+        name, = struct.unpack_from('{0}s'.format(NAME_LEN), data, off)
+        elem_names.append(name.split(b'\0', 1)[0].decode())
+        off += NAME_LEN
+    threads = []
+    event_size = struct.calcsize(EVENT_FMT)
+    for _ in range(num_threads):
+        name, tid, num_events, num_overwritten = struct.unpack_from(THREAD_FMT, data, off)
+        off += struct.calcsize(THREAD_FMT)
+        events = [struct.unpack_from(EVENT_FMT, data, off + event_size * i)
+                  for i in range(num_events)]
+        off += event_size * num_events
+        threads.append({
+            'name': name.split(b'\0', 1)[0].decode(),
+            'tid': tid,
+            'overwritten': num_overwritten,
+            'events': events,
+        })
+    return tsc_hz, elem_names, threads
+
+
+def convert(tsc_hz, elem_names, threads):
+    base_tsc = min((t['events'][0][0] for t in threads if t['events']), default=0)
+    to_usec = lambda tsc: (tsc - base_tsc) * 1e6 / tsc_hz
+    out = [{'ph': 'M', 'pid': 0, 'name': 'process_name', 'args': {'name': 'nba'}}]
+    open_tasks = {}
+    for t in threads:
+        tid = t['tid']
+        out.append({'ph': 'M', 'pid': 0, 'tid': tid, 'name': 'thread_name',
+                    'args': {'name': t['name']}})
+        depth = defaultdict(int)
+        for tsc, etype, _, arg0, arg1 in t['events']:
+            ts = to_usec(tsc)
+            base = {'pid': 0, 'tid': tid, 'ts': ts}
+            if etype == ELEM_ENTER or etype == ELEM_EXIT:
+                name = elem_names[arg0] if arg0 < len(elem_names) else 'elem{0}'.format(arg0)
+                key = ('elem', arg0)
+                if etype == ELEM_ENTER:
+                    depth[key] += 1
+                    out.append(dict(base, ph='B', cat='elem', name=name, args={'batch': hex(arg1)}))
+                elif depth[key] > 0:
+                    depth[key] -= 1
+                    out.append(dict(base, ph='E', cat='elem', name=name))
+            elif etype in SPANS:
+                depth[etype] += 1
+                out.append(dict(base, ph='B', cat='offload', name=SPANS[etype][1],
+                                args={'task': hex(arg1)}))
+            elif any(etype == end for end, _ in SPANS.values()):
+                begin = next(b for b, (end, _) in SPANS.items() if end == etype)
+                if depth[begin] > 0:
+                    depth[begin] -= 1
+                    out.append(dict(base, ph='E', cat='offload', name=SPANS[begin][1]))
+            elif etype == RX_BURST:
+                out.append(dict(base, ph='i', s='t', cat='io', name='rx',
+                                args={'pkts': arg0, 'port': arg1 >> 16, 'rxq': arg1 & 0xffff}))
+            elif etype == BATCH_ALLOC:
+                out.append(dict(base, ph='i', s='t', cat='io', name='batch-alloc',
+                                args={'pkts': arg0, 'batch': hex(arg1)}))
+            elif etype == TX:
+                out.append(dict(base, ph='i', s='t', cat='io', name='tx',
+                                args={'pkts': arg0, 'batch': hex(arg1)}))
+            # Task spans may cross threads, so they are matched separately.
+            for begin, (end, name) in TASK_SPANS.items():
+                if etype == begin:
+                    open_tasks[(begin, arg1)] = True
+                    args = {'batches': arg0} if etype == OFFLOAD_ENQUEUE else {}
+                    out.append(dict(base, ph='b', cat='task', name=name, id=hex(arg1), args=args))
+                elif etype == end and open_tasks.pop((begin, arg1), None):
+                    out.append(dict(base, ph='e', cat='task', name=name, id=hex(arg1)))
+    return out
+
+
+def summarize(tsc_hz, threads):
+    all_events = sorted((ev for t in threads for ev in t['events']), key=lambda ev: ev[0])
+    last_seen = {}
+    stage_sums = defaultdict(float)
+    stage_counts = defaultdict(int)
+    for tsc, etype, _, _, task in all_events:
+        for begin, end, name in STAGES:
+            if etype == end and (begin, task) in last_seen:
+                stage_sums[name] += (tsc - last_seen.pop((begin, task))) * 1e6 / tsc_hz
+                stage_counts[name] += 1
+        if any(etype == begin for begin, _, _ in STAGES):
+            last_seen[(etype, task)] = tsc
+    print('# threads', file=sys.stderr)
+    for t in threads:
+        print('  {0:<24} {1:>10} events ({2} overwritten)'.format(
+              t['name'], len(t['events']), t['overwritten']), file=sys.stderr)
+    print('# offload task stages (avg usec)', file=sys.stderr)
+    for _, _, name in STAGES:
+        cnt = stage_counts[name]
+        avg = stage_sums[name] / cnt if cnt else 0
+        print('  {0:<24} {1:>10.2f} ({2} tasks)'.format(name, avg, cnt), file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert an NBA binary trace to the Chrome trace format.')
+    parser.add_argument('input', help='The trace file dumped by NBA (e.g., nba-trace.bin)')
+    parser.add_argument('-o', '--output', default=None,
+                        help='The output JSON file. (default: the input name with .json)')
+    parser.add_argument('--summary', action='store_true', default=False,
+                        help='Print the per-thread event counts and offload stage latencies.')
+    args = parser.parse_args()
+
+    try:
+        with open(args.input, 'rb') as f:
+            tsc_hz, elem_names, threads = read_trace(f)
+    except (OSError, RuntimeError, struct.error) as e:
+        print('Cannot read {0}: {1}'.format(args.input, e), file=sys.stderr)
+        sys.exit(1)
+    output = args.output
+    if output is None:
+        output = (args.input[:-4] if args.input.endswith('.bin') else args.input) + '.json'
+    with open(output, 'w') as f:
+        json.dump({'traceEvents': convert(tsc_hz, elem_names, threads),
+                   'displayTimeUnit': 'ns'}, f)
+    print('Wrote {0}'.format(output), file=sys.stderr)
+    if args.summary:
+        summarize(tsc_hz, threads)
+
+
+if __name__ == '__main__':
+    main()
+
+# vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,480 @@
+#! /usr/bin/env python3
+
+'''
+This script runs end-to-end pipeline benchmarks without NICs nor a
+remote packet generator, to catch performance regressions of the
+framework.  Each pipeline in configs/*.click runs over DPDK virtual
+devices (net_pcap or net_null) with a fixed traffic profile, and its
+Mpps, cycles/packet and latency percentiles are read from the live
+statistics in shared memory (see scripts/nba-stat.py).
+
+The results are saved as JSON, which can be compared with a baseline
+saved earlier on the same machine:
+
+  scripts/run_regression.py -o base.json                  # record
+  scripts/run_regression.py -b base.json -o new.json      # compare
+
+It exits with 1 if any metric got worse than its threshold.
+
+net_pcap replays a pcap file of the profile.  Since net_pcap of old
+DPDK versions stops at the end of the file, the packets are streamed
+through a FIFO by default; use "--infinite-rx" for DPDK 19.08 or later.
+The throughput may be bounded by libpcap reading the packets, so
+compare cycles/packet rather than Mpps across different machines.
+'''
+
+import argparse
+import importlib.util
+import json
+import os
+import random
+import re
+import signal
+import socket
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+BASELINE_VERSION = 1
+
+# name: (click configuration, traffic profile)
+PIPELINES = {
+    'l2fwd-echo': ('l2fwd-echo.click', 'ipv4'),
+    'ipv4-router': ('ipv4-router-cpuonly.click', 'ipv4'),
+    'ipv6-router': ('ipv6-router-cpuonly.click', 'ipv6'),
+    'ipsec-encryption': ('ipsec-encryption-cpuonly.click', 'ipsec'),
+}
+DEFAULT_PIPELINES = ['l2fwd-echo', 'ipv4-router', 'ipv6-router', 'ipsec-encryption']
+
+# metric: (higher is better, default threshold in percent)
+METRICS = {
+    'rx_mpps': (True, 5.0),
+    'tx_mpps': (True, 5.0),
+    'cycles_per_pkt': (False, 5.0),
+    'elem_cycles_per_pkt': (False, 5.0),
+    'latency_p50_ns': (False, 15.0),
+    'latency_p99_ns': (False, 15.0),
+    'latency_p999_ns': (False, 25.0),
+}
+
+_spec = importlib.util.spec_from_file_location(
+    'nba_stat', os.path.join(os.path.dirname(os.path.abspath(__file__)), 'nba-stat.py'))
+nba_stat = importlib.util.module_from_spec(_spec)
+_spec.loader.exec_module(nba_stat)
+
+
+def ip_checksum(hdr):
+    s = sum(struct.unpack('!{0}H'.format(len(hdr) // 2), hdr))
+    s = (s & 0xffff) + (s >> 16)
+    s = (s & 0xffff) + (s >> 16)
+    return (~s) & 0xffff
+
+
+def make_packet(profile, seq, pkt_size, rng):
+    '''Builds a UDP packet of the profile, of pkt_size bytes without FCS.'''
+    eth_dst = b'\x02\x00\x00\x00\x00\x01'
+    eth_src = b'\x02\x00\x00\x00\x00\x00'
+    if profile in ('ipv4', 'ipsec'):
+        # IPsec elements have SAs for 10.0.0.1-10.0.4.0 (1024 tunnels).
+        if profile == 'ipsec':
+            daddr = 0x0a000001 + seq % 1024
+        else:
+            daddr = rng.getrandbits(32)
+        iph = struct.pack('!BBHHHBBHII', 0x45, 0, pkt_size - 14, seq & 0xffff, 0,
+                          64, 17, 0, 0x0a000001, daddr)
+        iph = iph[:10] + struct.pack('!H', ip_checksum(iph)) + iph[12:]
+        udph = struct.pack('!HHHH', 1234, 80, pkt_size - 14 - 20, 0)
+        hdr = eth_dst + eth_src + b'\x08\x00' + iph + udph
+    elif profile == 'ipv6':
+        saddr = b'\x20\x01' + b'\x00' * 13 + b'\x01'
+        daddr = rng.getrandbits(128).to_bytes(16, 'big')
+        plen = pkt_size - 14 - 40
+        iph = struct.pack('!IHBB', 6 << 28, plen, 17, 64) + saddr + daddr
+        udph = struct.pack('!HHHH', 1234, 80, plen, 0)
+        hdr = eth_dst + eth_src + b'\x86\xdd' + iph + udph
+    else:
+        raise ValueError('Unknown traffic profile: {0}'.format(profile))
+    return hdr + b'\x00' * (pkt_size - len(hdr))
+
+
+def pcap_header():
+    return struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1)
+
+
+def pcap_records(profile, num_pkts, pkt_size, seed):
+    rng = random.Random(seed)
+    chunks = []
+    for seq in range(num_pkts):
+        pkt = make_packet(profile, seq, pkt_size, rng)
+        chunks.append(struct.pack('<IIII', seq // 1000000, seq % 1000000, len(pkt), len(pkt)))
+        chunks.append(pkt)
+    return b''.join(chunks)
+
+
+def stream_fifo(path, records):
+    '''Keeps writing the records to the FIFO in a child process until the reader closes it.'''
+    pid = os.fork()
+    if pid != 0:
+        return pid
+    try:
+        signal.signal(signal.SIGINT, signal.SIG_DFL)
+        with open(path, 'wb', buffering=0) as f:
+            f.write(pcap_header())
+            while True:
+                f.write(records)
+    except (BrokenPipeError, KeyboardInterrupt):
+        pass
+    finally:
+        os._exit(0)
+
+
+def node0_cpus():
+    with open('/sys/devices/system/node/node0/cpulist') as f:
+        cpus = []
+        for part in f.read().strip().split(','):
+            if '-' in part:
+                begin, end = map(int, part.split('-'))
+                cpus.extend(range(begin, end + 1))
+            else:
+                cpus.append(int(part))
+        return cpus
+
+
+_label_re = re.compile(r'(\w+)="([^"]*)"')
+
+
+def parse_counters(counters):
+    '''Returns a list of (family, labels, value) from the raw counters.'''
+    parsed = []
+    for name, _, value in counters:
+        family, _, rest = name.partition('{')
+        parsed.append((family, dict(_label_re.findall(rest)), value))
+    return parsed
+
+
+def take_sample(mm, pid):
+    try:
+        seg_pid, counters = nba_stat.read_all(mm)
+    except (RuntimeError, ValueError, struct.error):
+        return None
+    if seg_pid != pid:
+        return None
+    return time.monotonic(), parse_counters(counters)
+
+
+def total(sample, family, **labels):
+    return sum(v for f, l, v in sample[1]
+               if f == family and all(l.get(k) == val for k, val in labels.items()))
+
+
+def summarize(first, last, latency_samples):
+    elapsed = last[0] - first[0]
+    delta = lambda family, **labels: total(last, family, **labels) - total(first, family, **labels)
+    rx_pkts = delta('nba_port_rx_packets')
+    tx_pkts = delta('nba_port_tx_packets')
+    result = {
+        'rx_mpps': rx_pkts / elapsed / 1e6,
+        'tx_mpps': tx_pkts / elapsed / 1e6,
+        'cycles_per_pkt': None,
+        'ipc': None,
+        'elem_cycles_per_pkt': None,
+        'elements': {},
+    }
+    thread_pkts = delta('nba_thread_rx_packets')
+    cycles = delta('nba_thread_perf_events', event='cycles')
+    insts = delta('nba_thread_perf_events', event='instructions')
+    if thread_pkts > 0 and cycles > 0:
+        result['cycles_per_pkt'] = cycles / thread_pkts
+        result['ipc'] = insts / cycles if insts > 0 else None
+    elem_names = sorted({(l['idx'], l['element']) for f, l, _ in last[1]
+                         if f == 'nba_element_sampled_packets'}, key=lambda t: int(t[0]))
+    elem_total = 0
+    for idx, name in elem_names:
+        pkts = delta('nba_element_sampled_packets', idx=idx)
+        if pkts > 0:
+            per_pkt = delta('nba_element_sampled_cycles', idx=idx) / pkts
+            result['elements']['{0}:{1}'.format(idx, name)] = per_pkt
+            elem_total += per_pkt
+    if elem_total > 0:
+        result['elem_cycles_per_pkt'] = elem_total
+    for pct in ('p50', 'p99', 'p999'):
+        values = [v for v in latency_samples[pct] if v > 0]
+        result['latency_{0}_ns'.format(pct)] = statistics.median(values) if values else None
+    return result
+
+
+def run_pipeline(args, name, tmpdir):
+    click_name, profile = PIPELINES.get(name, (name + '.click', args.profile or 'ipv4'))
+    if args.profile:
+        profile = args.profile
+    click_path = os.path.join('configs', click_name)
+    if not os.path.isfile(click_path):
+        raise RuntimeError('{0} does not exist.'.format(click_path))
+
+    cpus = node0_cpus()
+    if len(cpus) < args.cores + 1:
+        raise RuntimeError('Not enough cores in node 0.')
+    vdevs = []
+    feeders = []
+    if args.vdev == 'pcap':
+        records = pcap_records(profile, args.num_trace_pkts, args.pkt_size, args.seed)
+        for port in range(args.ports):
+            rx_args = []
+            for q in range(args.cores):
+                path = os.path.join(tmpdir, '{0}-p{1}q{2}.pcap'.format(name, port, q))
+                if args.infinite_rx:
+                    if not os.path.exists(path):
+                        with open(path, 'wb') as f:
+                            f.write(pcap_header())
+                            f.write(records)
+                else:
+                    os.mkfifo(path)
+                    feeders.append(stream_fifo(path, records))
+                rx_args.append('rx_pcap=' + path)
+            vdevs.append('--vdev=net_pcap{0},{1},{2}{3}'.format(
+                port, ','.join(rx_args), ','.join('tx_pcap=/dev/null' for _ in range(args.cores)),
+                ',infinite_rx=1' if args.infinite_rx else ''))
+    else:
+        for port in range(args.ports):
+            vdevs.append('--vdev=net_null{0},size={1}'.format(port, args.pkt_size))
+
+    cmd = [args.main_bin,
+           '-l', ','.join(map(str, cpus[:args.cores + 1])),
+           '-n', os.environ.get('NBA_MEM_CHANNELS', '4'),
+           '--no-pci', '--file-prefix', 'nba-regression']
+    cmd += vdevs + args.eal_args + ['--', 'configs/vdev.py', click_path]
+    env = dict(os.environ)
+    env.update({
+        'NBA_VDEV_CORES': str(args.cores),
+        'NBA_STATS_SHM': '1',
+        'NBA_ELEM_STAT_SAMPLE': str(args.elem_stat_sample),
+        'NBA_PERF_EVENTS': '' if args.no_perf else 'cycles,instructions',
+    })
+    log_path = os.path.join(args.log_dir, '{0}.log'.format(name))
+    with open(log_path, 'w') as log:
+        proc = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT, env=env)
+    mm = None
+    try:
+        deadline = time.monotonic() + args.startup_timeout
+        while mm is None:
+            if proc.poll() is not None or time.monotonic() > deadline:
+                raise RuntimeError('NBA did not start; see {0}.'.format(log_path))
+            try:
+                mm = nba_stat.open_segment('/nba-stats')
+                if take_sample(mm, proc.pid) is None:
+                    mm.close()
+                    mm = None
+            except OSError:
+                mm = None
+            time.sleep(0.5)
+        time.sleep(args.warmup)
+        first = take_sample(mm, proc.pid)
+        latency_samples = {'p50': [], 'p99': [], 'p999': []}
+        end = time.monotonic() + args.duration
+        last = first
+        while time.monotonic() < end:
+            time.sleep(1.0)
+            if proc.poll() is not None:
+                raise RuntimeError('NBA exited during the measurement; see {0}.'.format(log_path))
+            sample = take_sample(mm, proc.pid)
+            if sample is None:
+                continue
+            last = sample
+            for pct in latency_samples:
+                values = [v for f, l, v in sample[1]
+                          if f == 'nba_latency_{0}_ns'.format(pct) and l.get('kind') == 'rx-tx']
+                if values:
+                    latency_samples[pct].append(max(values))
+        if first is None or last is first:
+            raise RuntimeError('No statistics were exported; see {0}.'.format(log_path))
+        result = summarize(first, last, latency_samples)
+        result['profile'] = profile
+        return result
+    finally:
+        if mm is not None:
+            mm.close()
+        if proc.poll() is None:
+            proc.send_signal(signal.SIGINT)
+            try:
+                proc.wait(timeout=10)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+                proc.wait()
+        for pid in feeders:
+            try:
+                os.kill(pid, signal.SIGTERM)
+            except ProcessLookupError:
+                pass
+            os.waitpid(pid, 0)
+
+
+def merge_runs(runs):
+    '''Takes the median of each metric over repeated runs.'''
+    merged = dict(runs[0])
+    for key, value in runs[0].items():
+        if isinstance(value, (int, float)) or value is None:
+            values = [r[key] for r in runs if r.get(key) is not None]
+            merged[key] = statistics.median(values) if values else None
+    return merged
+
+
+def compare(baseline, current, thresholds):
+    regressions = []
+    fmt = '{0:<20} {1:<20} {2:>12} {3:>12} {4:>9}  {5}'
+    print(fmt.format('pipeline', 'metric', 'baseline', 'current', 'change', ''))
+    for name, result in current['results'].items():
+        base = baseline['results'].get(name)
+        if base is None:
+            print(fmt.format(name, '-', '-', '-', '-', 'no baseline'))
+            continue
+        for metric, (higher_is_better, _) in METRICS.items():
+            b, c = base.get(metric), result.get(metric)
+            if b is None or c is None or b == 0:
+                continue
+            change = (c - b) / b * 100.0
+            worse = -change if higher_is_better else change
+            status = ''
+            if worse > thresholds[metric]:
+                status = 'REGRESSION (> {0:.0f}%)'.format(thresholds[metric])
+                regressions.append((name, metric, change))
+            elif worse < -thresholds[metric]:
+                status = 'improved'
+            print(fmt.format(name, metric, '{0:.2f}'.format(b), '{0:.2f}'.format(c),
+                             '{0:+.1f}%'.format(change), status))
+    return regressions
+
+
+def get_commit():
+    try:
+        return subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD'],
+                                       stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run NIC-less end-to-end pipeline benchmarks '
+                                                 'and compare them with a baseline.')
+    parser.add_argument('pipelines', nargs='*', default=DEFAULT_PIPELINES,
+                        help='Pipeline names ({0}) or other configs/*.click names without '
+                             'the extension. (default: all above)'.format(', '.join(PIPELINES)))
+    parser.add_argument('-o', '--output', default=None,
+                        help='Save the results to the given JSON file.')
+    parser.add_argument('-b', '--baseline', default=None,
+                        help='Compare the results with the given JSON file saved by "-o".')
+    parser.add_argument('--threshold', action='append', default=[], metavar='METRIC=PCT',
+                        help='Override the threshold of a metric in percent, '
+                             'e.g., "tx_mpps=3". (metrics: {0})'.format(', '.join(METRICS)))
+    parser.add_argument('--vdev', choices=['pcap', 'null'], default='pcap',
+                        help='The virtual device type.  net_null generates all-zero '
+                             'packets, which only L2 pipelines forward. (default: pcap)')
+    parser.add_argument('--infinite-rx', action='store_true', default=False,
+                        help='Let net_pcap replay the file by itself (DPDK 19.08+).')
+    parser.add_argument('--profile', choices=['ipv4', 'ipv6', 'ipsec'], default=None,
+                        help='Override the traffic profile of all pipelines.')
+    parser.add_argument('--pkt-size', type=int, default=64,
+                        help='The packet size excluding FCS. (default: 64)')
+    parser.add_argument('--ports', type=int, default=2, help='The number of ports. (default: 2)')
+    parser.add_argument('--cores', type=int, default=1,
+                        help='The number of IO/comp threads. (default: 1)')
+    parser.add_argument('--duration', type=float, default=10,
+                        help='The measurement time in seconds. (default: 10)')
+    parser.add_argument('--warmup', type=float, default=3,
+                        help='The time to wait before measurement in seconds. (default: 3)')
+    parser.add_argument('--repeat', type=int, default=1,
+                        help='Run each pipeline this many times and take the medians. (default: 1)')
+    parser.add_argument('--num-trace-pkts', type=int, default=65536,
+                        help='The number of distinct packets in the replayed trace. (default: 65536)')
+    parser.add_argument('--seed', type=int, default=0, help='The random seed of the traffic.')
+    parser.add_argument('--elem-stat-sample', type=int, default=64,
+                        help='Measure element cycles for 1 in this many batches. (default: 64)')
+    parser.add_argument('--no-perf', action='store_true', default=False,
+                        help='Do not use hardware performance counters.')
+    parser.add_argument('--main-bin', default='bin/main', help='The NBA binary. (default: bin/main)')
+    parser.add_argument('--eal-args', default='',
+                        help='Extra EAL arguments, e.g., "--no-huge -m 1024".')
+    parser.add_argument('--log-dir', default=None,
+                        help='Where the NBA outputs are saved. (default: a temporary directory)')
+    parser.add_argument('--startup-timeout', type=float, default=60,
+                        help='Seconds to wait for NBA to start. (default: 60)')
+    args = parser.parse_args()
+    args.eal_args = args.eal_args.split()
+
+    thresholds = {metric: t for metric, (_, t) in METRICS.items()}
+    for item in args.threshold:
+        metric, _, value = item.partition('=')
+        if metric not in METRICS:
+            parser.error('Unknown metric: {0}'.format(metric))
+        thresholds[metric] = float(value)
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get('version') != BASELINE_VERSION:
+            parser.error('Unsupported baseline version in {0}.'.format(args.baseline))
+
+    # Run from the repository root so that pipelines find their data files.
+    os.chdir(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+    if not os.path.isfile(args.main_bin):
+        parser.error('{0} does not exist; build it first.'.format(args.main_bin))
+
+    report = {
+        'version': BASELINE_VERSION,
+        'created': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        'host': socket.gethostname(),
+        'commit': get_commit(),
+        'params': {
+            'vdev': args.vdev, 'pkt_size': args.pkt_size, 'ports': args.ports,
+            'cores': args.cores, 'duration': args.duration, 'repeat': args.repeat,
+        },
+        'results': {},
+    }
+    if baseline is not None and baseline.get('params') != report['params']:
+        print('warning: the baseline was measured with different parameters: {0}'
+              .format(baseline.get('params')), file=sys.stderr)
+
+    failed = False
+    with tempfile.TemporaryDirectory(prefix='nba-regression-') as tmpdir:
+        if args.log_dir is None:
+            args.log_dir = tmpdir
+        os.makedirs(args.log_dir, exist_ok=True)
+        for name in args.pipelines:
+            runs = []
+            for i in range(args.repeat):
+                print('Running {0} ({1}/{2})...'.format(name, i + 1, args.repeat), file=sys.stderr)
+                try:
+                    runs.append(run_pipeline(args, name, tmpdir))
+                except RuntimeError as e:
+                    print('  failed: {0}'.format(e), file=sys.stderr)
+                    failed = True
+                    break
+            if not runs:
+                continue
+            result = merge_runs(runs)
+            report['results'][name] = result
+            print('  {0:.3f} Mpps (rx {1:.3f}), {2} cycles/pkt, p99 latency {3} ns'.format(
+                  result['tx_mpps'], result['rx_mpps'],
+                  '{0:.1f}'.format(result['cycles_per_pkt']) if result['cycles_per_pkt'] else '-',
+                  '{0:.0f}'.format(result['latency_p99_ns']) if result['latency_p99_ns'] else '-'),
+                  file=sys.stderr)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+        print('Wrote {0}'.format(args.output), file=sys.stderr)
+    if baseline is not None:
+        regressions = compare(baseline, report, thresholds)
+        if regressions:
+            print('{0} regression(s) found.'.format(len(regressions)), file=sys.stderr)
+            sys.exit(1)
+    if failed:
+        sys.exit(2)
+
+
+if __name__ == '__main__':
+    main()
+
+# vim: ts=8 sts=4 sw=4 et
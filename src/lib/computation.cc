@@ -14,6 +14,8 @@
 #include <nba/framework/computecontext.hh>
 #include <nba/framework/graphanalysis.hh>
 #include <nba/framework/elementgraph.hh>
+#include <nba/framework/io.hh>
+#include <nba/framework/trace.hh>
 #include <nba/element/element.hh>
 #include <nba/element/element_map.hh>
 #include <nba/element/annotation.hh>
@@ -66,8 +68,11 @@ comp_thread_context::comp_thread_context()
     num_coproc_ppdepth = 0;
 
     batch_pool = nullptr;
+    dbstate_pool = nullptr;
     task_pool = nullptr;
     elem_graph = nullptr;
+    pending_graph = nullptr;
+    retiring_graph = nullptr;
     input_batch = nullptr;
 
     io_ctx = nullptr;
@@ -101,21 +106,29 @@ void comp_thread_context::resume_rx()
     ev_async_start(loop, rx_watcher);
 }
 
+struct click_build_arg {
+    comp_thread_context *ctx;
+    ElementGraph *graph;
+    int num_errors;
+};
+
 static void *click_module_handler(int global_idx, const char* name, int argc, char **argv, void *priv)
 {
-    comp_thread_context *ctx = (comp_thread_context *) priv;
+    struct click_build_arg *arg = (struct click_build_arg *) priv;
     string elem_name(name);
     if (element_registry.find(elem_name) == element_registry.end()) {
-        rte_panic("click_module_handler(): element with name \"%s\" does not exist.\n", name);
+        RTE_LOG(ERR, ELEM, "click_module_handler(): element with name \"%s\" does not exist.\n", name);
+        arg->num_errors ++;
+        return nullptr;
     }
     Element *module = element_registry[elem_name].instantiate();
 
     vector<string> args;
     for (int i = 0; i < argc; i++)
         args.push_back(string(argv[i]));
-    module->configure(ctx, args);
+    module->configure(arg->ctx, args);
 
-    ctx->elem_graph->add_element(module);
+    arg->graph->add_element(module);
     #if 0
     std::vector<int> my_datablocks;
     module->get_datablocks(my_datablocks);
@@ -153,21 +166,36 @@ static void *click_module_handler(int global_idx, const char* name, int argc, ch
 
 static void click_module_linker(void *from, int from_output, void *to, int to_input, void *priv)
 {
-    comp_thread_context *ctx = (comp_thread_context *) priv;
+    struct click_build_arg *arg = (struct click_build_arg *) priv;
     Element *from_module = (Element *) from;
     Element *to_module   = (Element *) to;
-    ctx->elem_graph->link_element(to_module, to_input, from_module, from_output);
+    if (from_module == nullptr || to_module == nullptr)
+        return;  /* already counted as an error */
+    arg->graph->link_element(to_module, to_input, from_module, from_output);
     from_module->link(to_module);
 }
 
-void comp_thread_context::build_element_graph(const char* config_file)
+int comp_thread_context::build_element_graph(const char* config_file, ElementGraph *graph)
 {
     elemgraph_lock->acquire();
 
     FILE* input = fopen(config_file, "r");
+    if (input == nullptr) {
+        RTE_LOG(ERR, ELEM, "Cannot open the pipeline configuration %s.\n", config_file);
+        elemgraph_lock->release();
+        return -1;
+    }
 
     /* Parse the config file and build the element graph object. */
-    ParseInfo *pi = click_parse_configuration(input, click_module_handler, click_module_linker, this);
+    struct click_build_arg arg = { this, graph, 0 };
+    ParseInfo *pi = click_parse_configuration(input, click_module_handler, click_module_linker, &arg);
+    if (arg.num_errors > 0 || graph->validate() != 0) {
+        RTE_LOG(ERR, ELEM, "Element graph validation failed.\n");
+        click_destroy_configuration(pi);
+        fclose(input);
+        elemgraph_lock->release();
+        return -1;
+    }
     int num_modules = click_num_module(pi);
 
     /* Schedulable elements will be automatically detected during addition.
@@ -185,6 +213,12 @@ void comp_thread_context::build_element_graph(const char* config_file)
         }
     }
     RTE_LOG(INFO, ELEM, "Number of linear groups: %lu\n", linear_groups.size());
+    #if NBA_FUSE_ELEMENTS == NBA_FUSE_ELEMENTS_ENABLED
+    graph->fuse_linear_groups();
+    #ifdef NBA_STATIC_GRAPH
+    graph->bind_static_chains();
+    #endif
+    #endif
     #if NBA_REUSE_DATABLOCKS == 1
     for (vector<GraphMetaData *> group : linear_groups) {
 
@@ -226,13 +260,13 @@ void comp_thread_context::build_element_graph(const char* config_file)
 
             for (int dbid : new_dbids) {
                 struct offload_action_key key = { (void *) oel, dbid, ELEM_OFFL_PREPROC };
-                elem_graph->add_offload_action(&key);
+                graph->add_offload_action(&key);
                 RTE_LOG(INFO, ELEM, "%s (%p, %d) -> preproc\n", el->class_name(), oel, dbid);
                 all_new_dbids.insert(dbid);
             }
             for (int dbid : deleted_dbids) {
                 struct offload_action_key key = { (void *) prev_oel, dbid, ELEM_OFFL_POSTPROC };
-                elem_graph->add_offload_action(&key);
+                graph->add_offload_action(&key);
                 RTE_LOG(INFO, ELEM, "%s (%p, %d) -> postproc\n", prev_el->class_name(), prev_oel, dbid);
                 all_deleted_dbids.insert(dbid);
 
@@ -243,7 +277,7 @@ void comp_thread_context::build_element_graph(const char* config_file)
                                     all_new_dbids.begin(), all_new_dbids.end())) {
                     /* When all used datablocks are postprocessed... */
                     struct offload_action_key key = { (void *) prev_oel, -1, ELEM_OFFL_POSTPROC_FIN };
-                    elem_graph->add_offload_action(&key);
+                    graph->add_offload_action(&key);
                     RTE_LOG(INFO, ELEM, "%s (%p) -> clear\n", prev_el->class_name(), prev_oel);
                     all_new_dbids.clear();
                     all_deleted_dbids.clear();
@@ -259,26 +293,45 @@ void comp_thread_context::build_element_graph(const char* config_file)
     click_destroy_configuration(pi);
     fclose(input);
     elemgraph_lock->release();
+    return 0;
 }
 
-void comp_thread_context::initialize_graph_global()
+static void trace_graph_elements(ElementGraph *graph)
+{
+    const char *elem_names[NBA_MAX_ELEMENTS];
+    unsigned num_elems = 0;
+    for (Element *el : graph->get_elements())
+        elem_names[num_elems ++] = el->class_name();
+    trace_set_element_names(num_elems, elem_names);
+}
+
+void comp_thread_context::initialize_graph_global(ElementGraph *graph)
 {
     elemgraph_lock->acquire();
-    /* globally once invocation is guaranteed by main.cc */
-    for (Element *el : elem_graph->get_elements()) {
+    /* globally once invocation is guaranteed by main.cc and reload.cc */
+    for (Element *el : graph->get_elements())
         el->initialize_global();
-    }
+    /* Reloaded graphs are traced once they are swapped in. */
+    if (graph == elem_graph)
+        trace_graph_elements(graph);
     elemgraph_lock->release();
 }
 
-void comp_thread_context::initialize_graph_per_node()
+int comp_thread_context::initialize_graph_per_node(ElementGraph *graph)
 {
+    int ret = 0;
     elemgraph_lock->acquire();
-    /* per-node invocation is guaranteed by main.cc */
-    for (Element *el : elem_graph->get_elements()) {
-        el->initialize_per_node();
+    /* per-node invocation is guaranteed by main.cc and reload.cc */
+    for (Element *el : graph->get_elements()) {
+        if (el->initialize_per_node() != 0) {
+            RTE_LOG(ERR, COMP, "element %s failed to initialize at node %u\n",
+                    el->class_name(), loc.node_id);
+            ret = -1;
+            break;
+        }
     }
     elemgraph_lock->release();
+    return ret;
 }
 
 void comp_thread_context::initialize_offloadables_per_node(ComputeDevice *device)
@@ -300,14 +353,37 @@ void comp_thread_context::initialize_offloadables_per_node(ComputeDevice *device
 }
 
 
-void comp_thread_context::initialize_graph_per_thread()
+void comp_thread_context::initialize_graph_per_thread(ElementGraph *graph)
 {
     // per-element configuration
-    for (Element *el : elem_graph->get_elements()) {
+    for (Element *el : graph->get_elements()) {
         el->initialize();
     }
 }
 
+void comp_thread_context::update_element_graph(uint64_t loop_count)
+{
+    /* The previous graph is destroyed only after all its batches and
+     * offload tasks have left, because the in-flight ones refer to its
+     * elements.  Until then, the next reload waits here. */
+    if (retiring_graph != nullptr) {
+        if (!retiring_graph->drain(loop_count))
+            return;
+        retiring_graph->~ElementGraph();
+        rte_free(retiring_graph);
+        retiring_graph = nullptr;
+        RTE_LOG(INFO, COMP, "comp@%u: released the previous element graph.\n", loc.core_id);
+    }
+    ElementGraph *graph = pending_graph.exchange(nullptr, std::memory_order_acquire);
+    if (graph == nullptr)
+        return;
+    if (io_ctx->node_stat->elem_stat_sample != 0)
+        elem_graph->export_stats(io_ctx->node_stat);
+    retiring_graph = elem_graph;
+    elem_graph = graph;
+    trace_graph_elements(graph);
+}
+
 void comp_thread_context::io_tx_new(void* data, size_t len, int out_port)
 {
     if (len > NBA_MAX_PACKET_SIZE) {
@@ -51,6 +51,7 @@ vector<struct queue_conf> queue_confs;
 unordered_map<void*, int> queue_idx_map;
 
 bool dummy_device __rte_cache_aligned;
+string perf_events;
 
 static PyStructSequence_Field netdevice_fields[] = {
     {"device_id", "The device ID used by the underlying IO library."},
@@ -565,6 +566,20 @@ static long pymap_getlong(PyObject *pmap, char *key, long default_value)
     return value;
 }
 
+static string pymap_getstring(PyObject *pmap, char *key, const char *default_value)
+{
+    string value(default_value);
+    assert(PyMapping_Check(pmap));
+    PyObject *_value = PyMapping_GetItemString(pmap, key);
+    if (_value != NULL) {
+        assert(PyUnicode_Check(_value));
+        value = PyUnicode_AsUTF8(_value);
+        Py_DECREF(_value);
+    } else
+        PyErr_Clear();
+    return value;
+}
+
 bool load_config(const char *pyfilename)
 {
     bool success = false;
@@ -628,7 +643,27 @@ bool load_config(const char *pyfilename)
 
     LOAD_PARAM(TASKPOOL_SIZE,  256);
     LOAD_PARAM(BATCHPOOL_SIZE, 512);
+
+    LOAD_PARAM(BRANCHPRED_SCHEME, NBA_BRANCHPRED_SCHEME);
+    LOAD_PARAM(BRANCHPRED_MISS_PERCENT, 25);
+
+    LOAD_PARAM(TX_BUFFER_SIZE,  32);
+    LOAD_PARAM(TX_FLUSH_USEC,  100);
+    LOAD_PARAM(HW_CSUM_OFFLOAD,  0);
+
+    LOAD_PARAM(RSS_REBALANCE,            0);
+    LOAD_PARAM(RSS_REBALANCE_THRESHOLD, 25);
+    LOAD_PARAM(RSS_REBALANCE_HOLDOFF,    5);
+
+    LOAD_PARAM(WORK_STEALING,  0);
+    LOAD_PARAM(IO_COMP_SPLIT,  0);
+    LOAD_PARAM(IDLE_POLL,      0);
+    LOAD_PARAM(ELEM_STAT_SAMPLE, 0);
+    LOAD_PARAM(STATS_SHM,      0);
+    LOAD_PARAM(TRACE,          0);
+    LOAD_PARAM(TRACE_EVENTS, 65536);
 #undef LOAD_PARAM
+    perf_events = pymap_getstring(p_sys_params, "PERF_EVENTS", "");
 
     /* Retrieve io thread configurations. */
     p_io_threads = PyMapping_GetItemString(p_globals, "io_threads");
@@ -14,6 +14,7 @@
 #include <nba/framework/coprocessor.hh>
 #include <nba/framework/offloadtask.hh>
 #include <nba/framework/computedevice.hh>
+#include <nba/framework/trace.hh>
 #ifdef USE_CUDA
 #include <nba/engines/cuda/computedevice.hh>
 #endif
@@ -60,8 +61,12 @@ static void coproc_task_input_cb(struct ev_loop *loop, struct ev_async *watcher,
     ret = rte_ring_dequeue(ctx->task_input_queue, (void **) &task);
     if (ret == 0 && task != nullptr) {
         task->coproc_ctx = ctx;
+        trace_record(TRACE_H2D_BEGIN, 0, (uintptr_t) task);
         task->copy_h2d();
+        trace_record(TRACE_H2D_END, 0, (uintptr_t) task);
+        trace_record(TRACE_KERNEL_BEGIN, 0, (uintptr_t) task);
         task->execute();
+        trace_record(TRACE_KERNEL_END, 0, (uintptr_t) task);
         #ifdef DEBUG_OFFLOAD
         task->cctx->sync();
         #endif
@@ -97,7 +102,10 @@ static void coproc_task_d2h_cb(struct ev_loop *loop, struct ev_async *watcher, i
         OffloadTask *task = ctx->d2h_pending_queue->front();
         ctx->d2h_pending_queue->pop_front();
         if (task->poll_kernel_finished()) {
+            trace_record(TRACE_KERNEL_DONE, 0, (uintptr_t) task);
+            trace_record(TRACE_D2H_BEGIN, 0, (uintptr_t) task);
             task->copy_d2h();
+            trace_record(TRACE_D2H_END, 0, (uintptr_t) task);
             #ifdef DEBUG_OFFLOAD
             task->cctx->sync();
             #endif
@@ -124,6 +132,7 @@ static void coproc_task_done_cb(struct ev_loop *loop, struct ev_async *watcher,
         OffloadTask *task = ctx->task_done_queue->front();
         ctx->task_done_queue->pop_front();
         if (task->poll_d2h_copy_finished()) {
+            trace_record(TRACE_TASK_DONE, 0, (uintptr_t) task);
             task->notify_completion();
         } else
             ctx->task_done_queue->push_back(task);
@@ -170,6 +179,7 @@ void *coproc_loop(void *arg)
     #ifdef USE_NVPROF
     nvtxNameOsThread(pthread_self(), temp);
     #endif
+    trace_init_thread(temp, ctx->loc.node_id);
 
     /* Initialize task queues. */
     ctx->d2h_pending_queue = new FixedRing<OffloadTask *>(256, ctx->loc.node_id);
@@ -54,7 +54,8 @@ tuple<size_t, size_t> DataBlock::calc_read_buffer_size(PacketBatch *batch)
     struct datablock_tracker *t = &batch->datablock_states[this->get_id()];
 
     switch (read_roi.type) {
-    case READ_PARTIAL_PACKET: {
+    case READ_PARTIAL_PACKET:
+    case READ_PARTIAL_NETWORK: {
 
         /* Copy a portion of packets or user-define fixed-size values.
          * We use a fixed-size range (offset, length) here.
@@ -194,6 +195,25 @@ void DataBlock::preprocess(PacketBatch *batch, void *host_in_buffer) {
             }
         } END_FOR_ALL_PREFETCH;
 
+        break; }
+    case READ_PARTIAL_NETWORK: {
+        /* Same as above, but VLAN tags may shift each packet's L3 header. */
+        void *invalid_value = this->get_invalid_value();
+        FOR_EACH_PACKET_ALL_PREFETCH(batch, 4u) {
+            uint16_t aligned_elemsz = t->aligned_item_sizes->size;
+            uint32_t offset         = t->aligned_item_sizes->size * pkt_idx;
+            if (IS_PACKET_INVALID(batch, pkt_idx)) {
+                if (invalid_value != nullptr) {
+                    rte_memcpy((char *) host_in_buffer + offset, invalid_value, aligned_elemsz);
+                }
+            } else {
+                Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+                rte_memcpy((char*) host_in_buffer + offset,
+                           (char *) pkt->network_header() + read_roi.offset,
+                           aligned_elemsz);
+            }
+        } END_FOR_ALL_PREFETCH;
+
         break; }
     case READ_WHOLE_PACKET: {
 
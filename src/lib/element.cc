@@ -30,7 +30,15 @@ Element::Element() : next_elems(), next_connected_inputs()
 {
     num_min_inputs = num_max_inputs = 0;
     num_min_outputs = num_max_outputs = 0;
+    memzero(&fused_cpu, 1);
+    memzero(&fused_offl, 1);
+    memzero(&disp, 1);
     memzero(branch_count, ElementGraph::num_max_outputs);
+    memzero(branch_hist, ElementGraph::num_max_outputs);
+    memzero(&stat, 1);
+    memzero(&stat_exported, 1);
+    memzero(perf_sampled, NBA_PERF_MAX_EVENTS);
+    elem_idx = 0;
     for (int i = 0; i < ElementGraph::num_max_outputs; i++)
         outputs[i] = OutputPort(this, i);
 }
@@ -190,7 +198,7 @@ int OffloadableElement::offload(ElementGraph *mother, PacketBatch *batch, int in
         nvtxRangePush("accum_batch");
         #endif
         /* We assume: task pool size >= task input queue length */
-        int ret = rte_mempool_get(ctx->task_pool, (void **) &otask);
+        int ret = ctx->task_freelist.get((void **) &otask);
         if (ret == -ENOENT) {
             //if (!ctx->io_ctx->loop_broken)
             //    ev_run(ctx->io_ctx->loop, EVRUN_NOWAIT);
@@ -277,6 +285,30 @@ int OffloadableElement::dispatch(uint64_t loop_count, PacketBatch*& out_batch, u
     return 0;
 }
 
+int OffloadableElement::flush_offload(ElementGraph *mother)
+{
+    for (unsigned dev_idx = 0; dev_idx < NBA_MAX_COPROCESSOR_TYPES; dev_idx++) {
+        OffloadTask *otask = tasks[dev_idx];
+        if (otask == nullptr)
+            continue;
+        tasks[dev_idx] = nullptr;
+        otask->offload_start = rte_rdtsc();
+        otask->state = TASK_INITIALIZED;
+        mother->enqueue_offload_task(otask, this, otask->tracker.input_port);
+    }
+    return 0;
+}
+
+bool OffloadableElement::has_pending_batches() const
+{
+    if (finished_batches->size() > 0)
+        return true;
+    for (unsigned dev_idx = 0; dev_idx < NBA_MAX_COPROCESSOR_TYPES; dev_idx++)
+        if (tasks[dev_idx] != nullptr)
+            return true;
+    return false;
+}
+
 void OffloadableElement::dummy_compute_handler(ComputeDevice *cdev,
                                                ComputeContext *ctx,
                                                struct resource_param *res)
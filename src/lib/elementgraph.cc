@@ -8,6 +8,10 @@
 #include <nba/framework/loadbalancer.hh>
 #include <nba/framework/task.hh>
 #include <nba/framework/offloadtask.hh>
+#include <nba/framework/trace.hh>
+#ifdef NBA_STATIC_GRAPH
+#include <nba/framework/staticgraph.hh>
+#endif
 #include <nba/element/packetbatch.hh>
 #include <nba/core/logging.hh>
 #include <nba/core/enumerate.hh>
@@ -30,8 +34,19 @@ static const uint64_t BRANCH_TRUNC_LIMIT = (1<<24);
 using namespace std;
 using namespace nba;
 
-ElementGraph::ElementGraph(comp_thread_context *ctx)
-    : elements(128, ctx->loc.node_id),
+/* Defers freeing a dropped packet to io_drop_flush(),
+ * counting it against its input port. */
+static inline void defer_drop(struct io_thread_context *io_ctx, struct rte_mbuf *m)
+{
+    struct io_drop_buffer *db = &io_ctx->drop_buffer;
+    io_ctx->port_stats[m->port].num_sw_drop_pkts ++;
+    db->pkts[db->count ++] = m;
+    if (unlikely(db->count == NBA_DROP_BUFFER_SIZE))
+        io_drop_flush(io_ctx);
+}
+
+ElementGraph::ElementGraph(comp_thread_context *ctx, unsigned generation)
+    : elements(NBA_MAX_ELEMENTS, ctx->loc.node_id),
       sched_elements(16, ctx->loc.node_id),
       offl_elements(16, ctx->loc.node_id),
       queue(2048, ctx->loc.node_id)
@@ -39,13 +54,15 @@ ElementGraph::ElementGraph(comp_thread_context *ctx)
     const size_t ready_task_qlen = 256;
     this->ctx = ctx;
     input_elem = nullptr;
+    elem_stat_countdown = ctx->elem_stat_sample;
+    num_running_tasks = 0;
     assert(0 == rte_malloc_validate(ctx, NULL));
 
 #if NBA_REUSE_DATABLOCKS == 1
     struct rte_hash_parameters hparams;
     char namebuf[RTE_HASH_NAMESIZE];
-    snprintf(namebuf, RTE_HASH_NAMESIZE, "elemgraph@%u.%u:offl_actions",
-             ctx->loc.node_id, ctx->loc.local_thread_idx);
+    snprintf(namebuf, RTE_HASH_NAMESIZE, "elemgraph@%u.%u.%u:offl_actions",
+             ctx->loc.node_id, ctx->loc.local_thread_idx, generation);
     hparams.name = namebuf;
     hparams.entries = 64;
     hparams.key_len = sizeof(struct offload_action_key);
@@ -59,6 +76,15 @@ ElementGraph::ElementGraph(comp_thread_context *ctx)
 #endif
 }
 
+ElementGraph::~ElementGraph()
+{
+    #if NBA_REUSE_DATABLOCKS == 1
+    rte_hash_free(offl_actions);
+    #endif
+    for (Element *el : elements)
+        delete el;
+}
+
 void ElementGraph::send_offload_task_to_device(OffloadTask *task)
 {
     if (unlikely(ctx->io_ctx->loop_broken))
@@ -92,9 +118,8 @@ void ElementGraph::send_offload_task_to_device(OffloadTask *task)
         size_t num_batches = task->batches.size();
         if (task->batches[0]->datablock_states == nullptr) {
             struct datablock_tracker *dbstates[num_batches];
-            assert(0 == rte_mempool_get_bulk(ctx->dbstate_pool,
-                                             (void **) &dbstates,
-                                             num_batches));
+            assert(0 == ctx->dbstate_freelist.get_bulk((void **) &dbstates,
+                                                       num_batches));
             for (auto&& p : enumerate(task->batches))
                 (p.second)->datablock_states = dbstates[p.first];
         }
@@ -136,6 +161,8 @@ void ElementGraph::send_offload_task_to_device(OffloadTask *task)
     } else {
         /* It may return -EDQUOT, but here we ignore this HWM signal.
          * Even for that case, the task is enqueued successfully. */
+        trace_record(TRACE_OFFLOAD_ENQUEUE, task->batches.size(), (uintptr_t) task);
+        num_running_tasks ++;
         ev_async_send(ctx->coproc_ctx->loop, ctx->offload_devices->at(dev_idx)->input_watcher);
         if (ctx->inspector) ctx->inspector->dev_sent_batch_count[0] += task->batches.size();
     }
@@ -148,20 +175,43 @@ void ElementGraph::send_offload_task_to_device(OffloadTask *task)
 void ElementGraph::free_batch(PacketBatch *batch, bool free_pkts)
 {
     if (free_pkts) {
-        assert(0 == rte_ring_enqueue_bulk(ctx->io_ctx->drop_queue,
-                                          (void **) &batch->packets[0],
-                                          batch->count));
         #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
-        assert(0 == rte_ring_enqueue_bulk(ctx->io_ctx->drop_queue,
-                                          (void **) &batch->packets[batch->count],
-                                          batch->drop_count));
+        if (batch->has_dropped)
+            batch->collect_excluded_packets();
+        #endif
+        /* The excluded slots are already dropped or moved to other batches. */
+        FOR_EACH_PACKET(batch) {
+            defer_drop(ctx->io_ctx, batch->packets[pkt_idx]);
+        } END_FOR;
+        #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+        drop_excluded(nullptr, batch);
         #endif
     }
-    rte_mempool_put(ctx->batch_pool, (void *) batch);
-    /* Make any blocking call to ev_run() to break. */
-    ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
+    ctx->batch_freelist.put((void *) batch);
+    /* Make any blocking call to ev_run() waiting for batches to break. */
+    if (ctx->io_ctx->num_batch_waiters > 0)
+        ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
 }
 
+#if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+void ElementGraph::drop_excluded(Element *elem, PacketBatch *batch)
+{
+    /* collect_excluded_packets() has moved them to the tail.
+     * Null slots are the packets moved to other batches or pending. */
+    unsigned num_drops = 0;
+    for (unsigned i = 0; i < batch->drop_count; i++) {
+        struct rte_mbuf *m = batch->packets[batch->count + i];
+        if (m == nullptr)
+            continue;
+        defer_drop(ctx->io_ctx, m);
+        num_drops ++;
+    }
+    if (elem != nullptr)
+        elem->stat.num_drops += num_drops;
+    batch->drop_count = 0;
+}
+#endif
+
 void ElementGraph::scan_schedulable_elements(uint64_t loop_count)
 {
     uint64_t now = 0;
@@ -241,27 +291,106 @@ void ElementGraph::enqueue_offload_task(OffloadTask *otask, OffloadableElement *
 void ElementGraph::enqueue_offload_task(OffloadTask *otask, Element *start_elem, int input_port)
 {
     assert(start_elem != nullptr);
-    otask->elem = dynamic_cast<OffloadableElement*>(start_elem);
+    otask->elem = start_elem->disp.offloadable;
     otask->tracker.element = start_elem;
     otask->tracker.input_port = input_port;
     queue.push_front(Task::to_task(otask));
 }
 
+#if NBA_BRANCHPRED_SCHEME != NBA_BRANCHPRED_DISABLED
+/* Returns the output port that most packets took in the last batch. */
+static inline int majority_branch(const uint64_t *counts, unsigned num_outputs)
+{
+    int predicted = 0;
+    uint64_t current_max = 0;
+    for (unsigned k = 0; k < num_outputs; k++) {
+        if (current_max < counts[k]) {
+            current_max = counts[k];
+            predicted = k;
+        }
+    }
+    return predicted;
+}
+#endif
+
+#if NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE
+/* Returns the majority output port if the ratio of the others in the
+ * decayed histogram is below miss_percent, or -1 otherwise. */
+static inline int predict_branch(const uint32_t *hist, unsigned num_outputs,
+                                 unsigned miss_percent)
+{
+    unsigned predicted = 0;
+    uint64_t sum = 0;
+    for (unsigned k = 0; k < num_outputs; k++) {
+        sum += hist[k];
+        if (hist[k] > hist[predicted])
+            predicted = k;
+    }
+    if (sum == 0 || (sum - hist[predicted]) * 100 >= (uint64_t) miss_percent * sum)
+        return -1;
+    return (int) predicted;
+}
+
+/* Adds the per-port packet counts of the last batch to the histogram,
+ * decaying the older history by 1/2^NBA_BRANCHPRED_DECAY_SHIFT. */
+static inline void decay_branch_hist(uint32_t *hist, const uint64_t *counts,
+                                     unsigned num_outputs)
+{
+    for (unsigned k = 0; k < num_outputs; k++)
+        hist[k] = hist[k] - (hist[k] >> NBA_BRANCHPRED_DECAY_SHIFT) + (uint32_t) counts[k];
+}
+#endif
+
 void ElementGraph::process_batch(PacketBatch *batch)
 {
     Element *current_elem = batch->tracker.element;
+    const struct element_dispatch *d = &current_elem->disp;
     int input_port = batch->tracker.input_port;
     int batch_disposition = CONTINUE_TO_PROCESS;
     int64_t lb_decision = anno_get(&batch->banno, NBA_BANNO_LB_DECISION);
     uint64_t now = rdtscp();  // The starting timestamp of the current element.
 
+    if (batch->delay_start != 0) {
+        /* The batch has waited for a room in the offload task. */
+        uint64_t delay = now - batch->delay_start;
+        batch->delay_time += delay;
+        batch->delay_start = 0;
+        if (ctx->inspector) ctx->inspector->queue_delay_hist.record(delay);
+    }
+
     /* Check if we can and should offload. */
     if (!batch->tracker.has_results) {
-        /* Since dynamic_cast has runtime overheads, we first use a bitmask
-         * to check class types. */
-        if (current_elem->get_type() & ELEMTYPE_OFFLOADABLE) {
-            OffloadableElement *offloadable = dynamic_cast<OffloadableElement*>(current_elem);
-            assert(offloadable != nullptr);
+        const unsigned count_in = batch->count;
+        bool sampled = false;
+        if (elem_stat_countdown != 0 && -- elem_stat_countdown == 0) {
+            elem_stat_countdown = ctx->elem_stat_sample;
+            sampled = true;
+        }
+        const PerfCounterGroup *perf = sampled ? ctx->io_ctx->perf : nullptr;
+        uint64_t perf_begin[NBA_PERF_MAX_EVENTS];
+        if (perf != nullptr)
+            perf->read(perf_begin);
+        Element *const head_elem = current_elem;
+        head_elem->stat.num_batches ++;
+        /* A fused chain is traced as its head element. */
+        trace_record(TRACE_ELEM_ENTER, head_elem->elem_idx, (uintptr_t) batch);
+        head_elem->stat.num_pkts_in += count_in;
+        #if NBA_FUSE_ELEMENTS == NBA_FUSE_ELEMENTS_ENABLED
+        const struct fused_chain &fc = (lb_decision == -1) ? current_elem->fused_cpu
+                                                           : current_elem->fused_offl;
+        if (fc.num_fused > 0) {
+            /* Run the fused chain and continue from its tail element. */
+            bool has_offloadable = false;
+            current_elem = process_fused(current_elem, fc, input_port,
+                                         batch, has_offloadable);
+            batch->tracker.element = current_elem;
+            d = &current_elem->disp;
+            if (has_offloadable)
+                batch->compute_time += (rdtscp() - now) / batch->count;
+        } else
+        #endif
+        if (d->offloadable != nullptr) {
+            OffloadableElement *offloadable = d->offloadable;
             if (lb_decision != -1) {
                 /* Get or initialize the task object.
                  * This step is always executed for every input batch
@@ -272,6 +401,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                     batch->delay_start = rte_rdtsc();
                     queue.push_back(Task::to_task(batch));
                 }
+                trace_record(TRACE_ELEM_EXIT, head_elem->elem_idx, (uintptr_t) batch);
                 /* At this point, the batch is already consumed to the task
                  * or delayed. */
                 return;
@@ -284,6 +414,17 @@ void ElementGraph::process_batch(PacketBatch *batch)
             /* If not offloadable, run the element's CPU-version handler. */
             batch_disposition = current_elem->_process_batch(input_port, batch);
         }
+        if (sampled) {
+            head_elem->stat.num_sampled_pkts += count_in;
+            head_elem->stat.num_sampled_cycles += rdtscp() - now;
+        }
+        if (perf != nullptr) {
+            uint64_t perf_end[NBA_PERF_MAX_EVENTS];
+            perf->read(perf_end);
+            for (unsigned e = 0, n = perf->size(); e < n; e++)
+                head_elem->perf_sampled[e] += perf_end[e] - perf_begin[e];
+        }
+        trace_record(TRACE_ELEM_EXIT, head_elem->elem_idx, (uintptr_t) batch);
     }
 
     /* If the element was per-batch and it said it will keep the batch,
@@ -304,7 +445,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
     }
 
     //assert(current_elem->num_max_outputs <= num_max_outputs || current_elem->num_max_outputs == -1);
-    size_t num_outputs = current_elem->next_elems.size();
+    size_t num_outputs = d->num_outputs;
 
     if (num_outputs == 0) {
 
@@ -316,12 +457,20 @@ void ElementGraph::process_batch(PacketBatch *batch)
 
         /* With the single output, we don't need to allocate new
          * batches.  Just reuse the given one. */
-        if (0 == (current_elem->get_type() & ELEMTYPE_PER_BATCH)) {
+        if (0 == (d->type & ELEMTYPE_PER_BATCH)) {
             const int *const results = batch->results;
             #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
             batch->has_dropped = false;
             #endif
+            #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
+            /* Packets passed to port 0 stay as they are,
+             * so we only visit the others. */
+            uint64_t passed[NBA_BATCH_MASK_WORDS], others[NBA_BATCH_MASK_WORDS];
+            batch_mask_split(batch->mask, results, (batch->count + 63) >> 6, 0, passed, others);
+            FOR_EACH_PACKET_IN_MASK(others, batch->count) {
+            #else
             FOR_EACH_PACKET(batch) {
+            #endif
                 int o = results[pkt_idx];
                 switch (o) {
                 case 0:
@@ -329,7 +478,8 @@ void ElementGraph::process_batch(PacketBatch *batch)
                     break;
                 case DROP:
                     #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
-                    rte_ring_enqueue(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+                    defer_drop(ctx->io_ctx, batch->packets[pkt_idx]);
+                    current_elem->stat.num_drops ++;
                     #endif
                     EXCLUDE_PACKET(batch, pkt_idx);
                     break;
@@ -347,10 +497,10 @@ void ElementGraph::process_batch(PacketBatch *batch)
             if (batch->has_dropped)
                 batch->collect_excluded_packets();
             if (ctx->inspector) ctx->inspector->drop_pkt_count += batch->drop_count;
-            batch->clean_drops(ctx->io_ctx->drop_queue);
+            drop_excluded(current_elem, batch);
             #endif
         }
-        if (unlikely(current_elem->next_elems[0]->get_type() & ELEMTYPE_OUTPUT)) {
+        if (unlikely(d->next_is_output[0])) {
             /* We are at the end leaf of the pipeline.
              * Inidicate free of the original batch. */
             if (ctx->inspector) {
@@ -361,8 +511,8 @@ void ElementGraph::process_batch(PacketBatch *batch)
             free_batch(batch, false);
         } else {
             /* Recurse into the next element, reusing the batch. */
-            Element *next_el = current_elem->next_elems[0];
-            int next_input_port = current_elem->next_connected_inputs[0];
+            Element *next_el = d->next_elems[0];
+            int next_input_port = d->next_inputs[0];
 
             batch->tracker.element = next_el;
             batch->tracker.input_port = next_input_port;
@@ -383,14 +533,176 @@ void ElementGraph::process_batch(PacketBatch *batch)
         // TODO: implement per-batch handling for branches
 
         /*
+         * NBA_BRANCH_SPLIT_INPLACE: use code path 3 only
          * NBA_BRANCHPRED_DISABLED: use code path 2 only
          * NBA_BRANCHPRED_ENABLED: use both code path 1 & 2
          * NBA_BRANCHPRED_ALWAYS: use code path 1 only
          */
 
+#if NBA_BRANCH_SPLIT == NBA_BRANCH_SPLIT_INPLACE
+#  pragma message "In-place branch split path enabled."
+        /* Code Path 3: Keep the largest partition in the original batch
+         * and move only the other packets to new batches. */
+        {
+            unsigned out_counts[num_outputs];
+            memzero(out_counts, num_outputs);
+            #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
+            const unsigned nw = (batch->count + 63) >> 6;
+            for (unsigned o = 0; o < num_outputs; o++)
+                for (unsigned w = 0; w < nw; w++)
+                    out_counts[o] += __builtin_popcountll(batch->mask[w]
+                                                          & batch_results_mask(results, w, o));
+            #else
+            FOR_EACH_PACKET(batch) {
+                unsigned o = (unsigned) results[pkt_idx];
+                if (o < num_outputs)
+                    out_counts[o] ++;
+            } END_FOR;
+            #endif
+            unsigned kept_output = 0;
+            for (unsigned o = 1; o < num_outputs; o++)
+                if (out_counts[o] > out_counts[kept_output])
+                    kept_output = o;
+
+            /* Allocate new batches only for the other non-empty outputs. */
+            for (unsigned o = 0; o < num_outputs; o++)
+                out_batches[o] = nullptr;
+            for (unsigned o = 0; o < num_outputs; o++) {
+                if (o == kept_output || out_counts[o] == 0)
+                    continue;
+                while (ctx->batch_freelist.get((void **) &out_batches[o]) == -ENOENT
+                       && !ctx->io_ctx->loop_broken)
+                {
+                    ctx->io_ctx->num_batch_waiters ++;
+                    ev_run(ctx->io_ctx->loop, 0);
+                    ctx->io_ctx->num_batch_waiters --;
+                }
+                if (unlikely(ctx->io_ctx->loop_broken)) {
+                    /* No packet has moved yet; they all go with the parent. */
+                    for (unsigned k = 0; k < num_outputs; k++)
+                        if (out_batches[k] != nullptr)
+                            free_batch(out_batches[k], false);
+                    free_batch(batch);
+                    return;
+                }
+                out_batches[o]->reset();
+                anno_copy(&out_batches[o]->banno, &batch->banno);
+                out_batches[o]->recv_timestamp = batch->recv_timestamp;
+                out_batches[o]->generation = batch->generation + 1;
+                out_batches[o]->count = 0;
+                INIT_BATCH_MASK(out_batches[o]);
+            }
+
+            /* Move out the packets not taking the kept output.
+             * The kept ones remain in their original order. */
+            #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
+            uint64_t moved_mask[NBA_BATCH_MASK_WORDS];
+            batch_mask_split(batch->mask, results, nw, kept_output, batch->mask, moved_mask);
+            FOR_EACH_PACKET_IN_MASK(moved_mask, batch->count) {
+            #else
+            FOR_EACH_PACKET(batch) {
+                if (results[pkt_idx] == (int) kept_output)
+                    continue;
+            #endif
+                int o = results[pkt_idx];
+                assert(o < (signed) num_outputs || o >= DROP);
+                switch (o) {
+                HANDLE_ALL_PORTS: {
+                    ADD_PACKET(out_batches[o], batch->packets[pkt_idx]);
+                    break; }
+                case DROP: {
+                    defer_drop(ctx->io_ctx, batch->packets[pkt_idx]);
+                    current_elem->stat.num_drops ++;
+                    if (ctx->inspector) ctx->inspector->drop_pkt_count ++;
+                    break; }
+                case PENDING: {
+                    /* The packet is now stored in io_thread_ctx::pended_pkt_queue. */
+                    break; }
+                case SLOWPATH: {
+                    rte_panic("SLOWPATH not implemented. (element: %s)\n",
+                              current_elem->class_name());
+                    break; }
+                }
+                #if NBA_BATCHING_SCHEME != NBA_BATCHING_BITVECTOR
+                EXCLUDE_PACKET_MARK_ONLY(batch, pkt_idx);
+                #endif
+            } END_FOR;
+
+            #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+            /* Compact the kept packets without reordering them.
+             * (The dropped ones are already enqueued above.) */
+            unsigned kept_count = 0;
+            for (unsigned p = 0; p < batch->count; p++) {
+                if (!batch->excluded[p]) {
+                    batch->packets[kept_count] = batch->packets[p];
+                    batch->results[kept_count] = batch->results[p];
+                    batch->excluded[kept_count] = false;
+                    #if NBA_BATCH_SOA_META
+                    batch->meta_move(kept_count, p);
+                    #endif
+                    kept_count ++;
+                }
+            }
+            batch->count = kept_count;
+            batch->drop_count = 0;
+            batch->has_dropped = false;
+            #endif
+
+            /* Recurse into the element subgraph starting from each
+             * output port. */
+            for (unsigned o = 0; o < num_outputs; o++) {
+                PacketBatch *out_batch = (o == kept_output) ? batch : out_batches[o];
+                if (out_batch == nullptr)
+                    continue;
+                if (unlikely(out_counts[o] == 0)) {
+                    /* All packets are dropped or pending. */
+                    free_batch(out_batch, false);
+                    continue;
+                }
+                if (d->next_is_output[o]) {
+
+                    if (ctx->inspector) {
+                        ctx->inspector->tx_batch_count ++;
+                        ctx->inspector->tx_pkt_count += out_batch->count;
+                    }
+
+                    /* We are at the end leaf of the pipeline. */
+                    io_tx_batch(ctx->io_ctx, out_batch);
+                    free_batch(out_batch, false);
+
+                } else {
+
+                    out_batch->tracker.element = d->next_elems[o];
+                    out_batch->tracker.input_port = d->next_inputs[o];
+                    out_batch->tracker.has_results = false;
+                    queue.push_back(Task::to_task(out_batch));
+                }
+            }
+        }
+#else // NBA_BRANCH_SPLIT_COPY
 #if (NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ENABLED \
-     || NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ALWAYS)
-#  if NBA_BRANCHPRED_SCHEME != NBA_BRANCHPRED_ALWAYS
+     || NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ALWAYS \
+     || NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE)
+#  if NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE
+        /* The adaptive build selects the scheme at runtime. */
+        int predicted_output = -1;
+        switch (ctx->branchpred_scheme) {
+        case NBA_BRANCHPRED_ADAPTIVE:
+            /* use branch prediction when the decayed miss ratio is below
+             * the configured threshold. */
+            predicted_output = predict_branch(current_elem->branch_hist, num_outputs,
+                                              ctx->branchpred_miss_percent);
+            break;
+        case NBA_BRANCHPRED_ENABLED:
+            if ((current_elem->branch_total >> 2) <= current_elem->branch_miss)
+                break;
+            /* fall through */
+        case NBA_BRANCHPRED_ALWAYS:
+            predicted_output = majority_branch(current_elem->branch_count, num_outputs);
+            break;
+        }
+        if (predicted_output >= 0)
+#  elif NBA_BRANCHPRED_SCHEME != NBA_BRANCHPRED_ALWAYS
         /* use branch prediction when miss < total / 4. */
         if ((current_elem->branch_total >> 2) > (current_elem->branch_miss))
 #  endif
@@ -398,27 +710,23 @@ void ElementGraph::process_batch(PacketBatch *batch)
         /* Code Path 1: Use branch prediction. */
         {
             /* Allocate copy-batches, but do NOT initialize them yet. */
-            while (rte_mempool_get_bulk(ctx->batch_pool,
-                                        (void **) &out_batches,
-                                        num_outputs) == -ENOENT
+            while (ctx->batch_freelist.get_bulk((void **) &out_batches,
+                                                num_outputs) == -ENOENT
                    && !ctx->io_ctx->loop_broken)
             {
+                ctx->io_ctx->num_batch_waiters ++;
                 ev_run(ctx->io_ctx->loop, 0);
+                ctx->io_ctx->num_batch_waiters --;
             }
             bool out_batches_used[num_outputs];
             memzero(out_batches_used, num_outputs);
 
+            #if NBA_BRANCHPRED_SCHEME != NBA_BRANCHPRED_ADAPTIVE
             /* Get the index of the output port for which most packets have
              * took their path. */
-            int predicted_output = 0;
-            uint64_t current_max = 0;
-            for (unsigned k = 0; k < num_outputs; k++) {
-                if (current_max < current_elem->branch_count[k]) {
-                    current_max = current_elem->branch_count[k];
-                    predicted_output = k;
-                }
-            }
-            rte_mempool_put(ctx->batch_pool, out_batches[predicted_output]);
+            int predicted_output = majority_branch(current_elem->branch_count, num_outputs);
+            #endif
+            ctx->batch_freelist.put(out_batches[predicted_output]);
             out_batches[predicted_output] = batch;
             out_batches_used[predicted_output] = true;
 
@@ -443,7 +751,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                         if (unlikely(!out_batches_used[o])) {
                             /* out_batch is not initialized yet... */
                             out_batches_used[o] = true;
-                            new (out_batches[o]) PacketBatch();
+                            out_batches[o]->reset();
                             anno_copy(&out_batches[o]->banno, &batch->banno);
                             out_batches[o]->recv_timestamp = batch->recv_timestamp;
                             out_batches[o]->generation = batch->generation + 1;
@@ -454,7 +762,8 @@ void ElementGraph::process_batch(PacketBatch *batch)
                         break; }
                     case DROP: {
                         #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
-                        rte_ring_enqueue(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
+                        defer_drop(ctx->io_ctx, batch->packets[pkt_idx]);
+                        current_elem->stat.num_drops ++;
                         #endif
                         break; }
                     case PENDING: {
@@ -476,7 +785,14 @@ void ElementGraph::process_batch(PacketBatch *batch)
                 batch->collect_excluded_packets();
             if (ctx->inspector)
                 ctx->inspector->drop_pkt_count += batch->drop_count;
-            batch->clean_drops(ctx->io_ctx->drop_queue);
+            drop_excluded(current_elem, batch);
+            #endif
+            current_elem->stat.num_branch_hits += current_elem->branch_count[predicted_output];
+            current_elem->stat.num_branch_misses += current_elem->branch_total
+                                                    - current_elem->branch_count[predicted_output];
+            current_elem->stat.num_branch_predicted ++;
+            #if NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE
+            decay_branch_hist(current_elem->branch_hist, current_elem->branch_count, num_outputs);
             #endif
 
             //if (current_elem->branch_total & BRANCH_TRUNC_LIMIT) {
@@ -491,8 +807,8 @@ void ElementGraph::process_batch(PacketBatch *batch)
              * output port using copy-batches. */
             for (unsigned o = 0; o < num_outputs; o++) {
                 if (likely(out_batches_used[o])) {
-                    assert(current_elem->next_elems[o] != nullptr);
-                    if (current_elem->next_elems[o]->get_type() & ELEMTYPE_OUTPUT) {
+                    assert(d->next_elems[o] != nullptr);
+                    if (d->next_is_output[o]) {
 
                         if (ctx->inspector) {
                             ctx->inspector->tx_batch_count ++;
@@ -505,8 +821,8 @@ void ElementGraph::process_batch(PacketBatch *batch)
 
                     } else {
 
-                        Element *next_el = current_elem->next_elems[o];
-                        int next_input_port = current_elem->next_connected_inputs[o];
+                        Element *next_el = d->next_elems[o];
+                        int next_input_port = d->next_inputs[o];
 
                         out_batches[o]->tracker.element = next_el;
                         out_batches[o]->tracker.input_port = next_input_port;
@@ -518,7 +834,7 @@ void ElementGraph::process_batch(PacketBatch *batch)
                     }
                 } else {
                     /* This batch is unused! */
-                    rte_mempool_put(ctx->batch_pool, out_batches[o]);
+                    ctx->batch_freelist.put(out_batches[o]);
                 }
             }
         }
@@ -527,20 +843,22 @@ void ElementGraph::process_batch(PacketBatch *batch)
 #  endif
 #endif // endif(code-path-1)
 #if (NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_DISABLED \
-     || NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ENABLED)
+     || NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ENABLED \
+     || NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE)
 #  pragma message "Non-branch prediction path enabled."
         /* Code Path 2: No branch prediction. */
         {
             /* Allocate and initialize copy-batches. */
-            while (rte_mempool_get_bulk(ctx->batch_pool,
-                                        (void **) out_batches,
-                                        num_outputs) == -ENOENT
+            while (ctx->batch_freelist.get_bulk((void **) out_batches,
+                                                num_outputs) == -ENOENT
                    && !ctx->io_ctx->loop_broken)
             {
+                ctx->io_ctx->num_batch_waiters ++;
                 ev_run(ctx->io_ctx->loop, 0);
+                ctx->io_ctx->num_batch_waiters --;
             }
             for (unsigned o = 0; o < num_outputs; o++) {
-                new (out_batches[o]) PacketBatch();
+                out_batches[o]->reset();
                 anno_copy(&out_batches[o]->banno, &batch->banno);
                 out_batches[o]->recv_timestamp = batch->recv_timestamp;
                 out_batches[o]->generation = batch->generation + 1;
@@ -548,6 +866,37 @@ void ElementGraph::process_batch(PacketBatch *batch)
                 INIT_BATCH_MASK(out_batches[o]);
             }
 
+            #if NBA_BATCHING_SCHEME == NBA_BATCHING_BITVECTOR
+            /* Classify packets into copy-batches by comparing the results
+             * against each output port at once. */
+            const unsigned nw = (batch->count + 63) >> 6;
+            uint64_t sel_mask[NBA_BATCH_MASK_WORDS];
+            uint64_t left_mask[NBA_BATCH_MASK_WORDS];
+            memcpy(left_mask, batch->mask, sizeof(uint64_t) * nw);
+            for (unsigned o = 0; o < num_outputs; o++) {
+                batch_mask_split(left_mask, results, nw, o, sel_mask, left_mask);
+                FOR_EACH_PACKET_IN_MASK(sel_mask, batch->count) {
+                    ADD_PACKET(out_batches[o], batch->packets[pkt_idx]);
+                } END_FOR_IN_MASK;
+            }
+            FOR_EACH_PACKET_IN_MASK(left_mask, batch->count) {
+                switch (results[pkt_idx]) {
+                case DROP: {
+                    defer_drop(ctx->io_ctx, batch->packets[pkt_idx]);
+                    current_elem->stat.num_drops ++;
+                    break; }
+                case PENDING: {
+                    /* The packet is now stored in io_thread_ctx::pended_pkt_queue. */
+                    break; }
+                default: {
+                    rte_panic("Invalid output port %d. (element: %s)\n",
+                              results[pkt_idx], current_elem->class_name());
+                    break; }
+                }
+            } END_FOR_IN_MASK;
+            /* Packets are excluded from original batch in ALL cases. */
+            memzero(batch->mask, NBA_BATCH_MASK_WORDS);
+            #else
             /* Classify packets into copy-batches. */
             FOR_EACH_PACKET(batch) {
                 int o = results[pkt_idx];
@@ -567,9 +916,8 @@ void ElementGraph::process_batch(PacketBatch *batch)
                     ADD_PACKET(out_batches[o], batch->packets[pkt_idx]);
                     break; }
                 case DROP: {
-                    #if NBA_BATCHING_SCHEME != NBA_BATCHING_CONTINUOUS
-                    rte_ring_enqueue(ctx->io_ctx->drop_queue, batch->packets[pkt_idx]);
-                    #endif
+                    defer_drop(ctx->io_ctx, batch->packets[pkt_idx]);
+                    current_elem->stat.num_drops ++;
                     break; }
                 case PENDING: {
                     /* The packet is now stored in io_thread_ctx::pended_pkt_queue. */
@@ -580,21 +928,35 @@ void ElementGraph::process_batch(PacketBatch *batch)
                     break; }
                 }
                 /* Packets are excluded from original batch in ALL cases. */
-                /* Therefore, we do not have to collect_excluded_packets()
-                 * nor clean_drops()! */
+                /* Therefore, we do not have to collect_excluded_packets()! */
                 EXCLUDE_PACKET_MARK_ONLY(batch, pkt_idx);
             } END_FOR;
+            #endif
+            #if NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE
+            /* Copy-batches contain only the packets of their ports. */
+            for (unsigned o = 0; o < num_outputs; o++)
+                current_elem->branch_count[o] = out_batches[o]->count;
+            decay_branch_hist(current_elem->branch_hist, current_elem->branch_count, num_outputs);
+            #endif
+            current_elem->stat.num_branch_copied ++;
 
             /* With multiple outputs (branches happened), we have made
-             * copy-batches and the parent should free its batch. */
-            free_batch(batch);
+             * copy-batches and the parent should free its batch.
+             * Its packets now belong to the copy-batches (or are dropped
+             * above), so only the batch itself is released here after
+             * dropping those the element has already excluded. */
+            #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+            if (ctx->inspector) ctx->inspector->drop_pkt_count += batch->drop_count;
+            drop_excluded(current_elem, batch);
+            #endif
+            free_batch(batch, false);
 
             /* Recurse into the element subgraph starting from each
              * output port using copy-batches. */
             for (unsigned o = 0; o < num_outputs; o++) {
                 if (likely(out_batches[o]->count > 0)) {
-                    assert(current_elem->next_elems[o] != NULL);
-                    if (current_elem->next_elems[o]->get_type() & ELEMTYPE_OUTPUT) {
+                    assert(d->next_elems[o] != nullptr);
+                    if (d->next_is_output[o]) {
 
                         if (ctx->inspector) {
                             ctx->inspector->tx_batch_count ++;
@@ -607,8 +969,8 @@ void ElementGraph::process_batch(PacketBatch *batch)
 
                     } else {
 
-                        Element *next_el = current_elem->next_elems[o];
-                        int next_input_port = current_elem->next_connected_inputs[o];
+                        Element *next_el = d->next_elems[o];
+                        int next_input_port = d->next_inputs[o];
 
                         out_batches[o]->tracker.element = next_el;
                         out_batches[o]->tracker.input_port = next_input_port;
@@ -625,9 +987,86 @@ void ElementGraph::process_batch(PacketBatch *batch)
             } //endfor(recurse)
         }
 #endif //endif(code-path-2)
+#endif //endif(code-path-3)
     } //endif(numoutputs)
 }
 
+Element *ElementGraph::process_fused(Element *head, const struct fused_chain &fc,
+                                     int input_port, PacketBatch *batch,
+                                     bool &has_offloadable)
+{
+    Element *chain[NBA_MAX_FUSED_ELEMENTS];
+    int input_ports[NBA_MAX_FUSED_ELEMENTS];
+    const unsigned chain_len = fc.num_fused + 1;
+    assert(chain_len <= NBA_MAX_FUSED_ELEMENTS);
+
+    chain[0] = head;
+    input_ports[0] = input_port;
+    for (unsigned k = 1; k < chain_len; k++) {
+        chain[k] = chain[k - 1]->disp.next_elems[0];
+        input_ports[k] = chain[k - 1]->disp.next_inputs[0];
+    }
+    for (unsigned k = 0; k < chain_len; k++) {
+        memzero(chain[k]->output_counts, num_max_outputs);
+        if (chain[k]->disp.offloadable != nullptr)
+            has_offloadable = true;
+    }
+    /* The head is counted by process_batch(). */
+    for (unsigned k = 1; k < chain_len; k++) {
+        chain[k]->stat.num_batches ++;
+        chain[k]->stat.num_pkts_in += batch->count;
+    }
+
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    batch->has_dropped = false;
+    batch->drop_count = 0;
+    #endif
+    if (fc.run != nullptr) {
+        fc.run(fc.typed, input_ports, batch);
+    } else {
+        unsigned begin = 0;
+        while (begin < chain_len) {
+            if (fc.batch_loops & (1u << begin)) {
+                /* It sees only the packets not killed so far, and
+                 * resets the drop counts of the batch for its own. */
+                #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+                if (batch->has_dropped)
+                    batch->collect_excluded_packets();
+                unsigned prev_drop_count = batch->drop_count;
+                #endif
+                chain[begin]->_process_batch(input_ports[begin], batch);
+                #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+                batch->drop_count += prev_drop_count;
+                #endif
+                begin ++;
+                continue;
+            }
+            unsigned end = begin + 1;
+            while (end < chain_len && !(fc.batch_loops & (1u << end)))
+                end ++;
+            FOR_EACH_PACKET(batch) {
+                Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+                pkt->bidx = pkt_idx;
+                for (unsigned k = begin; k < end; k++) {
+                    chain[k]->process(input_ports[k], pkt);
+                    /* Single-output elements only push to port 0.
+                     * Anything else (drop, pending, etc.) ends the chain here
+                     * and is handled as the tail's result by process_batch(). */
+                    if (batch->results[pkt_idx] != 0)
+                        break;
+                }
+            } END_FOR;
+            begin = end;
+        }
+    }
+    #if NBA_BATCHING_SCHEME == NBA_BATCHING_CONTINUOUS
+    if (batch->has_dropped)
+        batch->collect_excluded_packets();
+    #endif
+    batch->tracker.has_results = true;
+    return chain[chain_len - 1];
+}
+
 void ElementGraph::process_offload_task(OffloadTask *otask)
 {
     uint64_t now = rte_rdtsc();
@@ -668,6 +1107,22 @@ void ElementGraph::flush_tasks()
     return;
 }
 
+bool ElementGraph::drain(uint64_t loop_count)
+{
+    for (OffloadableElement *oel : offl_elements)
+        oel->flush_offload(this);
+    flush_tasks();
+    /* This also resumes the batches returned from the device. */
+    scan_schedulable_elements(loop_count);
+    flush_tasks();
+    if (!queue.empty() || num_running_tasks > 0)
+        return false;
+    for (OffloadableElement *oel : offl_elements)
+        if (oel->has_pending_batches())
+            return false;
+    return true;
+}
+
 void ElementGraph::add_offload_action(struct offload_action_key *key)
 {
     assert(offl_actions != nullptr);
@@ -706,7 +1161,7 @@ bool ElementGraph::check_postproc_all(OffloadableElement *oel)
 
 bool ElementGraph::check_next_offloadable(Element *offloaded_elem)
 {
-    return ((offloaded_elem->next_elems[0]->get_type() & ELEMTYPE_OFFLOADABLE) != 0);
+    return (offloaded_elem->disp.next_elems[0]->disp.offloadable != nullptr);
 }
 
 Element *ElementGraph::get_first_next(Element *elem)
@@ -718,6 +1173,7 @@ int ElementGraph::add_element(Element *new_elem)
 {
     new_elem->update_port_count();
     new_elem->ctx = this->ctx;
+    new_elem->elem_idx = elements.size();
     elements.push_back(new_elem);
 
     if (new_elem->get_type() & ELEMTYPE_SCHEDULABLE) {
@@ -762,10 +1218,176 @@ int ElementGraph::link_element(Element *to_elem, int input_port,
 
 int ElementGraph::validate()
 {
-    // TODO: implement
+    // TODO: check the writer-reader pairs of structured annotations.
+    for (Element *el : elements) {
+        struct element_dispatch &d = el->disp;
+        d.type = el->get_type();
+        d.offloadable = (d.type & ELEMTYPE_OFFLOADABLE)
+                        ? dynamic_cast<OffloadableElement*>(el) : nullptr;
+        if ((d.type & ELEMTYPE_OFFLOADABLE) && d.offloadable == nullptr)
+            return -1;
+        d.num_outputs = el->next_elems.size();
+        for (unsigned o = 0; o < d.num_outputs; o++) {
+            d.next_elems[o] = el->next_elems[o];
+            d.next_inputs[o] = el->next_connected_inputs[o];
+            d.next_is_output[o] = (el->next_elems[o]->get_type() & ELEMTYPE_OUTPUT) != 0;
+        }
+    }
     return 0;
 }
 
+static inline bool is_fusable(Element *el)
+{
+    /* Only elements with the per-packet _process_batch() semantics
+     * (including the CPU path of offloadables) can be fused.
+     * Those with their own batch loop keep it inside the chain. */
+    int type = el->get_type();
+    return (type == ELEMTYPE_PER_PACKET)
+           || (type == (ELEMTYPE_PER_PACKET | ELEMTYPE_BATCH_LOOP))
+           || (type == (ELEMTYPE_OFFLOADABLE | ELEMTYPE_SCHEDULABLE));
+}
+
+void ElementGraph::fuse_linear_groups()
+{
+    for (Element *el : elements) {
+        memzero(&el->fused_cpu, 1);
+        memzero(&el->fused_offl, 1);
+        if (!is_fusable(el) || el->get_linear_group() == -1)
+            continue;
+
+        /* Extend the chain while the next one is in the same linear group,
+         * which implies a single output and a single input in between. */
+        bool reached_offloadable = (el->disp.offloadable != nullptr);
+        if (el->get_type() & ELEMTYPE_BATCH_LOOP)
+            el->fused_cpu.batch_loops |= 1u;
+        Element *cur = el;
+        while (cur->next_elems.size() == 1
+               && el->fused_cpu.num_fused + 1 < NBA_MAX_FUSED_ELEMENTS) {
+            Element *next = cur->next_elems[0];
+            if (next->get_linear_group() != el->get_linear_group()
+                || !is_fusable(next))
+                break;
+            /* If the batch may be offloaded, stop before the next
+             * offloadable element so that it can decide to offload. */
+            if (next->disp.offloadable != nullptr)
+                reached_offloadable = true;
+            el->fused_cpu.num_fused ++;
+            if (next->get_type() & ELEMTYPE_BATCH_LOOP)
+                el->fused_cpu.batch_loops |= (1u << el->fused_cpu.num_fused);
+            if (!reached_offloadable)
+                el->fused_offl.num_fused ++;
+            cur = next;
+        }
+        /* The offloading chain is a prefix of the CPU chain. */
+        el->fused_offl.batch_loops = el->fused_cpu.batch_loops
+                                     & ((2u << el->fused_offl.num_fused) - 1);
+        if (el->fused_cpu.num_fused > 0)
+            RTE_LOG(INFO, ELEM, "Element [%s] fuses %u next elements (%u if offloading)\n",
+                    el->class_name(), el->fused_cpu.num_fused, el->fused_offl.num_fused);
+    }
+}
+
+#ifdef NBA_STATIC_GRAPH
+static void bind_static_chain(Element *const *chain, unsigned chain_len,
+                              struct fused_chain &fc)
+{
+    /* The static chains are single per-packet loops. */
+    if (fc.batch_loops != 0)
+        return;
+    string signature(chain[0]->class_name());
+    for (unsigned k = 1; k < chain_len; k++) {
+        signature.append(",");
+        signature.append(chain[k]->class_name());
+    }
+    for (size_t i = 0; i < num_static_chains; i++) {
+        if (signature != static_chains[i].signature)
+            continue;
+        if (!static_chains[i].bind(chain, fc.typed))
+            break;
+        fc.run = static_chains[i].run;
+        return;
+    }
+    RTE_LOG(WARNING, ELEM, "No static chain for [%s]; using the generic loop.\n",
+            signature.c_str());
+}
+
+void ElementGraph::bind_static_chains()
+{
+    Element *chain[NBA_MAX_FUSED_ELEMENTS];
+    for (Element *el : elements) {
+        if (el->fused_cpu.num_fused == 0)
+            continue;
+        chain[0] = el;
+        for (unsigned k = 1; k <= el->fused_cpu.num_fused; k++)
+            chain[k] = chain[k - 1]->next_elems[0];
+        /* The offloading chain is always a prefix of the CPU chain. */
+        bind_static_chain(chain, el->fused_cpu.num_fused + 1, el->fused_cpu);
+        if (el->fused_offl.num_fused > 0)
+            bind_static_chain(chain, el->fused_offl.num_fused + 1, el->fused_offl);
+    }
+}
+#endif
+
+#if NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE
+void ElementGraph::print_branch_stats()
+{
+    for (Element *el : elements) {
+        const struct element_stat *s = &el->stat;
+        uint64_t total = s->num_branch_predicted + s->num_branch_copied;
+        if (total == 0)
+            continue;
+        RTE_LOG(INFO, ELEM, "Element [%s] split %lu batches: %lu predicted (%lu hits, %lu misses), %lu full\n",
+                el->class_name(), total, s->num_branch_predicted,
+                s->num_branch_hits, s->num_branch_misses, s->num_branch_copied);
+    }
+}
+#endif
+
+void ElementGraph::export_stats(struct io_node_stat *node_stat)
+{
+    unsigned idx = 0;
+    for (Element *el : elements) {
+        struct io_elem_stat_atomic *ns = &node_stat->elem_stats[idx];
+        struct element_stat *s = &el->stat, *x = &el->stat_exported;
+        rte_atomic64_add(&ns->num_batches, s->num_batches - x->num_batches);
+        rte_atomic64_add(&ns->num_pkts_in, s->num_pkts_in - x->num_pkts_in);
+        rte_atomic64_add(&ns->num_drops, s->num_drops - x->num_drops);
+        rte_atomic64_add(&ns->num_sampled_pkts, s->num_sampled_pkts - x->num_sampled_pkts);
+        rte_atomic64_add(&ns->num_sampled_cycles, s->num_sampled_cycles - x->num_sampled_cycles);
+        rte_atomic64_add(&ns->num_branch_hits, s->num_branch_hits - x->num_branch_hits);
+        rte_atomic64_add(&ns->num_branch_misses, s->num_branch_misses - x->num_branch_misses);
+        rte_atomic64_add(&ns->num_branch_predicted, s->num_branch_predicted - x->num_branch_predicted);
+        rte_atomic64_add(&ns->num_branch_copied, s->num_branch_copied - x->num_branch_copied);
+        *x = *s;
+        /* All comp threads in a node have the same graph. */
+        node_stat->elem_names[idx] = el->class_name();
+        idx ++;
+    }
+    node_stat->num_elems = idx;
+}
+
+void ElementGraph::print_elem_stats()
+{
+    const PerfCounterGroup *perf = ctx->io_ctx->perf;
+    for (Element *el : elements) {
+        const struct element_stat &s = el->stat;
+        if (s.num_batches == 0)
+            continue;
+        RTE_LOG(INFO, ELEM, "Element [%s] %lu batches, %lu packets in, %lu dropped, %.1f cycles/pkt\n",
+                el->class_name(), s.num_batches, s.num_pkts_in, s.num_drops,
+                (s.num_sampled_pkts == 0) ? 0.0 : (double) s.num_sampled_cycles / s.num_sampled_pkts);
+        if (perf == nullptr || s.num_sampled_pkts == 0)
+            continue;
+        char buf[256];
+        char *bufp = buf;
+        for (unsigned e = 0, n = perf->size(); e < n; e++)
+            bufp += snprintf(bufp, buf + sizeof(buf) - bufp, " %.2f %s/pkt,",
+                             (double) el->perf_sampled[e] / s.num_sampled_pkts, perf->event_name(e));
+        *(bufp - 1) = '\0';
+        RTE_LOG(INFO, ELEM, "Element [%s]%s\n", el->class_name(), buf);
+    }
+}
+
 const FixedRing<Element*>& ElementGraph::get_elements() const
 {
     return elements;
@@ -37,16 +37,22 @@ int GraphMetaData::get_linear_group()
 }
 
 void GraphAnalyzer::analyze(ParseInfo* info)
+{
+    vector<GraphMetaData*> roots;
+    int total_roots = click_num_root(info);
+    for (int root_id = 0; root_id < total_roots; root_id++)
+        roots.push_back((GraphMetaData*) click_get_root(info, root_id));
+    analyze(roots);
+}
+
+void GraphAnalyzer::analyze(const vector<GraphMetaData*> &roots)
 {
     unordered_set<GraphMetaData*> visited;
     int linear_group_id = 0;
-    int total_modules = click_num_module(info);
-    int total_roots = click_num_root(info);
 
     /* This loop groups elements into a set of disjoint linear paths. */
-    for (int root_id = 0; root_id < total_roots; root_id++) {
+    for (GraphMetaData *root : roots) {
         /* Begin with all root elements (if there are disjoint sets of elements). */
-        GraphMetaData * root = (GraphMetaData*) click_get_root(info, root_id);
         stack<GraphMetaData*> dfsStack;
         dfsStack.push(root);
 
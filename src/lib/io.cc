@@ -18,12 +18,10 @@
 #include <nba/framework/loadbalancer.hh>
 #include <nba/framework/elementgraph.hh>
 #include <nba/framework/computecontext.hh>
+#include <nba/framework/trace.hh>
 #include <nba/element/packet.hh>
 #include <nba/element/packetbatch.hh>
 
-#ifdef NBA_CPU_MICROBENCH
-#include <papi.h>
-#endif
 #include <unistd.h>
 #include <pthread.h>
 #include <signal.h>
@@ -45,6 +43,7 @@
 #include <rte_mbuf.h>
 #include <rte_byteorder.h>
 #include <rte_ethdev.h>
+#include <rte_interrupts.h>
 #include <rte_prefetch.h>
 #include <rte_cycles.h>
 #include <rte_ring.h>
@@ -56,6 +55,7 @@
 #include <nvToolsExt.h>
 #endif
 
+#include <algorithm>
 #include <functional>
 #include <random>
 
@@ -77,6 +77,56 @@ typedef function<uint32_t(void)> random32_func_t;
 typedef function<uint64_t(void)> random64_func_t;
 typedef function<void(char*, int, int, random32_func_t)> packet_builder_func_t;
 
+/* ===== PERF =====
+ * The io loop attributes the hardware counters to the RX stage (NIC
+ * polling) and the comp stage (the rest of each iteration), chaining
+ * the readings so that each iteration reads the counters twice.
+ * io_tx_batch() and the TX flushes measure themselves as the TX stage. */
+static inline void io_perf_read(struct io_thread_context *ctx, uint64_t *begin)
+{
+    if (ctx->perf != nullptr)
+        ctx->perf->read(begin);
+}
+
+/* Adds the counts since begin to the stage and restarts begin from now.
+ * The TX counts nested in the comp stage are subtracted only when the comp
+ * stage ends, so that the exported counters never go backwards. */
+static inline void io_perf_add(struct io_thread_context *ctx, enum io_perf_stage stage, uint64_t *begin)
+{
+    if (ctx->perf == nullptr)
+        return;
+    uint64_t now[NBA_PERF_MAX_EVENTS];
+    ctx->perf->read(now);
+    for (unsigned e = 0, n = ctx->perf->size(); e < n; e++) {
+        uint64_t delta = now[e] - begin[e];
+        if (stage == IO_PERF_TX) {
+            ctx->perf_tx_nested[e] += delta;
+        } else if (stage == IO_PERF_COMP) {
+            delta -= RTE_MIN(delta, ctx->perf_tx_nested[e]);
+            ctx->perf_tx_nested[e] = 0;
+        }
+        ctx->perf_counts[stage][e] += delta;
+        begin[e] = now[e];
+    }
+}
+
+static void io_perf_print(struct io_thread_context *ctx)
+{
+    static const char *const stage_names[IO_PERF_NUM_STAGES] = {"rx", "comp", "tx"};
+    char buf[512];
+    for (unsigned s = 0; s < IO_PERF_NUM_STAGES; s++) {
+        char *bufp = buf;
+        for (unsigned e = 0, n = ctx->perf->size(); e < n; e++) {
+            bufp += snprintf(bufp, buf + sizeof(buf) - bufp, "  %s %'lu", ctx->perf->event_name(e),
+                             ctx->perf_counts[s][e] - ctx->perf_reported[s][e]);
+            ctx->perf_reported[s][e] = ctx->perf_counts[s][e];
+        }
+        RTE_LOG(INFO, IO, "perf[%u:%u@%u] %-4s%s\n", ctx->loc.node_id, ctx->loc.local_thread_idx,
+                ctx->loc.core_id, stage_names[s], buf);
+    }
+}
+/* ===== END_OF_PERF ===== */
+
 /* ===== COMP ===== */
 static void comp_packetbatch_init(struct rte_mempool *mp, void *arg, void *obj, unsigned idx)
 {
@@ -127,6 +177,10 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
         uint64_t now = rdtscp();
         OffloadTask *task = tasks[t];
         ComputeContext *cctx = task->cctx;
+        /* The task may belong to the graph retired by a reload. */
+        ElementGraph *elemgraph = task->elemgraph;
+        elemgraph->finish_offload_task();
+        trace_record(TRACE_COMPLETION_BEGIN, 0, (uintptr_t) task);
         #ifdef USE_NVPROF
         nvtxRangePush("task");
         #endif
@@ -134,12 +188,12 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
         /* Run postprocessing handlers. */
         task->postprocess();
 
-        if (ctx->elem_graph->check_postproc_all(task->elem)) {
+        if (elemgraph->check_postproc_all(task->elem)) {
             /* Reset all datablock trackers. */
             for (PacketBatch *batch : task->batches) {
                 if (batch->datablock_states != nullptr) {
                     struct datablock_tracker *t = batch->datablock_states;
-                    rte_mempool_put(ctx->dbstate_pool, (void *) t);
+                    ctx->dbstate_freelist.put((void *) t);
                     batch->datablock_states = nullptr;
                 }
             }
@@ -150,6 +204,7 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
 
         /* Update statistics. */
         uint64_t task_cycles = now - task->offload_start;
+        ctx->inspector->task_latency_hist.record(task_cycles);
         float time_spent = (float) task_cycles / rte_get_tsc_hz();
         uint64_t task_count = ctx->inspector->dev_finished_task_count[task->local_dev_idx];
         ctx->inspector->avg_task_completion_sec[task->local_dev_idx] \
@@ -162,7 +217,7 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
         for (PacketBatch *batch : task->batches)
             total_batch_size += batch->count;
         #if NBA_REUSE_DATABLOCKS == 1
-        if (ctx->elem_graph->check_next_offloadable(task->elem)) {
+        if (elemgraph->check_next_offloadable(task->elem)) {
             for (PacketBatch *batch : task->batches) {
                 batch->compute_time += (uint64_t)
                         ((float) task_cycles / total_batch_size
@@ -177,9 +232,9 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
             ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
 
             /* Enqueue it to ElemGraph. */
-            ctx->elem_graph->enqueue_offload_task(task,
-                                                  ctx->elem_graph->get_first_next(task->elem),
-                                                  0);
+            elemgraph->enqueue_offload_task(task,
+                                            elemgraph->get_first_next(task->elem),
+                                            0);
             /* This task is reused. We keep them intact. */
         } else {
         #else
@@ -196,13 +251,14 @@ static void comp_offload_task_completion_cb(struct ev_loop *loop, struct ev_asyn
             task->cctx->release_task_id(task->task_id);
             task->cctx = nullptr;
             task->~OffloadTask();
-            rte_mempool_put(ctx->task_pool, (void *) task);
+            ctx->task_freelist.put((void *) task);
             ev_break(ctx->io_ctx->loop, EVBREAK_ALL);
         }
 
         /* Free the resources used for this offload task. */
         cctx->currently_running_task = nullptr;
         cctx->state = ComputeContext::READY;
+        trace_record(TRACE_COMPLETION_END, 0, (uintptr_t) task);
 
         #ifdef USE_NVPROF
         nvtxRangePop();
@@ -220,18 +276,20 @@ static size_t comp_process_batch(io_thread_context *ctx, void *pkts, size_t coun
     int ret;
     PacketBatch *batch = nullptr;
     while (true) {
-        ret = rte_mempool_get(ctx->comp_ctx->batch_pool, (void **) &batch);
+        ret = ctx->comp_ctx->batch_freelist.get((void **) &batch);
         if (unlikely(ctx->loop_broken)) return 0;
         if (ret == -ENOENT) {
             /* Wait until some batches are freed. */
+            ctx->num_batch_waiters ++;
             ev_run(ctx->loop, 0);
+            ctx->num_batch_waiters --;
         } else
             break;
     }
 
     /* Okay, let's initialize a new packet batch. */
     assert(batch != nullptr);
-    new (batch) PacketBatch();
+    batch->reset();
     memcpy((void **) &batch->packets[0], (void **) pkts, count * sizeof(void*));
     batch->banno.bitmask = 0;
     anno_set(&batch->banno, NBA_BANNO_LB_DECISION, -1);
@@ -245,6 +303,7 @@ static size_t comp_process_batch(io_thread_context *ctx, void *pkts, size_t coun
     INIT_BATCH_MASK(batch);
     batch->recv_timestamp = t;
     batch->batch_id = recv_batch_cnt;
+    trace_record(TRACE_BATCH_ALLOC, count, (uintptr_t) batch);
     #if NBA_BATCHING_SCHEME == NBA_BATCHING_LINKEDLIST
     batch->first_idx = 0;
     batch->last_idx = batch->count - 1;
@@ -263,13 +322,28 @@ static size_t comp_process_batch(io_thread_context *ctx, void *pkts, size_t coun
         prev_pkt = pkt;
         #endif
 
+        /* Parse the headers once for all elements. */
+        pkt->parse_headers();
+
         /* Set annotations and strip the temporary headroom. */
         pkt->anno.bitmask = 0;
         anno_set(&pkt->anno, NBA_ANNO_IFACE_IN,
                  batch->packets[pkt_idx]->port);
         anno_set(&pkt->anno, NBA_ANNO_TIMESTAMP, t);
         anno_set(&pkt->anno, NBA_ANNO_BATCH_ID, recv_batch_cnt);
+        #if NBA_BATCH_SOA_META
+        batch->meta.iface_in[pkt_idx]  = batch->packets[pkt_idx]->port;
+        batch->meta.iface_out[pkt_idx] = NBA_META_NONE16;
+        batch->meta.flow_id[pkt_idx]   = NBA_META_NONE32;
+        batch->meta.timestamp[pkt_idx] = t;
+        batch->meta.l3_offset[pkt_idx] = pkt->network_header_offset();
+        batch->meta.l4_offset[pkt_idx] = pkt->transport_header_offset();
+        #endif
     } END_FOR_ALL_INIT_PREFETCH;
+    #if NBA_BATCH_SOA_META
+    batch->meta.valid = true;
+    batch->meta.hdrs_valid = true;
+    #endif
     recv_batch_cnt ++;
 
     /* Run the element graph's schedulable elements.
@@ -277,6 +351,166 @@ static size_t comp_process_batch(io_thread_context *ctx, void *pkts, size_t coun
     ctx->comp_ctx->elem_graph->feed_input(0, batch, loop_count);
     return count;
 }
+
+/* ===== Work stealing =====
+ * An overloaded IO thread sheds flow partitions: the packets whose RSS
+ * hash falls into a shed partition are bundled and published to the
+ * node-wide steal queue of the partition instead of being processed
+ * locally.  Idle threads in the same node drain those queues.
+ * Only one thread drains a queue at a time and it runs the drained
+ * batches to completion (including offloads) and flushes its TX buffers
+ * before releasing the queue.  An IO thread does the same with its own
+ * batches before it starts shedding a partition.  Hence the packets of
+ * a flow leave in order.
+ * (Elements that keep per-flow states must use node-local storage.)
+ */
+static inline unsigned io_steal_partition(struct rte_mbuf *m)
+{
+    /* The NIC uses the LSBs of the hash to choose the RX queue,
+     * so we use higher bits to split the flows of a queue. */
+    return (m->hash.rss >> 16) & (NBA_STEAL_QUEUES - 1);
+}
+
+static inline bool io_steal_claim(struct io_steal_queue *sq)
+{
+    return rte_atomic32_cmpset((volatile uint32_t *) &sq->owner.cnt, 0, 1);
+}
+
+/* Runs all batches in the element graph to the end, waiting for the
+ * offloaded ones to come back, and sends out the results. */
+static void io_steal_finish(io_thread_context *ctx, uint64_t loop_count)
+{
+    ElementGraph *graph = ctx->comp_ctx->elem_graph;
+    while (!graph->drain(loop_count) && !ctx->loop_broken)
+        ev_run(ctx->loop, EVRUN_NOWAIT);
+    io_tx_flush(ctx, true);
+}
+
+static inline void io_steal_release(io_thread_context *ctx, struct io_steal_queue *sq,
+                                    uint64_t loop_count)
+{
+    io_steal_finish(ctx, loop_count);
+    rte_atomic32_clear(&sq->owner);
+}
+
+/* The caller must own the queue. */
+static unsigned io_steal_drain(io_thread_context *ctx, struct io_steal_queue *sq,
+                               unsigned max_bundles, uint64_t loop_count)
+{
+    struct io_steal_bundle *bundle = nullptr;
+    unsigned n = 0;
+    while (n < max_bundles && rte_ring_dequeue(sq->ring, (void **) &bundle) == 0) {
+        comp_process_batch(ctx, &bundle->pkts[0], bundle->count, loop_count);
+        rte_mempool_put(ctx->node_steal->bundle_pool, bundle);
+        n ++;
+    }
+    return n;
+}
+
+static void io_steal_publish(io_thread_context *ctx, unsigned q,
+                             struct io_steal_bundle *bundle, uint64_t loop_count)
+{
+    struct io_steal_queue *sq = &ctx->node_steal->queues[q];
+    if (likely(rte_ring_enqueue(sq->ring, bundle) == 0))
+        return;
+    if (io_steal_claim(sq)) {
+        /* Nobody steals fast enough.  Drain it by ourselves in order. */
+        io_steal_drain(ctx, sq, NBA_STEAL_RING_SIZE, loop_count);
+        comp_process_batch(ctx, &bundle->pkts[0], bundle->count, loop_count);
+        io_steal_release(ctx, sq, loop_count);
+    } else {
+        for (unsigned k = 0; k < bundle->count; k++) {
+            ctx->port_stats[bundle->pkts[k]->port].num_sw_drop_pkts ++;
+            rte_pktmbuf_free(bundle->pkts[k]);
+        }
+    }
+    rte_mempool_put(ctx->node_steal->bundle_pool, bundle);
+}
+
+/* Publishes the packets in the shed partitions and returns the number of
+ * remaining packets, which are compacted at the front of pkts. */
+static unsigned io_steal_shed(io_thread_context *ctx, struct rte_mbuf **pkts,
+                              unsigned count, uint64_t loop_count)
+{
+    struct io_steal_bundle *bundles[NBA_STEAL_QUEUES] = {nullptr,};
+    const unsigned comp_batch_size = ctx->comp_ctx->num_combatch_size;
+    unsigned num_kept = 0;
+    for (unsigned i = 0; i < count; i++) {
+        struct rte_mbuf *m = pkts[i];
+        unsigned q = io_steal_partition(m);
+        if (!(m->ol_flags & PKT_RX_RSS_HASH) || !(ctx->steal_shed_mask & (1u << q))) {
+            pkts[num_kept ++] = m;
+            continue;
+        }
+        if (bundles[q] == nullptr) {
+            if (unlikely(rte_mempool_get(ctx->node_steal->bundle_pool, (void **) &bundles[q]) != 0)) {
+                ctx->port_stats[m->port].num_sw_drop_pkts ++;
+                rte_pktmbuf_free(m);
+                continue;
+            }
+            bundles[q]->count = 0;
+        }
+        bundles[q]->pkts[bundles[q]->count ++] = m;
+        if (bundles[q]->count == comp_batch_size) {
+            io_steal_publish(ctx, q, bundles[q], loop_count);
+            bundles[q] = nullptr;
+        }
+    }
+    for (unsigned q = 0; q < NBA_STEAL_QUEUES; q++) {
+        if (bundles[q] != nullptr)
+            io_steal_publish(ctx, q, bundles[q], loop_count);
+    }
+    return num_kept;
+}
+
+/* Sheds one more partition when overloaded, or takes back one when not,
+ * only after the load state has lasted NBA_STEAL_HYSTERESIS iterations. */
+static void io_steal_update_load(io_thread_context *ctx, bool overloaded, uint64_t loop_count)
+{
+    if (overloaded != ctx->steal_overloaded) {
+        ctx->steal_overloaded = overloaded;
+        ctx->steal_streak = 0;
+    }
+    if (++ ctx->steal_streak < NBA_STEAL_HYSTERESIS)
+        return;
+    ctx->steal_streak = 0;
+    for (unsigned k = 0; k < NBA_STEAL_QUEUES; k++) {
+        /* Threads start from different partitions to shed different flows. */
+        unsigned q = (ctx->loc.local_thread_idx + k) % NBA_STEAL_QUEUES;
+        struct io_steal_queue *sq = &ctx->node_steal->queues[q];
+        if (overloaded && !(ctx->steal_shed_mask & (1u << q))) {
+            /* Our earlier packets of the partition must leave first. */
+            io_steal_finish(ctx, loop_count);
+            ctx->steal_shed_mask |= (1u << q);
+            NBA_LOG_DEBUG(IO, "@%u: shedding flow partition %u\n", ctx->loc.core_id, q);
+            break;
+        }
+        /* Our packets may be still queued or being processed by others. */
+        if (!overloaded && (ctx->steal_shed_mask & (1u << q))
+            && rte_ring_empty(sq->ring) && rte_atomic32_read(&sq->owner) == 0) {
+            ctx->steal_shed_mask &= ~(1u << q);
+            NBA_LOG_DEBUG(IO, "@%u: taking back flow partition %u\n", ctx->loc.core_id, q);
+            break;
+        }
+    }
+}
+
+/* Processes a few bundles from a steal queue, if any.
+ * Returns whether any work has been stolen. */
+static bool io_steal_work(io_thread_context *ctx, uint64_t loop_count)
+{
+    for (unsigned k = 0; k < NBA_STEAL_QUEUES; k++) {
+        unsigned q = (ctx->steal_next_queue + k) % NBA_STEAL_QUEUES;
+        struct io_steal_queue *sq = &ctx->node_steal->queues[q];
+        if (rte_ring_empty(sq->ring) || !io_steal_claim(sq))
+            continue;
+        io_steal_drain(ctx, sq, 8, loop_count);
+        io_steal_release(ctx, sq, loop_count);
+        ctx->steal_next_queue = (q + 1) % NBA_STEAL_QUEUES;
+        return true;
+    }
+    return false;
+}
 /* ===== END_OF_COMP ===== */
 
 /* Taken from PSIO */
@@ -315,6 +549,56 @@ static inline uint32_t io_myrand(uint64_t *seed) /*{{{*/
     return (uint32_t)(*seed >> 32);
 }/*}}}*/
 
+static void io_export_thread_stats(io_thread_context *ctx)/*{{{*/
+{
+    struct shm_section *sec = ctx->shm_section;
+    const unsigned n = ctx->loc.node_id, c = ctx->loc.core_id;
+    shmstats_begin(sec);
+    shmstats_add(sec, SHM_COUNTER, ctx->total_recv_pkts, "nba_thread_rx_packets{node=\"%u\",core=\"%u\"}", n, c);
+    shmstats_add(sec, SHM_COUNTER, ctx->total_sent_pkts, "nba_thread_tx_packets{node=\"%u\",core=\"%u\"}", n, c);
+    shmstats_add(sec, SHM_COUNTER, ctx->total_sw_drop_pkts, "nba_thread_sw_drop_packets{node=\"%u\",core=\"%u\"}", n, c);
+    shmstats_add(sec, SHM_COUNTER, ctx->total_tx_drop_pkts, "nba_thread_tx_drop_packets{node=\"%u\",core=\"%u\"}", n, c);
+    shmstats_add(sec, SHM_GAUGE, ctx->idle_polls, "nba_thread_idle_polls{node=\"%u\",core=\"%u\"}", n, c);
+    if (ctx->role != IO_ROLE_RXTX) {
+        SystemInspector *insp = ctx->comp_ctx->inspector;
+        shmstats_add(sec, SHM_COUNTER, insp->tx_batch_count, "nba_comp_tx_batches{node=\"%u\",core=\"%u\"}", n, c);
+        shmstats_add(sec, SHM_COUNTER, insp->tx_pkt_count, "nba_comp_tx_packets{node=\"%u\",core=\"%u\"}", n, c);
+        shmstats_add(sec, SHM_COUNTER, insp->drop_pkt_count, "nba_comp_drop_packets{node=\"%u\",core=\"%u\"}", n, c);
+        for (unsigned d = 0; d < NBA_MAX_COPROCESSOR_TYPES; d++) {
+            if (insp->dev_sent_batch_count[d] == 0)
+                continue;
+            shmstats_add(sec, SHM_COUNTER, insp->dev_sent_batch_count[d],
+                         "nba_offload_sent_batches{node=\"%u\",core=\"%u\",dev=\"%u\"}", n, c, d);
+            shmstats_add(sec, SHM_COUNTER, insp->dev_finished_batch_count[d],
+                         "nba_offload_finished_batches{node=\"%u\",core=\"%u\",dev=\"%u\"}", n, c, d);
+            shmstats_add(sec, SHM_COUNTER, insp->dev_finished_task_count[d],
+                         "nba_offload_finished_tasks{node=\"%u\",core=\"%u\",dev=\"%u\"}", n, c, d);
+            shmstats_add(sec, SHM_GAUGE, (uint64_t) (insp->avg_task_completion_sec[d] * 1e9),
+                         "nba_offload_task_avg_ns{node=\"%u\",core=\"%u\",dev=\"%u\"}", n, c, d);
+        }
+        /* The inputs of the load balancers. */
+        shmstats_add(sec, SHM_GAUGE, (uint64_t) insp->pkt_proc_cycles[0],
+                     "nba_lb_pkt_proc_cycles{node=\"%u\",core=\"%u\",proc=\"cpu\"}", n, c);
+        for (unsigned d = 0; d < NBA_MAX_COPROCESSOR_TYPES; d++) {
+            if (insp->dev_sent_batch_count[d] == 0)
+                continue;
+            shmstats_add(sec, SHM_GAUGE, (uint64_t) insp->pkt_proc_cycles[d + 1],
+                         "nba_lb_pkt_proc_cycles{node=\"%u\",core=\"%u\",proc=\"dev%u\"}", n, c, d);
+        }
+        shmstats_add(sec, SHM_GAUGE, insp->batch_proc_time,
+                     "nba_lb_batch_proc_cycles{node=\"%u\",core=\"%u\"}", n, c);
+    }
+    if (ctx->perf != nullptr) {
+        static const char *const stage_names[IO_PERF_NUM_STAGES] = {"rx", "comp", "tx"};
+        for (unsigned s = 0; s < IO_PERF_NUM_STAGES; s++)
+            for (unsigned e = 0; e < ctx->perf->size(); e++)
+                shmstats_add(sec, SHM_COUNTER, ctx->perf_counts[s][e],
+                             "nba_thread_perf_events{node=\"%u\",core=\"%u\",stage=\"%s\",event=\"%s\"}",
+                             n, c, stage_names[s], ctx->perf->event_name(e));
+    }
+    shmstats_commit(sec);
+}/*}}}*/
+
 static void io_local_stat_timer_cb(struct ev_loop *loop, struct ev_timer *watcher, int revents)/*{{{*/
 {
     io_thread_context *ctx = (io_thread_context *) ev_userdata(loop);
@@ -330,19 +614,59 @@ static void io_local_stat_timer_cb(struct ev_loop *loop, struct ev_timer *watche
         rte_atomic64_add(&ctx->node_stat->port_stats[j].num_recv_bytes, ctx->port_stats[j].num_recv_bytes);
         rte_atomic64_add(&ctx->node_stat->port_stats[j].num_sent_bytes, ctx->port_stats[j].num_sent_bytes);
         ctx->tx_pkt_thruput += ctx->port_stats[j].num_sent_pkts;
+        ctx->total_recv_pkts += ctx->port_stats[j].num_recv_pkts;
+        ctx->total_sent_pkts += ctx->port_stats[j].num_sent_pkts;
+        ctx->total_sw_drop_pkts += ctx->port_stats[j].num_sw_drop_pkts;
+        ctx->total_tx_drop_pkts += ctx->port_stats[j].num_tx_drop_pkts;
         memzero(&ctx->port_stats[j], 1);
     }
- #ifdef NBA_CPU_MICROBENCH
-    char buf[2048];
-    char *bufp = &buf[0];
-    for (int e = 0; e < 5; e++) {
-        bufp += sprintf(bufp, "[worker:%02u].%d %'12lld, %'12lld, %'12lld\n", ctx->loc.core_id, e, ctx->papi_ctr_rx[e], ctx->papi_ctr_tx[e], ctx->papi_ctr_comp[e]);
+    if (ctx->rss_rebalance) {
+        /* Attribute the busy cycles to each RX queue by its share of packets. */
+        uint64_t total_pkts = 0;
+        for (unsigned i = 0; i < ctx->num_hw_rx_queues; i++)
+            total_pkts += ctx->rx_hwring_pkts[i];
+        for (unsigned i = 0; i < ctx->num_hw_rx_queues; i++) {
+            struct io_rss_port_state *rss = &ctx->node_stat->rss[ctx->rx_hwrings[i].ifindex];
+            unsigned rxq = ctx->rx_hwrings[i].qidx;
+            uint64_t pkts = ctx->rx_hwring_pkts[i];
+            uint64_t cycles = (total_pkts == 0) ? 0
+                              : (uint64_t) ((double) ctx->busy_cycles * pkts / total_pkts);
+            rte_atomic64_add(&rss->rxq_pkts[rxq], pkts);
+            rte_atomic64_add(&rss->rxq_busy_cycles[rxq], cycles);
+            ctx->rx_hwring_pkts[i] = 0;
+        }
+        rte_atomic64_add(&ctx->node_stat->thread_busy_cycles[ctx->loc.local_thread_idx],
+                         ctx->busy_cycles);
+        ctx->busy_cycles = 0;
+        for (unsigned j = 0; j < ctx->node_stat->num_ports; j++) {
+            struct io_rss_port_state *rss = &ctx->node_stat->rss[j];
+            uint32_t *bucket_pkts = &ctx->rss_bucket_pkts[j * NBA_MAX_RSS_RETA_SIZE];
+            if (rss->reta_size == 0)
+                continue;
+            for (unsigned b = 0; b < NBA_MAX_RSS_RETA_SIZE; b++) {
+                if (bucket_pkts[b] > 0)
+                    rte_atomic64_add(&rss->bucket_pkts[b], bucket_pkts[b]);
+            }
+        }
+        memset(ctx->rss_bucket_pkts, 0, sizeof(uint32_t) * NBA_MAX_RSS_RETA_SIZE * ctx->node_stat->num_ports);
     }
-    printf("%s", buf);
-    memset(ctx->papi_ctr_rx, 0, sizeof(long long) * 5);
-    memset(ctx->papi_ctr_tx, 0, sizeof(long long) * 5);
-    memset(ctx->papi_ctr_comp, 0, sizeof(long long) * 5);
-#endif
+    if (ctx->node_stat->elem_stat_sample != 0 && ctx->role != IO_ROLE_RXTX)
+        ctx->comp_ctx->elem_graph->export_stats(ctx->node_stat);
+    if (ctx->role != IO_ROLE_RXTX) {
+        SystemInspector *insp = ctx->comp_ctx->inspector;
+        rte_spinlock_lock(&ctx->node_stat->latency_lock);
+        ctx->node_stat->pkt_latency_hist.merge(insp->pkt_latency_hist);
+        ctx->node_stat->task_latency_hist.merge(insp->task_latency_hist);
+        ctx->node_stat->queue_delay_hist.merge(insp->queue_delay_hist);
+        rte_spinlock_unlock(&ctx->node_stat->latency_lock);
+        insp->pkt_latency_hist.reset();
+        insp->task_latency_hist.reset();
+        insp->queue_delay_hist.reset();
+    }
+    if (ctx->perf != nullptr)
+        io_perf_print(ctx);
+    if (ctx->shm_section != nullptr)
+        io_export_thread_stats(ctx);
     /* Inform the master to check updates. */
     rte_atomic16_inc(ctx->node_master_flag);
     ev_async_send(ctx->node_master_ctx->loop, ctx->node_stat_watcher);
@@ -350,6 +674,238 @@ static void io_local_stat_timer_cb(struct ev_loop *loop, struct ev_timer *watche
     ev_timer_again(loop, watcher);
 }/*}}}*/
 
+static void io_rss_rebalance(struct io_node_stat *node_stat, unsigned port_idx,
+                             const uint64_t *thread_cycles)/*{{{*/
+{
+    struct io_rss_port_state *rss = &node_stat->rss[port_idx];
+    uint64_t rxq_pkts[NBA_MAX_QUEUES_PER_PORT];
+    uint64_t rxq_cycles[NBA_MAX_QUEUES_PER_PORT];
+    uint64_t bucket_pkts[NBA_MAX_RSS_RETA_SIZE];
+    unsigned q, b;
+
+    /* Take the samples of the last period.  The IO threads may add
+     * concurrently, so we subtract what we have read instead of resetting. */
+    for (q = 0; q < NBA_MAX_QUEUES_PER_PORT; q++) {
+        if (!rss->rxq_polled[q])
+            continue;
+        rxq_pkts[q] = rte_atomic64_read(&rss->rxq_pkts[q]);
+        rxq_cycles[q] = rte_atomic64_read(&rss->rxq_busy_cycles[q]);
+        rte_atomic64_sub(&rss->rxq_pkts[q], rxq_pkts[q]);
+        rte_atomic64_sub(&rss->rxq_busy_cycles[q], rxq_cycles[q]);
+    }
+    memset(bucket_pkts, 0, sizeof(bucket_pkts));
+    for (b = 0; b < NBA_MAX_RSS_RETA_SIZE; b++) {
+        uint64_t cnt = rte_atomic64_read(&rss->bucket_pkts[b]);
+        rte_atomic64_sub(&rss->bucket_pkts[b], cnt);
+        /* The NIC uses the LSBs of the hash to index the RETA. */
+        bucket_pkts[b & (rss->reta_size - 1)] += cnt;
+    }
+
+    /* Let the last update take effect before judging again. */
+    if (rss->holdoff > 0) {
+        rss->holdoff --;
+        return;
+    }
+
+    /* An IO thread may poll several queues, so we move load from the
+     * busiest thread's hottest queue to the least busy thread's coldest
+     * queue, judging by the threads' busy cycles. */
+    int hot = -1, cold = -1;
+    for (q = 0; q < NBA_MAX_QUEUES_PER_PORT; q++) {
+        if (!rss->rxq_polled[q])
+            continue;
+        uint64_t t = thread_cycles[rss->rxq_owner[q]];
+        if (hot == -1 || t > thread_cycles[rss->rxq_owner[hot]]
+            || (t == thread_cycles[rss->rxq_owner[hot]] && rxq_cycles[q] > rxq_cycles[hot]))
+            hot = q;
+        if (cold == -1 || t < thread_cycles[rss->rxq_owner[cold]]
+            || (t == thread_cycles[rss->rxq_owner[cold]] && rxq_cycles[q] < rxq_cycles[cold]))
+            cold = q;
+    }
+    if (hot == -1 || rss->rxq_owner[hot] == rss->rxq_owner[cold] || rxq_pkts[hot] == 0)
+        return;
+    uint64_t hot_thread_cycles = thread_cycles[rss->rxq_owner[hot]];
+    uint64_t cold_thread_cycles = thread_cycles[rss->rxq_owner[cold]];
+    /* Ignore small imbalances so that the table does not flap. */
+    if (hot_thread_cycles * 100 <= cold_thread_cycles * (100 + node_stat->rss_threshold))
+        return;
+
+    /* Move the buckets of the hot queue, largest first, until about half
+     * of the gap is closed.  A bucket larger than the remaining gap is
+     * skipped since moving it would just swap the hot and cold threads. */
+    double cycles_per_pkt = (double) rxq_cycles[hot] / rxq_pkts[hot];
+    double gap = (double) (hot_thread_cycles - cold_thread_cycles) / 2;
+    uint16_t candidates[NBA_MAX_RSS_RETA_SIZE];
+    unsigned num_candidates = 0, num_moved = 0;
+    for (b = 0; b < rss->reta_size; b++) {
+        if (rss->reta[b] == (uint16_t) hot && bucket_pkts[b] > 0)
+            candidates[num_candidates ++] = b;
+    }
+    std::sort(&candidates[0], &candidates[num_candidates], [&bucket_pkts](uint16_t x, uint16_t y) {
+        return bucket_pkts[x] > bucket_pkts[y];
+    });
+    struct rte_eth_rss_reta_entry64 reta_conf[NBA_MAX_RSS_RETA_SIZE / RTE_ETH_RETA_GROUP_SIZE];
+    memzero(reta_conf, NBA_MAX_RSS_RETA_SIZE / RTE_ETH_RETA_GROUP_SIZE);
+    for (unsigned k = 0; k < num_candidates; k++) {
+        unsigned idx = candidates[k];
+        double load = bucket_pkts[idx] * cycles_per_pkt;
+        if (load > gap)
+            continue;
+        reta_conf[idx / RTE_ETH_RETA_GROUP_SIZE].mask |= (1ull << (idx % RTE_ETH_RETA_GROUP_SIZE));
+        reta_conf[idx / RTE_ETH_RETA_GROUP_SIZE].reta[idx % RTE_ETH_RETA_GROUP_SIZE] = (uint16_t) cold;
+        gap -= load;
+        num_moved ++;
+    }
+    if (num_moved == 0)
+        return;
+
+    int ret = rte_eth_dev_rss_reta_update((uint8_t) port_idx, reta_conf, rss->reta_size);
+    if (ret != 0) {
+        RTE_LOG(WARNING, IO, "port %u: RETA update failed (%d), disabling RSS rebalancing.\n", port_idx, ret);
+        rss->reta_size = 0;
+        return;
+    }
+    for (b = 0; b < rss->reta_size; b++) {
+        if (reta_conf[b / RTE_ETH_RETA_GROUP_SIZE].mask & (1ull << (b % RTE_ETH_RETA_GROUP_SIZE)))
+            rss->reta[b] = (uint16_t) cold;
+    }
+    rss->holdoff = node_stat->rss_holdoff;
+    RTE_LOG(INFO, IO, "port %u: moved %u of %u RSS buckets from rxq %d (thread %u) to rxq %d (thread %u) "
+                      "(%'lu vs. %'lu busy cycles)\n",
+            port_idx, num_moved, num_candidates, hot, rss->rxq_owner[hot], cold, rss->rxq_owner[cold],
+            hot_thread_cycles, cold_thread_cycles);
+}/*}}}*/
+
+static void io_print_elem_stats(struct io_node_stat *node_stat)/*{{{*/
+{
+    /* The comp threads may add concurrently, so we subtract what we have
+     * read instead of resetting.  The cumulative totals are kept for
+     * the shared memory export. */
+    for (unsigned e = 0; e < node_stat->num_elems; e++) {
+        struct io_elem_stat_atomic *es = &node_stat->elem_stats[e];
+        uint64_t batches = rte_atomic64_read(&es->num_batches);
+        uint64_t pkts_in = rte_atomic64_read(&es->num_pkts_in);
+        uint64_t drops = rte_atomic64_read(&es->num_drops);
+        uint64_t sampled_pkts = rte_atomic64_read(&es->num_sampled_pkts);
+        uint64_t sampled_cycles = rte_atomic64_read(&es->num_sampled_cycles);
+        uint64_t branch_hits = rte_atomic64_read(&es->num_branch_hits);
+        uint64_t branch_misses = rte_atomic64_read(&es->num_branch_misses);
+        uint64_t branch_predicted = rte_atomic64_read(&es->num_branch_predicted);
+        uint64_t branch_copied = rte_atomic64_read(&es->num_branch_copied);
+        rte_atomic64_sub(&es->num_batches, batches);
+        rte_atomic64_sub(&es->num_pkts_in, pkts_in);
+        rte_atomic64_sub(&es->num_drops, drops);
+        rte_atomic64_sub(&es->num_sampled_pkts, sampled_pkts);
+        rte_atomic64_sub(&es->num_sampled_cycles, sampled_cycles);
+        rte_atomic64_sub(&es->num_branch_hits, branch_hits);
+        rte_atomic64_sub(&es->num_branch_misses, branch_misses);
+        rte_atomic64_sub(&es->num_branch_predicted, branch_predicted);
+        rte_atomic64_sub(&es->num_branch_copied, branch_copied);
+        struct io_elem_stat *et = &node_stat->elem_totals[e];
+        et->num_batches += batches;
+        et->num_pkts_in += pkts_in;
+        et->num_drops += drops;
+        et->num_sampled_pkts += sampled_pkts;
+        et->num_sampled_cycles += sampled_cycles;
+        et->num_branch_hits += branch_hits;
+        et->num_branch_misses += branch_misses;
+        et->num_branch_predicted += branch_predicted;
+        et->num_branch_copied += branch_copied;
+        if (batches == 0)
+            continue;
+        printf("elem[%u:%2u]: %-24s %'10lu batches %'12lu in %'12lu out %'12lu drops | %7.1f cycles/pkt\n",
+               node_stat->node_id, e, node_stat->elem_names[e],
+               batches, pkts_in, pkts_in - RTE_MIN(drops, pkts_in), drops,
+               (sampled_pkts == 0) ? 0.0 : (double) sampled_cycles / sampled_pkts);
+    }
+}/*}}}*/
+
+struct io_latency_summary {
+    uint64_t count;
+    uint64_t p50, p99, p999, max;   /* in TSC cycles */
+};
+
+/* Takes the percentiles of the histogram and resets it. */
+static void io_take_latency(LogHistogram<> &hist, struct io_latency_summary *s)/*{{{*/
+{
+    s->count = hist.count();
+    s->p50 = hist.percentile(50);
+    s->p99 = hist.percentile(99);
+    s->p999 = hist.percentile(99.9);
+    s->max = hist.max();
+    hist.reset();
+}/*}}}*/
+
+static void io_print_latency(unsigned node_id, const char *name, const struct io_latency_summary *s)/*{{{*/
+{
+    if (s->count == 0)
+        return;
+    double cycles_per_usec = (double) rte_get_tsc_hz() / 1e6;
+    printf("latency[%u]: %-8s %'12lu samples | p50 %9.1f p99 %9.1f p99.9 %9.1f max %9.1f usec\n",
+           node_id, name, s->count,
+           s->p50 / cycles_per_usec, s->p99 / cycles_per_usec,
+           s->p999 / cycles_per_usec, s->max / cycles_per_usec);
+}/*}}}*/
+
+static void io_export_node_stats(struct io_node_stat *node_stat, const struct io_thread_stat *total,
+                                 const struct io_latency_summary *lats, const char *const *lat_names,
+                                 unsigned num_lats)/*{{{*/
+{
+    struct shm_section *sec = node_stat->shm_section;
+    const unsigned n = node_stat->node_id;
+    shmstats_begin(sec);
+    for (unsigned j = 0; j < node_stat->num_ports; j++) {
+        const struct io_port_stat *ps = &total->port_stats[j];
+        shmstats_add(sec, SHM_COUNTER, ps->num_recv_pkts, "nba_port_rx_packets{node=\"%u\",port=\"%u\"}", n, j);
+        shmstats_add(sec, SHM_COUNTER, ps->num_recv_bytes, "nba_port_rx_bytes{node=\"%u\",port=\"%u\"}", n, j);
+        shmstats_add(sec, SHM_COUNTER, ps->num_sent_pkts, "nba_port_tx_packets{node=\"%u\",port=\"%u\"}", n, j);
+        shmstats_add(sec, SHM_COUNTER, ps->num_sent_bytes, "nba_port_tx_bytes{node=\"%u\",port=\"%u\"}", n, j);
+        shmstats_add(sec, SHM_COUNTER, ps->num_invalid_pkts, "nba_port_invalid_packets{node=\"%u\",port=\"%u\"}", n, j);
+        shmstats_add(sec, SHM_COUNTER, ps->num_sw_drop_pkts, "nba_port_sw_drop_packets{node=\"%u\",port=\"%u\"}", n, j);
+        shmstats_add(sec, SHM_COUNTER, ps->num_rx_drop_pkts, "nba_port_rx_drop_packets{node=\"%u\",port=\"%u\"}", n, j);
+        shmstats_add(sec, SHM_COUNTER, ps->num_tx_drop_pkts, "nba_port_tx_drop_packets{node=\"%u\",port=\"%u\"}", n, j);
+    }
+    for (unsigned e = 0; e < node_stat->num_elems; e++) {
+        const struct io_elem_stat *es = &node_stat->elem_totals[e];
+        const char *name = node_stat->elem_names[e];
+        shmstats_add(sec, SHM_COUNTER, es->num_batches,
+                     "nba_element_batches{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        shmstats_add(sec, SHM_COUNTER, es->num_pkts_in,
+                     "nba_element_packets{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        shmstats_add(sec, SHM_COUNTER, es->num_drops,
+                     "nba_element_drops{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        shmstats_add(sec, SHM_COUNTER, es->num_sampled_pkts,
+                     "nba_element_sampled_packets{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        shmstats_add(sec, SHM_COUNTER, es->num_sampled_cycles,
+                     "nba_element_sampled_cycles{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        if (es->num_branch_predicted + es->num_branch_copied == 0)
+            continue;
+        shmstats_add(sec, SHM_COUNTER, es->num_branch_hits,
+                     "nba_element_branch_hits{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        shmstats_add(sec, SHM_COUNTER, es->num_branch_misses,
+                     "nba_element_branch_misses{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        shmstats_add(sec, SHM_COUNTER, es->num_branch_predicted,
+                     "nba_element_branch_predicted_batches{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+        shmstats_add(sec, SHM_COUNTER, es->num_branch_copied,
+                     "nba_element_branch_copied_batches{node=\"%u\",idx=\"%u\",element=\"%s\"}", n, e, name);
+    }
+    /* Percentiles of the last stat period. */
+    const double ns_per_cycle = 1e9 / rte_get_tsc_hz();
+    for (unsigned k = 0; k < num_lats; k++) {
+        const struct io_latency_summary *s = &lats[k];
+        shmstats_add(sec, SHM_GAUGE, s->count, "nba_latency_samples{node=\"%u\",kind=\"%s\"}", n, lat_names[k]);
+        shmstats_add(sec, SHM_GAUGE, (uint64_t) (s->p50 * ns_per_cycle),
+                     "nba_latency_p50_ns{node=\"%u\",kind=\"%s\"}", n, lat_names[k]);
+        shmstats_add(sec, SHM_GAUGE, (uint64_t) (s->p99 * ns_per_cycle),
+                     "nba_latency_p99_ns{node=\"%u\",kind=\"%s\"}", n, lat_names[k]);
+        shmstats_add(sec, SHM_GAUGE, (uint64_t) (s->p999 * ns_per_cycle),
+                     "nba_latency_p999_ns{node=\"%u\",kind=\"%s\"}", n, lat_names[k]);
+        shmstats_add(sec, SHM_GAUGE, (uint64_t) (s->max * ns_per_cycle),
+                     "nba_latency_max_ns{node=\"%u\",kind=\"%s\"}", n, lat_names[k]);
+    }
+    shmstats_commit(sec);
+}/*}}}*/
+
 static void io_node_stat_cb(struct ev_loop *loop, struct ev_async *watcher, int revents)/*{{{*/
 {
     io_thread_context *ctx = (io_thread_context *) ev_userdata(loop);
@@ -401,6 +957,30 @@ static void io_node_stat_cb(struct ev_loop *loop, struct ev_async *watcher, int
             total_thruput_gbps += port_thruput_gbps;
         }
         printf("Total forwarded pkts: %.2f Mpps, %.2f Gbps in node %d\n", total_thruput_mpps, total_thruput_gbps, node_stat->node_id);
+        if (node_stat->elem_stat_sample != 0)
+            io_print_elem_stats(node_stat);
+        static const char *const lat_names[3] = {"rx-tx", "offload", "queueing"};
+        struct io_latency_summary lats[3];
+        rte_spinlock_lock(&node_stat->latency_lock);
+        io_take_latency(node_stat->pkt_latency_hist, &lats[0]);
+        io_take_latency(node_stat->task_latency_hist, &lats[1]);
+        io_take_latency(node_stat->queue_delay_hist, &lats[2]);
+        rte_spinlock_unlock(&node_stat->latency_lock);
+        for (unsigned k = 0; k < 3; k++)
+            io_print_latency(node_stat->node_id, lat_names[k], &lats[k]);
+        if (node_stat->shm_section != nullptr)
+            io_export_node_stats(node_stat, &total, lats, lat_names, 3);
+        if (node_stat->rss_rebalance) {
+            /* Take the per-thread samples of the last period once for all ports. */
+            uint64_t thread_cycles[NBA_MAX_CORES];
+            for (unsigned t = 0; t < node_stat->num_threads; t++) {
+                thread_cycles[t] = rte_atomic64_read(&node_stat->thread_busy_cycles[t]);
+                rte_atomic64_sub(&node_stat->thread_busy_cycles[t], thread_cycles[t]);
+            }
+            for (j = 0; j < node_stat->num_ports; j++)
+                if (node_stat->rss[j].reta_size > 0)
+                    io_rss_rebalance(node_stat, j, thread_cycles);
+        }
         rte_memcpy(last_total, &total, sizeof(total));
         node_stat->last_time = get_usec();
         fflush(stdout);
@@ -414,170 +994,292 @@ static void io_terminate_cb(struct ev_loop *loop, struct ev_async *watcher, int
     ev_break(loop, EVBREAK_ALL);
 }
 
+/**
+ * Transmits all packets in the TX buffer of the given port.
+ * Returns the number of rte_eth_tx_burst() calls.
+ */
+static unsigned io_tx_flush_port(struct io_thread_context *ctx, unsigned o)
+{
+    struct io_tx_buffer *txbuf = &ctx->tx_buffers[o];
+    struct rte_mbuf **pkts = txbuf->pkts;
+    unsigned count = txbuf->count;
+    unsigned tx_tries = 0;
+    txbuf->count = 0;
+    ctx->tx_pending_ports &= ~(1u << o);
+
+    /* Sum TX packet bytes. */
+    for(unsigned k = 0; k < count; k++) {
+        struct rte_mbuf* cur_pkt = pkts[k];
+        unsigned len = rte_pktmbuf_pkt_len(cur_pkt) + 24;  /* Add Ethernet overheads */
+        ctx->port_stats[o].num_sent_bytes += len;
+    }
+
+    /* Software fallback for checksum offload requests. */
+    if (ctx->comp_ctx->hw_csum_offload && !(ctx->tx_csum_ports & (1u << o))) {
+        for (unsigned k = 0; k < count; k++) {
+            struct rte_mbuf *m = pkts[k];
+            if (m->ol_flags & PKT_TX_IP_CKSUM) {
+                struct ipv4_hdr *iph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, m->l2_len);
+                iph->hdr_checksum = 0;
+                iph->hdr_checksum = ip_fast_csum(iph, iph->version_ihl & 0x0f);
+                m->ol_flags &= ~(PKT_TX_IPV4 | PKT_TX_IP_CKSUM);
+            }
+        }
+    }
+
+#if NBA_OQ
+    /* To implement output-queuing, we need to drop when the TX NIC
+     * is congested.  This would not happen in high line rates such
+     * as 10 GbE because processing speed becomes the bottleneck,
+     * but it will be meaningful when we use low-speed NICs such as
+     * 1 GbE cards. */
+    unsigned txq = ctx->loc.global_thread_idx;
+    unsigned sent_cnt = rte_eth_tx_burst((uint8_t) o, txq, pkts, count);
+    for (unsigned k = sent_cnt; k < count; k++) {
+        struct rte_mbuf* cur_pkt = pkts[k];
+        unsigned len = rte_pktmbuf_pkt_len(cur_pkt) + 24;
+        ctx->port_stats[o].num_sent_bytes -= len;
+        rte_pktmbuf_free(pkts[k]);
+    }
+    ctx->port_stats[o].num_sent_pkts += sent_cnt;
+    ctx->port_stats[o].num_tx_drop_pkts += (count - sent_cnt);
+    ctx->global_tx_cnt += sent_cnt;
+    tx_tries ++;
+#else
+    /* Try to send all packets with retries. */
+    unsigned total_sent_cnt = 0;
+    do {
+        unsigned txq = ctx->loc.global_thread_idx;
+        unsigned sent_cnt = rte_eth_tx_burst((uint8_t) o, txq, &pkts[total_sent_cnt], count);
+        count -= sent_cnt;
+        total_sent_cnt += sent_cnt;
+        tx_tries ++;
+    } while (count > 0);
+    ctx->port_stats[o].num_sent_pkts += total_sent_cnt;
+    ctx->global_tx_cnt += total_sent_cnt;
+#endif
+    return tx_tries;
+}
+
+/* Appends a packet to the TX buffer of port o. */
+static inline unsigned io_tx_append(struct io_thread_context *ctx, struct rte_mbuf *m,
+                                    unsigned o, uint64_t now)
+{
+    struct io_tx_buffer *txbuf = &ctx->tx_buffers[o];
+    if (txbuf->count == 0) {
+        txbuf->deadline = now + ctx->tx_flush_cycles;
+        ctx->tx_pending_ports |= (1u << o);
+    }
+    txbuf->pkts[txbuf->count ++] = m;
+    if (txbuf->count >= ctx->num_txbuf_size)
+        return io_tx_flush_port(ctx, o);
+    return 0;
+}
+
+/**
+ * Flushes the TX buffers whose deadline has passed, or all non-empty
+ * ones if force is set.  Called from the io loop on every iteration.
+ */
+void io_tx_flush(struct io_thread_context *ctx, bool force)
+{
+    if (ctx->tx_pending_ports == 0)
+        return;
+    uint64_t perf_begin[NBA_PERF_MAX_EVENTS];
+    io_perf_read(ctx, perf_begin);
+    uint64_t now = rdtscp();
+    uint32_t pending = ctx->tx_pending_ports;
+    while (pending != 0) {
+        unsigned o = __builtin_ctz(pending);
+        pending &= pending - 1;
+        if (force || now >= ctx->tx_buffers[o].deadline)
+            io_tx_flush_port(ctx, o);
+    }
+    io_perf_add(ctx, IO_PERF_TX, perf_begin);
+}
+
+/**
+ * Frees the buffered dropped packets.  Consecutive single-segment mbufs
+ * from the same mempool are returned with a single bulk put instead of
+ * per-packet rte_pktmbuf_free() calls.
+ */
+void io_drop_flush(struct io_thread_context *ctx)
+{
+    struct io_drop_buffer *db = &ctx->drop_buffer;
+    struct rte_mempool *pool = nullptr;
+    void *objs[NBA_DROP_BUFFER_SIZE];
+    unsigned n = 0;
+    for (unsigned i = 0; i < db->count; i++) {
+        struct rte_mbuf *m = db->pkts[i];
+        if (unlikely(m->nb_segs > 1)) {
+            rte_pktmbuf_free(m);
+            continue;
+        }
+        /* Skip the mbufs still referenced by others. */
+        m = __rte_pktmbuf_prefree_seg(m);
+        if (m == nullptr)
+            continue;
+        if (m->pool != pool) {
+            if (n > 0)
+                rte_mempool_put_bulk(pool, objs, n);
+            pool = m->pool;
+            n = 0;
+        }
+        objs[n ++] = m;
+    }
+    if (n > 0)
+        rte_mempool_put_bulk(pool, objs, n);
+    db->count = 0;
+}
+
 /**
  * The TXCommonComponent implementation.
  * This function is directly called from the computation thread.
+ *
+ * Packets are appended to per-port TX buffers shared across batches,
+ * which are flushed when they reach num_txbuf_size packets or by
+ * io_tx_flush() after tx_flush_cycles since their first packet.
+ * This avoids many tiny TX bursts when a batch is spread over many ports.
  */
 void io_tx_batch(struct io_thread_context *ctx, PacketBatch *batch)
 {
-    struct rte_mbuf *out_batches[NBA_MAX_PORTS][NBA_MAX_COMP_BATCH_SIZE];
-    unsigned out_batches_cnt[NBA_MAX_PORTS];
-    memzero(out_batches_cnt, NBA_MAX_PORTS);
+    uint64_t perf_begin[NBA_PERF_MAX_EVENTS];
+    io_perf_read(ctx, perf_begin);
     uint64_t t = rdtscp();
     int64_t proc_id = anno_get(&batch->banno, NBA_BANNO_LB_DECISION) + 1; // adjust range to be positive
+    trace_record(TRACE_TX, batch->count, (uintptr_t) batch);
     ctx->comp_ctx->inspector->update_batch_proc_time(t - batch->recv_timestamp);
     ctx->comp_ctx->inspector->update_pkt_proc_cycles(batch->compute_time, proc_id);
-//#ifdef NBA_CPU_MICROBENCH
-//    PAPI_start(ctx->papi_evset_tx);
-//#endif
 
     // TODO: keep ordering of packets (or batches)
-    //   NOTE: current implementation: no extra queueing,
-    //   just transmit as requested
+    unsigned tx_tries = 0, num_tx_pkts = 0;
+    #if NBA_BATCH_SOA_META
+    const struct batch_meta &meta = batch->load_meta();
+    #endif
+    /* A split comp thread hands the packets to its IO thread. */
+    struct io_split_bundle *bundle = nullptr;
+    if (ctx->role == IO_ROLE_COMP) {
+        while (rte_mempool_get(ctx->split_bundle_pool, (void **) &bundle) != 0) {
+            if (unlikely(ctx->loop_broken)) {
+                FOR_EACH_PACKET(batch) {
+                    rte_pktmbuf_free(batch->packets[pkt_idx]);
+                } END_FOR;
+                return;
+            }
+            ev_run(ctx->loop, EVRUN_NOWAIT);
+        }
+        bundle->count = 0;
+    }
     FOR_EACH_PACKET(batch) {
-        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
         struct ether_hdr *ethh = rte_pktmbuf_mtod(batch->packets[pkt_idx], struct ether_hdr *);
+        #if NBA_BATCH_SOA_META
+        uint64_t o = meta.iface_out[pkt_idx];
+        #else
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
         uint64_t o = anno_get(&pkt->anno, NBA_ANNO_IFACE_OUT);
+        #endif
 
         /* Update source/dest MAC addresses. */
         ether_addr_copy(&ethh->s_addr, &ethh->d_addr);
         ether_addr_copy(&ctx->tx_ports[o].addr, &ethh->s_addr);
 
-        /* Append to the corresponding output batch. */
-        int cnt = out_batches_cnt[o] ++;
-        out_batches[o][cnt] = batch->packets[pkt_idx];
+        if (bundle != nullptr) {
+            bundle->out_ports[bundle->count] = (uint16_t) o;
+            bundle->pkts[bundle->count ++] = batch->packets[pkt_idx];
+        } else {
+            /* Append to the corresponding TX buffer. */
+            tx_tries += io_tx_append(ctx, batch->packets[pkt_idx], o, t);
+        }
+        num_tx_pkts ++;
     } END_FOR;
-
-    unsigned tx_tries = 0;
-    for (unsigned o = 0; o < ctx->num_tx_ports; o++) {
-        if (out_batches_cnt[o] == 0)
-            continue;
-        struct rte_mbuf **pkts = out_batches[o];
-        unsigned count = out_batches_cnt[o];
-        uint64_t total_sent_byte = 0;
-
-        /* Sum TX packet bytes. */
-        for(unsigned k = 0; k < count; k++) {
-            struct rte_mbuf* cur_pkt = out_batches[o][k];
-            unsigned len = rte_pktmbuf_pkt_len(cur_pkt) + 24;  /* Add Ethernet overheads */
-            ctx->port_stats[o].num_sent_bytes += len;
+    ctx->comp_ctx->inspector->pkt_latency_hist.record(t - batch->recv_timestamp, num_tx_pkts);
+    if (bundle != nullptr) {
+        /* Backpressure: wait until the IO thread catches up. */
+        while (rte_ring_sp_enqueue(ctx->split_tx_ring, bundle) == -ENOBUFS) {
+            if (unlikely(ctx->loop_broken)) {
+                for (unsigned k = 0; k < bundle->count; k++)
+                    rte_pktmbuf_free(bundle->pkts[k]);
+                rte_mempool_put(ctx->split_bundle_pool, bundle);
+                return;
+            }
+            ev_run(ctx->loop, EVRUN_NOWAIT);
         }
-
-#if NBA_OQ
-        /* To implement output-queuing, we need to drop when the TX NIC
-         * is congested.  This would not happen in high line rates such
-         * as 10 GbE because processing speed becomes the bottleneck,
-         * but it will be meaningful when we use low-speed NICs such as
-         * 1 GbE cards. */
-        unsigned txq = ctx->loc.global_thread_idx;
-        unsigned sent_cnt = rte_eth_tx_burst((uint8_t) o, txq, pkts, count);
-        for (unsigned k = sent_cnt; k < count; k++) {
-            struct rte_mbuf* cur_pkt = out_batches[o][k];
-            unsigned len = rte_pktmbuf_pkt_len(cur_pkt) + 24;
-            ctx->port_stats[o].num_sent_bytes -= len;
-            rte_pktmbuf_free(pkts[k]);
-        }
-        ctx->port_stats[o].num_sent_pkts += sent_cnt;
-        ctx->port_stats[o].num_tx_drop_pkts += (count - sent_cnt);
-        ctx->global_tx_cnt += sent_cnt;
-#else
-        /* Try to send all packets with retries. */
-        unsigned total_sent_cnt = 0;
-        do {
-            unsigned txq = ctx->loc.global_thread_idx;
-            unsigned sent_cnt = rte_eth_tx_burst((uint8_t) o, txq, &pkts[total_sent_cnt], count);
-            count -= sent_cnt;
-            total_sent_cnt += sent_cnt;
-            tx_tries ++;
-        } while (count > 0);
-        ctx->port_stats[o].num_sent_pkts += total_sent_cnt;
-        ctx->global_tx_cnt += total_sent_cnt;
-#endif
     }
-//#ifdef NBA_CPU_MICROBENCH
-//    {
-//        long long ctr[5];
-//        PAPI_stop(ctx->papi_evset_tx, ctr);
-//        for (int i = 0; i < 5; i++)
-//            ctx->papi_ctr_tx[i] += ctr[i];
-//    }
-//#endif
+    io_perf_add(ctx, IO_PERF_TX, perf_begin);
     print_ratelimit("# tx trials per batch", tx_tries, 10000);
 }
 
-int io_loop(void *arg)
+/* ===== IO/comp split =====
+ * An IO_ROLE_RXTX thread hands received packets to its IO_ROLE_COMP peer
+ * in bundles of up to a computation batch, and the peer sends the
+ * packets to transmit back in the same way.  Each direction uses a
+ * single-producer/single-consumer ring.  The IO thread stops polling the
+ * NIC when the comp thread lags behind, so the NIC drops the excess
+ * instead of the IO thread spending cycles on them.
+ */
+static void io_split_drop(struct io_thread_context *ctx, struct rte_mbuf **pkts, unsigned count)
 {
-    struct io_thread_context *const ctx = (struct io_thread_context *) arg;
-
-    /* Ensure we are on the right core. */
-    assert(rte_socket_id() == ctx->loc.node_id);
-    assert(rte_lcore_id() == ctx->loc.core_id);
-    RTE_LOG(DEBUG, IO, "@%u: starting to read from %u hw rx queue(s)\n",
-               ctx->loc.core_id, ctx->num_hw_rx_queues);
-    ctx->thread_id = syscall(SYS_gettid);
-
-    // the way numa index numbered for each cpu core is checked in main(). (see 'is_numa_idx_grouped' in main())
-    const unsigned num_nodes = numa_num_configured_nodes();
-    struct rte_mbuf *pkts[NBA_MAX_IO_BATCH_SIZE * NBA_MAX_QUEUES_PER_PORT];
-    struct rte_mbuf *drop_pkts[NBA_MAX_IO_BATCH_SIZE];
-    struct timespec sleep_ts;
-    unsigned i, j;
-    char temp[1024];
-    int ret;
-
-    /* Initialize random for randomized port access order. */
-    random32_func_t random32 = bind(uniform_int_distribution<uint32_t>{}, mt19937());
-
-    /* IO thread initialization */
-    assert((unsigned) numa_node_of_cpu(ctx->loc.core_id) == ctx->loc.node_id);
+    for (unsigned k = 0; k < count; k++) {
+        ctx->port_stats[pkts[k]->port].num_sw_drop_pkts ++;
+        rte_pktmbuf_free(pkts[k]);
+    }
+}
 
-    snprintf(temp, 64, "compio.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
-    prctl(PR_SET_NAME, temp, 0, 0, 0);
-    threading::bind_cpu(ctx->loc.core_id);
-    #ifdef USE_NVPROF
-    nvtxNameOsThread(pthread_self(), temp);
-    #endif
+static void io_split_publish_rx(struct io_thread_context *ctx, struct rte_mbuf **pkts, unsigned count)
+{
+    const unsigned comp_batch_size = ctx->comp_ctx->num_combatch_size;
+    for (unsigned pidx = 0; pidx < count; pidx += comp_batch_size) {
+        unsigned n = RTE_MIN(comp_batch_size, count - pidx);
+        struct io_split_bundle *bundle = nullptr;
+        if (unlikely(rte_mempool_get(ctx->split_bundle_pool, (void **) &bundle) != 0)) {
+            io_split_drop(ctx, &pkts[pidx], n);
+            continue;
+        }
+        bundle->count = n;
+        memcpy(&bundle->pkts[0], &pkts[pidx], sizeof(struct rte_mbuf *) * n);
+        if (unlikely(rte_ring_sp_enqueue(ctx->split_rx_ring, bundle) == -ENOBUFS)) {
+            io_split_drop(ctx, &pkts[pidx], n);
+            rte_mempool_put(ctx->split_bundle_pool, bundle);
+        }
+    }
+}
 
-#ifdef NBA_CPU_MICROBENCH
-    assert(PAPI_register_thread() == PAPI_OK);
-    ctx->papi_evset_rx = PAPI_NULL;
-    ctx->papi_evset_tx = PAPI_NULL;
-    ctx->papi_evset_comp = PAPI_NULL;
-    memset(ctx->papi_ctr_rx, 0, sizeof(long long) * 5);
-    memset(ctx->papi_ctr_tx, 0, sizeof(long long) * 5);
-    memset(ctx->papi_ctr_comp, 0, sizeof(long long) * 5);
-    assert(PAPI_create_eventset(&ctx->papi_evset_rx) == PAPI_OK);
-    assert(PAPI_create_eventset(&ctx->papi_evset_tx) == PAPI_OK);
-    assert(PAPI_create_eventset(&ctx->papi_evset_comp) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_rx, PAPI_TOT_CYC) == PAPI_OK);   // total cycles
-    assert(PAPI_add_event(ctx->papi_evset_rx, PAPI_TOT_INS) == PAPI_OK);   // total instructions
-    assert(PAPI_add_event(ctx->papi_evset_rx, PAPI_L2_TCM) == PAPI_OK);   // total load/store instructions
-    assert(PAPI_add_event(ctx->papi_evset_rx, PAPI_BR_CN) == PAPI_OK);    // number of conditional branches
-    assert(PAPI_add_event(ctx->papi_evset_rx, PAPI_BR_MSP) == PAPI_OK);    // number of branch misprediction
-    assert(PAPI_add_event(ctx->papi_evset_tx, PAPI_TOT_CYC) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_tx, PAPI_TOT_INS) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_tx, PAPI_L2_TCM) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_tx, PAPI_BR_CN) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_tx, PAPI_BR_MSP) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_comp, PAPI_TOT_CYC) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_comp, PAPI_TOT_INS) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_comp, PAPI_L2_TCM) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_comp, PAPI_BR_CN) == PAPI_OK);
-    assert(PAPI_add_event(ctx->papi_evset_comp, PAPI_BR_MSP) == PAPI_OK);
-#endif
+static void io_split_drain_tx(struct io_thread_context *ctx)
+{
+    struct io_split_bundle *bundles[NBA_SPLIT_RING_SIZE];
+    unsigned n = rte_ring_sc_dequeue_burst(ctx->split_tx_ring, (void **) bundles, NBA_SPLIT_RING_SIZE);
+    if (n == 0)
+        return;
+    uint64_t perf_begin[NBA_PERF_MAX_EVENTS];
+    io_perf_read(ctx, perf_begin);
+    uint64_t now = rdtscp();
+    for (unsigned b = 0; b < n; b++) {
+        for (unsigned k = 0; k < bundles[b]->count; k++)
+            io_tx_append(ctx, bundles[b]->pkts[k], bundles[b]->out_ports[k], now);
+    }
+    rte_mempool_put_bulk(ctx->split_bundle_pool, (void **) bundles, n);
+    io_perf_add(ctx, IO_PERF_TX, perf_begin);
+}
 
-    /* Read TX-port MAC addresses. */
-    for (i = 0; i < ctx->num_tx_ports; i++) {
-        ctx->tx_ports[i].port_idx = i;
-        rte_eth_macaddr_get(i, &ctx->tx_ports[i].addr);
+/* Returns the number of packets processed. */
+static unsigned io_split_consume_rx(struct io_thread_context *ctx, uint64_t loop_count)
+{
+    struct io_split_bundle *bundles[8];
+    unsigned n = rte_ring_sc_dequeue_burst(ctx->split_rx_ring, (void **) bundles, 8);
+    unsigned total = 0;
+    for (unsigned b = 0; b < n; b++) {
+        comp_process_batch(ctx, &bundles[b]->pkts[0], bundles[b]->count, loop_count);
+        total += bundles[b]->count;
     }
+    if (n > 0)
+        rte_mempool_put_bulk(ctx->split_bundle_pool, (void **) bundles, n);
+    return total;
+}
 
-    /* Initialize the event loop. */
-    ctx->loop = ev_loop_new(EVFLAG_AUTO | EVFLAG_NOSIGMASK);
-    ctx->loop_broken = false;
-    ev_set_userdata(ctx->loop, ctx);
+/* Initializes the computation context run in this thread. */
+static void io_comp_init(struct io_thread_context *ctx)
+{
+    char temp[RTE_MEMPOOL_NAMESIZE];
 
-    /* ==== COMP ====*/
     ctx->comp_ctx->loop = ctx->loop;
     snprintf(temp, RTE_MEMPOOL_NAMESIZE,
          "comp.batch.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
@@ -613,6 +1315,10 @@ int io_loop(void *arg)
     if (ctx->comp_ctx->task_pool == nullptr)
         rte_panic("RTE_ERROR while creating comp_ctx->task pool: %s\n", rte_strerror(rte_errno));
 
+    ctx->comp_ctx->batch_freelist.init(ctx->comp_ctx->batch_pool);
+    ctx->comp_ctx->dbstate_freelist.init(ctx->comp_ctx->dbstate_pool);
+    ctx->comp_ctx->task_freelist.init(ctx->comp_ctx->task_pool);
+
     ctx->comp_ctx->packet_pool = packet_create_mempool(128, ctx->loc.node_id, ctx->loc.core_id);
     assert(ctx->comp_ctx->packet_pool != nullptr);
 
@@ -630,8 +1336,146 @@ int io_loop(void *arg)
                                                                          CACHE_LINE_SIZE, ctx->loc.node_id);
     ev_check_init(ctx->comp_ctx->check_watcher, comp_prepare_cb);
     ev_check_start(ctx->loop, ctx->comp_ctx->check_watcher);
+}
 
-    /* ==== END_OF_COMP ====*/
+/* ===== IDLE ===== */
+/* Registers all RX queues of this thread to its epoll instance.
+ * On failure, the thread backs off with sleeps only. */
+static void io_idle_init(struct io_thread_context *ctx)
+{
+    ctx->idle_polls = 0;
+    ctx->rx_intr_ready = false;
+    if (ctx->idle_poll_mode < 2 || ctx->num_hw_rx_queues == 0)
+        return;
+    for (unsigned i = 0; i < ctx->num_hw_rx_queues; i++) {
+        if (!(ctx->rx_intr_ports & (1u << ctx->rx_hwrings[i].ifindex))) {
+            RTE_LOG(WARNING, IO, "@%u: port %d has no RX interrupts, falling back to idle sleeps.\n",
+                    ctx->loc.core_id, ctx->rx_hwrings[i].ifindex);
+            return;
+        }
+        int ret = rte_eth_dev_rx_intr_ctl_q((uint8_t) ctx->rx_hwrings[i].ifindex,
+                                            (uint16_t) ctx->rx_hwrings[i].qidx,
+                                            RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD,
+                                            (void *) (uintptr_t) i);
+        if (ret != 0) {
+            RTE_LOG(WARNING, IO, "@%u: cannot use RX interrupts of port %d rxq %d (%d), "
+                                 "falling back to idle sleeps.\n",
+                    ctx->loc.core_id, ctx->rx_hwrings[i].ifindex, ctx->rx_hwrings[i].qidx, ret);
+            return;
+        }
+    }
+    ctx->rx_intr_ready = true;
+}
+
+/* Returns whether packets or batches are still held by this thread,
+ * in which case it must keep polling to make progress on them. */
+static bool io_idle_has_inflight(struct io_thread_context *ctx)
+{
+    if (ctx->tx_pending_ports != 0)
+        return true;
+    if (ctx->role == IO_ROLE_RXTX)
+        return rte_mempool_count(ctx->split_bundle_pool) < ctx->split_bundle_pool->size;
+    comp_thread_context *cctx = ctx->comp_ctx;
+    return rte_mempool_count(cctx->batch_pool) + cctx->batch_freelist.count() < cctx->batch_pool->size;
+}
+
+/* Backs off after an iteration without any work: first by pausing for
+ * exponentially longer bursts, then by short sleeps, and finally by
+ * waiting for RX interrupts.  The caller resets idle_polls on work. */
+static void io_idle_backoff(struct io_thread_context *ctx, struct timespec *sleep_ts)
+{
+    unsigned n = ++ ctx->idle_polls;
+    if (n < NBA_IDLE_PAUSE_POLLS)
+        return;
+    if (n < NBA_IDLE_SLEEP_POLLS || io_idle_has_inflight(ctx)) {
+        unsigned num_pauses = 1u << RTE_MIN((n - NBA_IDLE_PAUSE_POLLS) / NBA_IDLE_PAUSE_POLLS, 6u);
+        for (unsigned k = 0; k < num_pauses; k++)
+            rte_pause();
+        return;
+    }
+    if (n < NBA_IDLE_INTR_POLLS || !ctx->rx_intr_ready) {
+        sleep_ts->tv_sec = 0;
+        sleep_ts->tv_nsec = NBA_IDLE_SLEEP_USEC * 1000;
+        nanosleep(sleep_ts, nullptr);
+        return;
+    }
+    /* A packet that arrived before enabling interrupts does not raise
+     * one, but it is picked up when the bounded wait times out. */
+    struct rte_epoll_event events[NBA_MAX_QUEUES_PER_PORT];
+    for (unsigned i = 0; i < ctx->num_hw_rx_queues; i++)
+        rte_eth_dev_rx_intr_enable((uint8_t) ctx->rx_hwrings[i].ifindex, (uint16_t) ctx->rx_hwrings[i].qidx);
+    rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, NBA_MAX_QUEUES_PER_PORT, NBA_IDLE_INTR_TIMEOUT_MS);
+    for (unsigned i = 0; i < ctx->num_hw_rx_queues; i++)
+        rte_eth_dev_rx_intr_disable((uint8_t) ctx->rx_hwrings[i].ifindex, (uint16_t) ctx->rx_hwrings[i].qidx);
+}
+/* ===== END_OF_IDLE ===== */
+
+int io_loop(void *arg)
+{
+    struct io_thread_context *const ctx = (struct io_thread_context *) arg;
+
+    /* Ensure we are on the right core. */
+    assert(rte_socket_id() == ctx->loc.node_id);
+    assert(rte_lcore_id() == ctx->loc.core_id);
+    RTE_LOG(DEBUG, IO, "@%u: starting to read from %u hw rx queue(s)\n",
+               ctx->loc.core_id, ctx->num_hw_rx_queues);
+    ctx->thread_id = syscall(SYS_gettid);
+
+    // the way numa index numbered for each cpu core is checked in main(). (see 'is_numa_idx_grouped' in main())
+    const unsigned num_nodes = numa_num_configured_nodes();
+    struct rte_mbuf *pkts[NBA_MAX_IO_BATCH_SIZE * NBA_MAX_QUEUES_PER_PORT];
+    struct timespec sleep_ts;
+    unsigned i, j;
+    char temp[1024];
+    int ret;
+
+    /* Initialize random for randomized port access order. */
+    random32_func_t random32 = bind(uniform_int_distribution<uint32_t>{}, mt19937());
+
+    /* IO thread initialization */
+    assert((unsigned) numa_node_of_cpu(ctx->loc.core_id) == ctx->loc.node_id);
+
+    snprintf(temp, 64, "compio.%u:%u@%u", ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+    prctl(PR_SET_NAME, temp, 0, 0, 0);
+    threading::bind_cpu(ctx->loc.core_id);
+    #ifdef USE_NVPROF
+    nvtxNameOsThread(pthread_self(), temp);
+    #endif
+    trace_init_thread(temp, ctx->loc.node_id);
+
+    /* Open the hardware counters for this thread. */
+    ctx->perf = nullptr;
+    memzero(ctx->perf_counts, IO_PERF_NUM_STAGES);
+    memzero(ctx->perf_reported, IO_PERF_NUM_STAGES);
+    memzero(ctx->perf_tx_nested, NBA_PERF_MAX_EVENTS);
+    if (!perf_events.empty()) {
+        ctx->perf = new PerfCounterGroup();
+        ret = ctx->perf->open(perf_events.c_str());
+        if (ret < 0) {
+            RTE_LOG(WARNING, IO, "@%u: cannot count hardware events \"%s\": %s\n",
+                    ctx->loc.core_id, perf_events.c_str(), strerror(-ret));
+            delete ctx->perf;
+            ctx->perf = nullptr;
+        } else
+            RTE_LOG(INFO, IO, "@%u: counting %d hardware events (%s)\n", ctx->loc.core_id, ret,
+                    ctx->perf->uses_rdpmc() ? "rdpmc" : "read");
+    }
+
+    /* Read TX-port MAC addresses. */
+    for (i = 0; i < ctx->num_tx_ports; i++) {
+        ctx->tx_ports[i].port_idx = i;
+        rte_eth_macaddr_get(i, &ctx->tx_ports[i].addr);
+    }
+
+    /* Initialize the event loop. */
+    ctx->loop = ev_loop_new(EVFLAG_AUTO | EVFLAG_NOSIGMASK);
+    ctx->loop_broken = false;
+    ctx->num_batch_waiters = 0;
+    ev_set_userdata(ctx->loop, ctx);
+
+    /* The comp context runs in this thread's loop unless split off. */
+    if (ctx->role != IO_ROLE_RXTX)
+        io_comp_init(ctx);
 
     /* Register the termination event. */
     ev_set_cb(ctx->terminate_watcher, io_terminate_cb);
@@ -642,6 +1486,24 @@ int io_loop(void *arg)
                                                                 sizeof(struct io_port_stat) * ctx->node_stat->num_ports,
                                                                 CACHE_LINE_SIZE, ctx->loc.node_id);
     memzero(ctx->port_stats, ctx->node_stat->num_ports);
+    ctx->busy_cycles = 0;
+    ctx->total_recv_pkts = 0;
+    ctx->total_sent_pkts = 0;
+    ctx->total_sw_drop_pkts = 0;
+    ctx->total_tx_drop_pkts = 0;
+    memzero(ctx->rx_hwring_pkts, NBA_MAX_PORTS * NBA_MAX_QUEUES_PER_PORT);
+    ctx->steal_shed_mask = 0;
+    ctx->steal_streak = 0;
+    ctx->steal_overloaded = false;
+    ctx->steal_next_queue = ctx->loc.local_thread_idx % NBA_STEAL_QUEUES;
+    io_idle_init(ctx);
+    ctx->rss_bucket_pkts = nullptr;
+    if (ctx->rss_rebalance) {
+        ctx->rss_bucket_pkts = (uint32_t *) rte_malloc_socket("io_rss_bucket_stat",
+                                                              sizeof(uint32_t) * NBA_MAX_RSS_RETA_SIZE * ctx->node_stat->num_ports,
+                                                              CACHE_LINE_SIZE, ctx->loc.node_id);
+        memset(ctx->rss_bucket_pkts, 0, sizeof(uint32_t) * NBA_MAX_RSS_RETA_SIZE * ctx->node_stat->num_ports);
+    }
 
     /* Initialize statistics timer. */
     if (ctx->loc.local_thread_idx == 0) {
@@ -690,13 +1552,23 @@ int io_loop(void *arg)
     // ctx->num_iobatch_size = 1; // FOR TESTING
     uint64_t loop_count = 0;
 
+    /* A split IO thread polls the NIC only if the comp thread can take
+     * all packets from a full round of RX bursts. */
+    const unsigned split_rx_reserve = (ctx->role != IO_ROLE_RXTX) ? 0
+            : (ctx->num_hw_rx_queues * ctx->num_iobatch_size + ctx->comp_ctx->num_combatch_size - 1)
+              / ctx->comp_ctx->num_combatch_size;
+
+    uint64_t perf_begin[NBA_PERF_MAX_EVENTS];
+    io_perf_read(ctx, perf_begin);
+
     /* The IO thread runs in polling mode. */
     while (likely(!ctx->loop_broken)) {
         unsigned total_recv_cnt = 0;
-        #ifdef NBA_CPU_MICROBENCH/*{{{*/
-        PAPI_start(ctx->papi_evset_rx);
-        #endif/*}}}*/
-        for (i = 0; i < ctx->num_hw_rx_queues; i++) {
+        bool has_stolen = false;
+        uint64_t iter_begin = ctx->rss_rebalance ? rte_rdtsc() : 0;
+        const bool rx_paused = (ctx->role == IO_ROLE_RXTX
+                                && rte_ring_free_count(ctx->split_rx_ring) < split_rx_reserve);
+        for (i = 0; i < ctx->num_hw_rx_queues && !rx_paused; i++) {
 #ifdef NBA_RANDOM_PORT_ACCESS /*{{{*/
             /* Shuffle the RX queue list. */
             int swap_idx = random32() % ctx->num_hw_rx_queues;
@@ -705,7 +1577,7 @@ int io_loop(void *arg)
             random_mapping[swap_idx] = temp;
         }
         unsigned _temp;
-        for (_temp = 0; _temp < ctx->num_hw_rx_queues; _temp++) {
+        for (_temp = 0; _temp < ctx->num_hw_rx_queues && !rx_paused; _temp++) {
             i = random_mapping[_temp];
 #endif /*}}}*/
             unsigned port_idx = ctx->rx_hwrings[i].ifindex;
@@ -715,15 +1587,21 @@ int io_loop(void *arg)
 
             recv_cnt = rte_eth_rx_burst((uint8_t) port_idx, rxq,
                                          &pkts[total_recv_cnt], ctx->num_iobatch_size);
+            if (recv_cnt > 0)
+                trace_record(TRACE_RX_BURST, recv_cnt, (port_idx << 16) | rxq);
 
 #if !defined(TEST_RXONLY) && !defined(TEST_MINIMAL_L2FWD)
             for(unsigned _k=0; _k<recv_cnt; _k++)
             {
                 struct rte_mbuf* cur_pkt = pkts[total_recv_cnt + _k];
                 ctx->port_stats[port_idx].num_recv_bytes += rte_pktmbuf_pkt_len(cur_pkt) + 24;
+                if (ctx->rss_rebalance && (cur_pkt->ol_flags & PKT_RX_RSS_HASH))
+                    ctx->rss_bucket_pkts[port_idx * NBA_MAX_RSS_RETA_SIZE
+                                         + (cur_pkt->hash.rss & (NBA_MAX_RSS_RETA_SIZE - 1))] ++;
             }
             total_recv_cnt += recv_cnt;
             ctx->port_stats[port_idx].num_recv_pkts += recv_cnt;
+            ctx->rx_hwring_pkts[i] += recv_cnt;
 #endif
 #ifdef TEST_RXONLY/*{{{*/
             /* Drop all packets in software */
@@ -773,35 +1651,22 @@ int io_loop(void *arg)
 
         } // end of rxq scanning
         assert(total_recv_cnt <= NBA_MAX_IO_BATCH_SIZE * ctx->num_hw_rx_queues);
-        #ifdef NBA_CPU_MICROBENCH/*{{{*/
-        {
-            long long ctr[5];
-            PAPI_stop(ctx->papi_evset_rx, ctr);
-            for (int i = 0; i < 5; i++)
-                ctx->papi_ctr_rx[i] += ctr[i];
-        }
-        #endif/*}}}*/
+        io_perf_add(ctx, IO_PERF_RX, perf_begin);
 
-        while (!rte_ring_empty(ctx->drop_queue)) {
-            int n = rte_ring_dequeue_burst(ctx->drop_queue, (void**) drop_pkts,
-                                           ctx->num_iobatch_size);
-            for (int p = 0; p < n; p++)
-                if (drop_pkts[p] != nullptr)
-                    rte_pktmbuf_free(drop_pkts[p]);
-            ctx->port_stats[0].num_sw_drop_pkts += n;
-        }
+        if (ctx->drop_buffer.count > 0)
+            io_drop_flush(ctx);
+        trace_poll();
 
-        /* Scan and execute schedulable elements. */
-        ctx->comp_ctx->elem_graph->scan_schedulable_elements(loop_count);
+        /* Swap in a reloaded element graph between batches, and drain
+         * the previous one. */
+        if (ctx->role != IO_ROLE_RXTX
+            && unlikely(ctx->comp_ctx->pending_graph.load(std::memory_order_relaxed) != nullptr
+                        || ctx->comp_ctx->retiring_graph != nullptr))
+            ctx->comp_ctx->update_element_graph(loop_count);
 
-        #ifdef NBA_CPU_MICROBENCH/*{{{*/
-        {
-            long long ctr[5];
-            PAPI_stop(ctx->papi_evset_comp, ctr);
-            for (int i = 0; i < 5; i++)
-                ctx->papi_ctr_comp[i] += ctr[i];
-        }
-        #endif/*}}}*/
+        /* Scan and execute schedulable elements. */
+        if (ctx->role != IO_ROLE_RXTX)
+            ctx->comp_ctx->elem_graph->scan_schedulable_elements(loop_count);
 
         while (!rte_ring_empty(ctx->new_packet_request_ring))/*{{{*/
         {
@@ -824,22 +1689,64 @@ int io_loop(void *arg)
             rte_mempool_put(ctx->new_packet_request_pool, new_packet);
         }/*}}}*/
 
+        if (ctx->work_stealing) {
+            bool overloaded = (total_recv_cnt == ctx->num_hw_rx_queues * ctx->num_iobatch_size);
+            io_steal_update_load(ctx, overloaded, loop_count);
+            if (ctx->steal_shed_mask != 0)
+                total_recv_cnt = io_steal_shed(ctx, pkts, total_recv_cnt, loop_count);
+            else if (total_recv_cnt == 0)
+                has_stolen = io_steal_work(ctx, loop_count);
+        }
+
         /* Process received packets. */
         print_ratelimit("# received pkts from all rxq", total_recv_cnt, 10000);
-        #ifdef NBA_CPU_MICROBENCH/*{{{*/
-        PAPI_start(ctx->papi_evset_comp);
-        #endif/*}}}*/
-        unsigned comp_batch_size = ctx->comp_ctx->num_combatch_size;
-        for (unsigned pidx = 0; pidx < total_recv_cnt; pidx += comp_batch_size) {
-            comp_process_batch(ctx, &pkts[pidx], RTE_MIN(comp_batch_size, total_recv_cnt - pidx), loop_count);
+        switch (ctx->role) {
+        case IO_ROLE_RXTX:
+            io_split_publish_rx(ctx, pkts, total_recv_cnt);
+            io_split_drain_tx(ctx);
+            break;
+        case IO_ROLE_COMP:
+            total_recv_cnt = io_split_consume_rx(ctx, loop_count);
+            break;
+        default: {
+            unsigned comp_batch_size = ctx->comp_ctx->num_combatch_size;
+            for (unsigned pidx = 0; pidx < total_recv_cnt; pidx += comp_batch_size) {
+                comp_process_batch(ctx, &pkts[pidx], RTE_MIN(comp_batch_size, total_recv_cnt - pidx), loop_count);
+            }
+            break; }
         }
 
         /* The io event loop. */
         if (likely(!ctx->loop_broken))
             ev_run(ctx->loop, EVRUN_NOWAIT);
 
+        /* Flush TX buffers that have waited too long. */
+        io_tx_flush(ctx, false);
+
+        if (ctx->rss_rebalance && total_recv_cnt > 0)
+            ctx->busy_cycles += rte_rdtsc() - iter_begin;
+        io_perf_add(ctx, IO_PERF_COMP, perf_begin);
+
+        /* Back off while there is nothing to do. */
+        if (ctx->idle_poll_mode != 0) {
+            if (total_recv_cnt > 0 || has_stolen)
+                ctx->idle_polls = 0;
+            else if (likely(!ctx->loop_broken)) {
+                io_idle_backoff(ctx, &sleep_ts);
+                io_perf_read(ctx, perf_begin);
+            }
+        }
         loop_count ++;
     }
+    io_tx_flush(ctx, true);
+    io_drop_flush(ctx);
+    if (ctx->role != IO_ROLE_RXTX)
+        ctx->comp_ctx->elem_graph->print_elem_stats();
+    #if NBA_BRANCHPRED_SCHEME == NBA_BRANCHPRED_ADAPTIVE
+    if (ctx->role != IO_ROLE_RXTX)
+        ctx->comp_ctx->elem_graph->print_branch_stats();
+    #endif
+    delete ctx->perf;
     if (ctx->loc.local_thread_idx == 0) {
         ctx->init_cond->~CondVar();
         rte_free(ctx->init_cond);
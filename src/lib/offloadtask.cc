@@ -101,7 +101,8 @@ void OffloadTask::prepare_read_buffer()
                             cctx->unwrap_host_buffer(t->aligned_item_sizes_h);
                 }
                 _debug_print_inb("prepare_read_buffer.WHOLE", nullptr, dbid);
-            } else if (rri.type == READ_PARTIAL_PACKET) {
+            } else if (rri.type == READ_PARTIAL_PACKET
+                       || rri.type == READ_PARTIAL_NETWORK) {
                 for (PacketBatch *batch : batches) {
                     struct datablock_tracker *t = &batch->datablock_states[dbid];
                     cctx->alloc_input_buffer(io_base, sizeof(uint64_t),
@@ -36,6 +36,16 @@ void Packet::kill()
     #endif
 }
 
+#if NBA_BATCH_SOA_META
+void Packet::sync_header_meta()
+{
+    if (mother != nullptr && bidx >= 0 && mother->meta.hdrs_valid) {
+        mother->meta.l3_offset[bidx] = l3_off;
+        mother->meta.l4_offset[bidx] = l4_off;
+    }
+}
+#endif
+
 }
 
 // vim: ts=8 sts=4 sw=4 et
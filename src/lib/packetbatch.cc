@@ -25,21 +25,37 @@ void PacketBatch::collect_excluded_packets()
             this->excluded[q] = true;
             this->results[p] = this->results[q];
             this->results[q] = -1;
+            #if NBA_BATCH_SOA_META
+            this->meta_move(p, q);
+            #endif
             dropped_cnt ++;
         }
     }
     this->count -= dropped_cnt;
     this->drop_count += dropped_cnt;  /* will be zeroed by ElementGraph. */
 }
+#endif
 
-void PacketBatch::clean_drops(struct rte_ring *drop_queue)
+#if NBA_BATCH_SOA_META
+void PacketBatch::gather_meta()
 {
-    if (this->drop_count > 0) {
-        rte_ring_enqueue_bulk(drop_queue,
-                              (void **) &this->packets[this->count],
-                              this->drop_count);
-        this->drop_count = 0;
-    }
+    PacketBatch *batch = this;
+    FOR_EACH_PACKET(batch) {
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+        struct annotation_set *a = &pkt->anno;
+        meta.iface_in[pkt_idx]  = anno_isset(a, NBA_ANNO_IFACE_IN)
+                                  ? (uint16_t) anno_get(a, NBA_ANNO_IFACE_IN) : NBA_META_NONE16;
+        meta.iface_out[pkt_idx] = anno_isset(a, NBA_ANNO_IFACE_OUT)
+                                  ? (uint16_t) anno_get(a, NBA_ANNO_IFACE_OUT) : NBA_META_NONE16;
+        meta.flow_id[pkt_idx]   = anno_isset(a, NBA_ANNO_IPSEC_FLOW_ID)
+                                  ? (uint32_t) anno_get(a, NBA_ANNO_IPSEC_FLOW_ID) : NBA_META_NONE32;
+        meta.timestamp[pkt_idx] = anno_isset(a, NBA_ANNO_TIMESTAMP)
+                                  ? (uint64_t) anno_get(a, NBA_ANNO_TIMESTAMP) : 0;
+        meta.l3_offset[pkt_idx] = pkt->network_header_offset();
+        meta.l4_offset[pkt_idx] = pkt->transport_header_offset();
+    } END_FOR;
+    meta.valid = true;
+    meta.hdrs_valid = true;
 }
 #endif
 
@@ -0,0 +1,178 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/framework/config.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/elementgraph.hh>
+#include <nba/framework/reload.hh>
+#include <nba/element/element.hh>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <rte_config.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
+using namespace std;
+using namespace nba;
+
+namespace nba {
+
+static vector<comp_thread_context *> reload_ctxs;
+static string reload_config_path;
+static bool reload_use_coprocessors = false;
+static unsigned reload_generation = 0;
+static sem_t reload_sem;
+static pthread_t reload_tid;
+
+/* The offloadable element classes whose device-side state is set up. */
+static unordered_set<string> reload_offloadables;
+
+static void reload_free_graphs(vector<ElementGraph *> &graphs)
+{
+    for (ElementGraph *graph : graphs) {
+        if (graph == nullptr)
+            continue;
+        graph->~ElementGraph();
+        rte_free(graph);
+    }
+}
+
+static int reload_graphs()
+{
+    for (comp_thread_context *ctx : reload_ctxs) {
+        if (ctx->pending_graph.load(std::memory_order_acquire) != nullptr) {
+            RTE_LOG(WARNING, MAIN, "reload: the previous reload is still in progress.\n");
+            return -EBUSY;
+        }
+    }
+    RTE_LOG(NOTICE, MAIN, "reload: building element graphs from %s...\n", reload_config_path.c_str());
+    reload_generation ++;
+    vector<ElementGraph *> graphs(reload_ctxs.size(), nullptr);
+    for (unsigned i = 0; i < reload_ctxs.size(); i++) {
+        comp_thread_context *ctx = reload_ctxs[i];
+        NEW(ctx->loc.node_id, graphs[i], ElementGraph, ctx, reload_generation);
+        if (ctx->build_element_graph(reload_config_path.c_str(), graphs[i]) != 0) {
+            RTE_LOG(ERR, MAIN, "reload: cannot build the element graph; keeping the current one.\n");
+            reload_free_graphs(graphs);
+            return -EINVAL;
+        }
+    }
+
+    /* Device buffers are initialized by coproc threads only at startup. */
+    vector<string> new_offloadables;
+    for (Element *el : graphs[0]->get_elements()) {
+        OffloadableElement *oel = dynamic_cast<OffloadableElement *>(el);
+        if (oel == nullptr || reload_offloadables.count(el->class_name()) > 0)
+            continue;
+        if (reload_use_coprocessors && !oel->offload_init_handlers.empty()) {
+            RTE_LOG(ERR, MAIN, "reload: offloadable element %s is not running yet; "
+                               "restart to add it.\n", el->class_name());
+            reload_free_graphs(graphs);
+            return -ENOTSUP;
+        }
+        new_offloadables.push_back(el->class_name());
+    }
+
+    /* The same initialization sequence as main(), but node-local
+     * storage already has the entries of the running elements. */
+    reload_ctxs[0]->initialize_graph_global(graphs[0]);
+    unordered_set<unsigned> initialized_nodes;
+    for (unsigned i = 0; i < reload_ctxs.size(); i++) {
+        comp_thread_context *ctx = reload_ctxs[i];
+        if (initialized_nodes.count(ctx->loc.node_id) > 0)
+            continue;
+        if (ctx->initialize_graph_per_node(graphs[i]) != 0) {
+            /* The entries allocated so far stay in node-local storage
+             * and are reused by the next reload. */
+            RTE_LOG(ERR, MAIN, "reload: cannot initialize the element graph; keeping the current one.\n");
+            reload_free_graphs(graphs);
+            return -EINVAL;
+        }
+        initialized_nodes.insert(ctx->loc.node_id);
+    }
+    for (unsigned i = 0; i < reload_ctxs.size(); i++)
+        reload_ctxs[i]->initialize_graph_per_thread(graphs[i]);
+
+    /* Each comp thread takes it at its next batch boundary. */
+    for (unsigned i = 0; i < reload_ctxs.size(); i++)
+        reload_ctxs[i]->pending_graph.store(graphs[i], std::memory_order_release);
+    for (const string &name : new_offloadables)
+        reload_offloadables.insert(name);
+    RTE_LOG(NOTICE, MAIN, "reload: element graph generation %u is ready (%d elements).\n",
+            reload_generation, graphs[0]->count());
+    return 0;
+}
+
+/* The online CPUs not running IO, comp or coproc threads.
+ * If there are none, the main lcore, which only waits for signals. */
+static void reload_get_cpus(cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus);
+    for (long c = 0, num_cpus = sysconf(_SC_NPROCESSORS_ONLN); c < num_cpus; c++)
+        CPU_SET(c, cpus);
+    for (const struct io_thread_conf &conf : io_thread_confs)
+        CPU_CLR(conf.core_id, cpus);
+    for (const struct comp_thread_conf &conf : comp_thread_confs)
+        CPU_CLR(conf.core_id, cpus);
+    for (const struct coproc_thread_conf &conf : coproc_thread_confs)
+        CPU_CLR(conf.core_id, cpus);
+    if (CPU_COUNT(cpus) == 0)
+        CPU_SET(rte_get_master_lcore(), cpus);
+}
+
+static void *reload_loop(void *arg)
+{
+    while (true) {
+        if (sem_wait(&reload_sem) != 0)
+            continue;  /* EINTR */
+        reload_graphs();
+    }
+    return nullptr;
+}
+
+int reload_setup(const vector<comp_thread_context *> &ctxs,
+                 const char *config_path, bool use_coprocessors)
+{
+    if (ctxs.empty())
+        return -EINVAL;
+    reload_ctxs = ctxs;
+    reload_config_path = config_path;
+    reload_use_coprocessors = use_coprocessors;
+    for (Element *el : ctxs[0]->elem_graph->get_elements()) {
+        if (dynamic_cast<OffloadableElement *>(el) != nullptr)
+            reload_offloadables.insert(el->class_name());
+    }
+    if (sem_init(&reload_sem, 0, 0) != 0)
+        return -errno;
+    /* The spawning thread is bound to a comp thread's core,
+     * so set the affinity before the thread runs. */
+    cpu_set_t cpus;
+    pthread_attr_t attr;
+    reload_get_cpus(&cpus);
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    int ret = pthread_create(&reload_tid, &attr, reload_loop, nullptr);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        RTE_LOG(WARNING, MAIN, "reload: cannot spawn the reload thread (%s).\n", strerror(ret));
+        sem_destroy(&reload_sem);
+        return -ret;
+    }
+    pthread_detach(reload_tid);
+    return 0;
+}
+
+void reload_request()
+{
+    sem_post(&reload_sem);
+}
+
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,130 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/core/timing.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/shmstats.hh>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <rte_config.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_log.h>
+
+using namespace std;
+using namespace nba;
+
+static size_t shmstats_size(unsigned num_sections)
+{
+    return sizeof(struct shm_stats) + sizeof(struct shm_section) * num_sections;
+}
+
+/* Returns the pid of the live process exporting to the segment, or 0. */
+static pid_t shmstats_owner(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return 0;
+    pid_t owner = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(struct shm_stats)) {
+        void *p = mmap(nullptr, sizeof(struct shm_stats), PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            const struct shm_stats *stats = (const struct shm_stats *) p;
+            if (stats->magic == NBA_SHM_STATS_MAGIC && stats->pid != 0
+                && (kill((pid_t) stats->pid, 0) == 0 || errno == EPERM))
+                owner = (pid_t) stats->pid;
+            munmap(p, sizeof(struct shm_stats));
+        }
+    }
+    close(fd);
+    return owner;
+}
+
+struct shm_stats *nba::shmstats_create(const char *name, unsigned num_sections)
+{
+    size_t size = shmstats_size(num_sections);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1 && errno == EEXIST) {
+        /* Never clobber the segment of another running instance,
+         * but take over the one left by a crashed process. */
+        pid_t owner = shmstats_owner(name);
+        if (owner != 0) {
+            RTE_LOG(WARNING, MAIN, "%s is in use by pid %d; live statistics are disabled.\n",
+                    name, (int) owner);
+            return nullptr;
+        }
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd == -1) {
+        RTE_LOG(WARNING, MAIN, "shm_open(%s) failed: %s\n", name, strerror(errno));
+        return nullptr;
+    }
+    if (ftruncate(fd, size) != 0) {
+        RTE_LOG(WARNING, MAIN, "ftruncate(%s) failed: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return nullptr;
+    }
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        RTE_LOG(WARNING, MAIN, "mmap(%s) failed: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return nullptr;
+    }
+    struct shm_stats *stats = (struct shm_stats *) p;
+    memset(stats, 0, size);
+    stats->version = NBA_SHM_STATS_VERSION;
+    stats->num_sections = num_sections;
+    stats->pid = (uint32_t) getpid();
+    stats->tsc_hz = rte_get_tsc_hz();
+    /* Readers check the magic last. */
+    rte_wmb();
+    stats->magic = NBA_SHM_STATS_MAGIC;
+    return stats;
+}
+
+void nba::shmstats_destroy(const char *name, struct shm_stats *stats)
+{
+    if (stats == nullptr)
+        return;
+    munmap(stats, shmstats_size(stats->num_sections));
+    shm_unlink(name);
+}
+
+void nba::shmstats_begin(struct shm_section *sec)
+{
+    sec->seq ++;
+    rte_wmb();
+    sec->num_counters = 0;
+}
+
+void nba::shmstats_add(struct shm_section *sec, enum shm_counter_type type, uint64_t value,
+                       const char *name_fmt, ...)
+{
+    if (sec->num_counters == NBA_SHM_MAX_COUNTERS)
+        return;
+    struct shm_counter *c = &sec->counters[sec->num_counters ++];
+    va_list ap;
+    va_start(ap, name_fmt);
+    vsnprintf(c->name, NBA_SHM_NAME_LEN, name_fmt, ap);
+    va_end(ap);
+    c->type = type;
+    c->value = value;
+}
+
+void nba::shmstats_commit(struct shm_section *sec)
+{
+    sec->update_usec = get_usec();
+    rte_wmb();
+    sec->seq ++;
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstring>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <nba/framework/test_utils.hh>
@@ -13,6 +14,25 @@ PacketBatch *nba::testing::create_batch
 (size_t num_pkts, size_t pkt_size, pkt_init_callback_t init_cb)
 {
     PacketBatch *batch = new PacketBatch();
+    for (unsigned pkt_idx = 0; pkt_idx < num_pkts; pkt_idx++) {
+        batch->packets[pkt_idx] = (struct rte_mbuf *) malloc(sizeof(struct rte_mbuf)
+                                                             + RTE_PKTMBUF_HEADROOM
+                                                             + NBA_MAX_PACKET_SIZE);
+    }
+    reset_batch(batch, num_pkts, pkt_size, init_cb);
+    return batch;
+}
+
+void nba::testing::reset_batch
+(PacketBatch *batch, size_t num_pkts, size_t pkt_size, pkt_init_callback_t init_cb)
+{
+    /* Elements may have reordered the packets (e.g., collect_excluded_packets())
+     * but the set of mbufs is kept.  reset() may poison packets[] in DEBUG builds. */
+    struct rte_mbuf *mbufs[NBA_MAX_COMP_BATCH_SIZE];
+    assert(num_pkts <= NBA_MAX_COMP_BATCH_SIZE);
+    memcpy(mbufs, batch->packets, sizeof(struct rte_mbuf *) * num_pkts);
+    batch->reset();
+    memcpy(batch->packets, mbufs, sizeof(struct rte_mbuf *) * num_pkts);
     batch->count = num_pkts;
     INIT_BATCH_MASK(batch);
     batch->banno.bitmask = 0;
@@ -23,11 +43,6 @@ PacketBatch *nba::testing::create_batch
     batch->slot_count = batch->count;
     Packet *prev_pkt = nullptr;
     #endif
-    for (unsigned pkt_idx = 0; pkt_idx < num_pkts; pkt_idx++) {
-        batch->packets[pkt_idx] = (struct rte_mbuf *) malloc(sizeof(struct rte_mbuf)
-                                                             + RTE_PKTMBUF_HEADROOM
-                                                             + NBA_MAX_PACKET_SIZE);
-    }
     FOR_EACH_PACKET_ALL_INIT_PREFETCH(batch, 8u) {
         assert(pkt_idx < num_pkts);
         assert(nullptr != batch->packets[pkt_idx]);
@@ -36,6 +51,10 @@ PacketBatch *nba::testing::create_batch
                                                       + sizeof(struct rte_mbuf));
         batch->packets[pkt_idx]->data_off = RTE_PKTMBUF_HEADROOM;
         batch->packets[pkt_idx]->port = 0;
+        batch->packets[pkt_idx]->ol_flags = 0;
+        #ifdef RTE_PTYPE_L2_MASK
+        batch->packets[pkt_idx]->packet_type = 0;
+        #endif
         batch->packets[pkt_idx]->pkt_len = pkt_size;
         batch->packets[pkt_idx]->data_len = pkt_size;
         Packet *pkt = Packet::from_base_nocheck(batch->packets[pkt_idx]);
@@ -54,9 +73,8 @@ PacketBatch *nba::testing::create_batch
         anno_set(&pkt->anno, NBA_ANNO_TIMESTAMP, 1234);
         anno_set(&pkt->anno, NBA_ANNO_BATCH_ID, 10000);
         init_cb(pkt_idx, pkt);
+        pkt->parse_headers();
     } END_FOR_ALL_INIT_PREFETCH;
-
-    return batch;
 }
 
 void nba::testing::free_batch(PacketBatch *batch)
@@ -0,0 +1,144 @@
+#include <nba/core/intrinsic.hh>
+#include <nba/framework/config.hh>
+#include <nba/framework/logging.hh>
+#include <nba/framework/trace.hh>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <rte_config.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+#include <rte_lcore.h>
+#include <rte_spinlock.h>
+
+using namespace std;
+using namespace nba;
+
+namespace nba {
+
+volatile bool trace_enabled = false;
+thread_local TraceRing *trace_ring = nullptr;
+rte_atomic32_t trace_toggled = RTE_ATOMIC32_INIT(0);
+
+struct trace_thread_slot {
+    char name[NBA_TRACE_NAME_LEN];
+    uint32_t tid;
+    TraceRing ring;
+};
+
+static unsigned trace_capacity = 0;
+static struct trace_thread_slot trace_slots[RTE_MAX_LCORE];
+static rte_atomic32_t trace_num_slots = RTE_ATOMIC32_INIT(0);
+
+/* All comp threads swap in the graphs of the same configuration. */
+static char trace_elem_names[NBA_MAX_ELEMENTS][NBA_TRACE_NAME_LEN];
+static unsigned trace_num_elements = 0;
+static rte_spinlock_t trace_elem_names_lock = RTE_SPINLOCK_INITIALIZER;
+
+void trace_setup(bool enabled, unsigned events_per_thread)
+{
+    /* Round up to a power of two for TraceRing. */
+    unsigned capacity = 1;
+    while (capacity < events_per_thread)
+        capacity <<= 1;
+    trace_capacity = capacity;
+    trace_enabled = enabled;
+}
+
+void trace_init_thread(const char *name, unsigned node_id)
+{
+    if (trace_capacity == 0)
+        return;
+    int idx = rte_atomic32_add_return(&trace_num_slots, 1) - 1;
+    if (idx >= RTE_MAX_LCORE) {
+        RTE_LOG(WARNING, MAIN, "trace: too many threads; %s is not traced.\n", name);
+        return;
+    }
+    struct trace_event *buf = (struct trace_event *) rte_malloc_socket(nullptr,
+            sizeof(struct trace_event) * trace_capacity, CACHE_LINE_SIZE, node_id);
+    if (buf == nullptr) {
+        RTE_LOG(WARNING, MAIN, "trace: cannot allocate the ring for %s.\n", name);
+        return;
+    }
+    struct trace_thread_slot *slot = &trace_slots[idx];
+    snprintf(slot->name, NBA_TRACE_NAME_LEN, "%s", name);
+    slot->tid = (uint32_t) syscall(SYS_gettid);
+    slot->ring.init(buf, trace_capacity);
+    trace_ring = &slot->ring;
+}
+
+void trace_set_element_names(unsigned num_elements, const char *const *names)
+{
+    num_elements = RTE_MIN(num_elements, NBA_MAX_ELEMENTS);
+    rte_spinlock_lock(&trace_elem_names_lock);
+    for (unsigned i = 0; i < num_elements; i++)
+        snprintf(trace_elem_names[i], NBA_TRACE_NAME_LEN, "%s", names[i]);
+    trace_num_elements = num_elements;
+    rte_spinlock_unlock(&trace_elem_names_lock);
+}
+
+void trace_toggle()
+{
+    trace_enabled = !trace_enabled;
+    rte_atomic32_set(&trace_toggled, 1);
+}
+
+void trace_report_toggle()
+{
+    if (rte_atomic32_cmpset((volatile uint32_t *) &trace_toggled.cnt, 1, 0))
+        RTE_LOG(NOTICE, MAIN, "tracing %s.\n", trace_enabled ? "started" : "stopped");
+}
+
+int trace_dump(const char *path)
+{
+    unsigned num_threads = RTE_MIN((unsigned) rte_atomic32_read(&trace_num_slots),
+                                   (unsigned) RTE_MAX_LCORE);
+    uint64_t total = 0;
+    for (unsigned t = 0; t < num_threads; t++)
+        total += trace_slots[t].ring.size();
+    if (total == 0)
+        return 0;
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == nullptr) {
+        RTE_LOG(ERR, MAIN, "trace: cannot open %s: %s\n", path, strerror(errno));
+        return -errno;
+    }
+    struct trace_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, NBA_TRACE_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = NBA_TRACE_FILE_VERSION;
+    hdr.num_threads = num_threads;
+    hdr.tsc_hz = rte_get_tsc_hz();
+    hdr.num_elements = trace_num_elements;
+    hdr.num_event_types = NUM_TRACE_EVENT_TYPES;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    if (trace_num_elements > 0)
+        fwrite(trace_elem_names, NBA_TRACE_NAME_LEN, trace_num_elements, fp);
+    for (unsigned t = 0; t < num_threads; t++) {
+        const struct trace_thread_slot *slot = &trace_slots[t];
+        struct trace_file_thread th;
+        memset(&th, 0, sizeof(th));
+        memcpy(th.name, slot->name, NBA_TRACE_NAME_LEN);
+        th.tid = slot->tid;
+        th.num_events = slot->ring.size();
+        th.num_overwritten = slot->ring.overwritten();
+        fwrite(&th, sizeof(th), 1, fp);
+        for (unsigned i = 0; i < th.num_events; i++)
+            fwrite(&slot->ring.at(i), sizeof(struct trace_event), 1, fp);
+    }
+    if (fclose(fp) != 0) {
+        RTE_LOG(ERR, MAIN, "trace: cannot write %s: %s\n", path, strerror(errno));
+        return -errno;
+    }
+    RTE_LOG(NOTICE, MAIN, "trace: dumped %lu events of %u threads to %s\n",
+            total, num_threads, path);
+    return 0;
+}
+
+}
+
+// vim: ts=8 sts=4 sw=4 et
@@ -20,6 +20,9 @@
 #include <nba/framework/datablock.hh>
 #include <nba/framework/elementgraph.hh>
 #include <nba/framework/logging.hh>
+#include <nba/framework/reload.hh>
+#include <nba/framework/shmstats.hh>
+#include <nba/framework/trace.hh>
 #include <nba/element/packet.hh>
 #include <nba/element/annotation.hh>
 #include <nba/element/nodelocalstorage.hh>
@@ -47,9 +50,6 @@
 #include <unordered_set>
 #include <map>
 
-#ifdef NBA_CPU_MICROBENCH
-#include <papi.h>
-#endif
 #include <unistd.h>
 #include <limits.h>
 #include <signal.h>
@@ -76,6 +76,7 @@
 #include <rte_ether.h>
 #include <rte_ethdev.h>
 #include <rte_ring.h>
+#include <rte_cycles.h>
 
 using namespace std;
 using namespace nba;
@@ -85,18 +86,30 @@ static unsigned num_coproc_threads, num_comp_threads, num_io_threads;
 static struct spawned_thread *coprocessor_threads;
 static struct spawned_thread *computation_threads;
 static struct spawned_thread *io_threads;
+static struct shm_stats *shm_segment = nullptr;
 
 static CondVar _exit_cond;
 static bool _terminated = false;
 static thread_id_t main_thread_id;
 
 static void handle_signal(int signum);
+static void handle_trace_signal(int signum);
+static void handle_reload_signal(int signum);
 
 static void invalid_cb(struct ev_loop *loop, struct ev_async *w, int revents)
 {
     rte_panic("BUG: Callback was not set!!\n");
 }
 
+/* Exits if the system parameter is out of [min_val, max_val]. */
+static void check_param(const char *name, long min_val, long max_val)
+{
+    long val = system_params[name];
+    if (val < min_val || val > max_val)
+        rte_exit(EXIT_FAILURE, "%s must be between %ld and %ld (given %ld).\n",
+                 name, min_val, max_val, val);
+}
+
 int main(int argc, char **argv)
 {
     /* Prevent multiple instances from running concurrently. */
@@ -134,10 +147,6 @@ int main(int argc, char **argv)
         unsigned num_rx_ports;
     } node_ports[NBA_MAX_NODES];
 
-#ifdef NBA_CPU_MICROBENCH
-    assert(PAPI_library_init(PAPI_VER_CURRENT) == PAPI_VER_CURRENT);
-    assert(PAPI_thread_init(pthread_self) == PAPI_OK);
-#endif
     setlocale(LC_NUMERIC, "");
 
     /* Initialize DPDK EAL and move argument pointers. */
@@ -268,6 +277,25 @@ int main(int argc, char **argv)
     if (!load_config(system_config)) {
         rte_exit(EXIT_FAILURE, "Loading system configuration has failed.\n");
     }
+    check_param("BRANCHPRED_SCHEME", NBA_BRANCHPRED_DISABLED, NBA_MAX_BRANCHPRED_SCHEME);
+    #if NBA_BRANCHPRED_SCHEME != NBA_BRANCHPRED_ADAPTIVE
+    if (system_params["BRANCHPRED_SCHEME"] != NBA_BRANCHPRED_SCHEME)
+        RTE_LOG(WARNING, MAIN, "BRANCHPRED_SCHEME is fixed to %d in this build; "
+                               "build with NBA_BRANCHPRED_SCHEME=%d to select it at runtime.\n",
+                NBA_BRANCHPRED_SCHEME, NBA_BRANCHPRED_ADAPTIVE);
+    #endif
+    check_param("BRANCHPRED_MISS_PERCENT", 0, NBA_MAX_BRANCHPRED_MISS_PERCENT);
+    check_param("TX_BUFFER_SIZE", 0, NBA_MAX_TX_BUFFER_SIZE);
+    check_param("TX_FLUSH_USEC", 0, NBA_MAX_TX_FLUSH_USEC);
+    check_param("HW_CSUM_OFFLOAD", 0, NBA_MAX_HW_CSUM_OFFLOAD);
+    check_param("RSS_REBALANCE", 0, NBA_MAX_RSS_REBALANCE);
+    check_param("RSS_REBALANCE_THRESHOLD", 0, NBA_MAX_RSS_REBALANCE_THRESHOLD);
+    check_param("RSS_REBALANCE_HOLDOFF", 0, NBA_MAX_RSS_REBALANCE_HOLDOFF);
+    check_param("WORK_STEALING", 0, NBA_MAX_WORK_STEALING);
+    check_param("IO_COMP_SPLIT", 0, NBA_MAX_IO_COMP_SPLIT);
+    check_param("IDLE_POLL", 0, NBA_MAX_IDLE_POLL);
+    check_param("ELEM_STAT_SAMPLE", 0, NBA_MAX_ELEM_STAT_SAMPLE);
+    check_param("STATS_SHM", 0, NBA_MAX_STATS_SHM);
     if (num_ports > NBA_MAX_PORTS)
         num_ports = NBA_MAX_PORTS;
 
@@ -281,6 +309,15 @@ int main(int argc, char **argv)
     //    rte_exit(EXIT_FAILURE, "Could not open the pipeline configuration.\n");
     //}
 
+    /* When enabled, ports that support them validate RX IPv4 checksums
+     * and compute TX IPv4 checksums requested by elements.  The other
+     * ports fall back to software in io_tx_flush_port(). */
+    const bool hw_csum_offload = (system_params["HW_CSUM_OFFLOAD"] != 0);
+    uint32_t tx_csum_ports = 0;
+    /* Ports whose drivers accept RX interrupts for IDLE_POLL=2.
+     * IO threads polling any other port stay at the sleep tier. */
+    uint32_t rx_intr_ports = 0;
+
     /* Prepare per-port configurations. */
     struct rte_eth_conf port_conf;
     memzero(&port_conf, 1);
@@ -355,27 +392,62 @@ int main(int argc, char **argv)
 
         rte_eth_dev_info_get(port_idx, &dev_info);
 
+        /* Enable checksum offloads only where supported. */
+        struct rte_eth_conf this_port_conf = port_conf;
+        struct rte_eth_txconf this_tx_conf = tx_conf;
+        if (hw_csum_offload) {
+            if (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_IPV4_CKSUM)
+                this_port_conf.rxmode.hw_ip_checksum = true;
+            if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_IPV4_CKSUM) {
+                /* The "simple TX" function ignores offload requests. */
+                this_tx_conf.txq_flags = ETH_TXQ_FLAGS_NOMULTSEGS | ETH_TXQ_FLAGS_NOVLANOFFL
+                                         | ETH_TXQ_FLAGS_NOXSUMSCTP;
+                tx_csum_ports |= (1u << port_idx);
+            }
+            RTE_LOG(INFO, MAIN, "port %u: hw checksum offload rx %s, tx %s\n", port_idx,
+                    this_port_conf.rxmode.hw_ip_checksum ? "on" : "off",
+                    (tx_csum_ports & (1u << port_idx)) ? "on" : "off (software)");
+        }
+        if (system_params["IDLE_POLL"] == 2)
+            this_port_conf.intr_conf.rxq = 1;
+
         /* Check the available RX/TX queues. */
         if (num_rxq_per_port > dev_info.max_rx_queues)
             rte_exit(EXIT_FAILURE, "port (%u, %s) does not support request number of rxq (%u).\n",
                      port_idx, dev_info.driver_name, num_rxq_per_port);
-        if (num_txq_per_port > dev_info.max_tx_queues)
+        /* IO threads use the TX queues of their global thread indices only,
+         * so virtual devices (e.g., net_pcap and net_ring) with a few TX
+         * queues may still be used. */
+        unsigned this_num_txq = RTE_MIN(num_txq_per_port, (unsigned) dev_info.max_tx_queues);
+        unsigned num_txq_required = io_thread_confs.size() * ((system_params["IO_COMP_SPLIT"] != 0) ? 2 : 1);
+        if (this_num_txq < num_txq_required)
             rte_exit(EXIT_FAILURE, "port (%u, %s) does not support request number of txq (%u).\n",
-                     port_idx, dev_info.driver_name, num_txq_per_port);
-
-        assert(0 == rte_eth_dev_configure(port_idx, num_rxq_per_port, num_txq_per_port, &port_conf));
+                     port_idx, dev_info.driver_name, num_txq_required);
+
+        ret = rte_eth_dev_configure(port_idx, num_rxq_per_port, this_num_txq, &this_port_conf);
+        if (ret != 0 && this_port_conf.intr_conf.rxq) {
+            /* Drivers without RX interrupt support reject the whole configuration. */
+            RTE_LOG(WARNING, MAIN, "port (%u, %s) does not support RX interrupts (%d), "
+                                   "its IO threads fall back to idle sleeps.\n",
+                    port_idx, dev_info.driver_name, ret);
+            this_port_conf.intr_conf.rxq = 0;
+            ret = rte_eth_dev_configure(port_idx, num_rxq_per_port, this_num_txq, &this_port_conf);
+        }
+        assert(0 == ret);
+        if (this_port_conf.intr_conf.rxq)
+            rx_intr_ports |= (1u << port_idx);
         rte_eth_macaddr_get(port_idx, &macaddr);
 
         /* Initialize memory pool, rxq, txq rings. */
         unsigned node_idx = rte_eth_dev_socket_id(port_idx);
-        if (is_numa_disabled)
-            node_idx = 0;
+        if (is_numa_disabled || rte_eth_dev_socket_id(port_idx) < 0)
+            node_idx = 0;   /* virtual devices have SOCKET_ID_ANY */
         unsigned port_per_node = node_ports[node_idx].num_rx_ports;
         node_ports[node_idx].rx_ports[port_per_node].port_idx = port_idx;
         ether_addr_copy(&macaddr, &node_ports[node_idx].rx_ports[port_per_node].addr);
         node_ports[node_idx].num_rx_ports ++;
-        for (ring_idx = 0; ring_idx < num_txq_per_port; ring_idx++) {
-            ret = rte_eth_tx_queue_setup(port_idx, ring_idx, num_tx_desc, node_idx, &tx_conf);
+        for (ring_idx = 0; ring_idx < this_num_txq; ring_idx++) {
+            ret = rte_eth_tx_queue_setup(port_idx, ring_idx, num_tx_desc, node_idx, &this_tx_conf);
             if (ret < 0)
                 rte_exit(EXIT_FAILURE, "rte_eth_tx_queue_setup: err=%d, port=%d, qidx=%d\n",
                          ret, port_idx, ring_idx);
@@ -484,6 +556,12 @@ int main(int argc, char **argv)
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
     signal(SIGUSR1, SIG_IGN);
+    signal(SIGUSR2, handle_trace_signal);
+    signal(SIGHUP, SIG_IGN);  /* until the reload thread is ready */
+
+    /* The trace rings are always allocated so that SIGUSR2 can start
+     * tracing without restarting. */
+    trace_setup(system_params["TRACE"] != 0, system_params["TRACE_EVENTS"]);
 
     /* Now we need to spawn IO, computation, corprocessor threads.
      * They have interdependencies of element graphs and device initialization steps as follows.
@@ -646,9 +724,13 @@ int main(int argc, char **argv)
             ctx->num_batchpool_size = system_params["BATCHPOOL_SIZE"];
             ctx->num_taskpool_size = system_params["TASKPOOL_SIZE"];
             ctx->task_completion_queue_size = system_params["COPROC_COMPLETIONQ_LENGTH"];
+            ctx->branchpred_scheme = system_params["BRANCHPRED_SCHEME"];
+            ctx->branchpred_miss_percent = system_params["BRANCHPRED_MISS_PERCENT"];
             ctx->num_tx_ports = num_ports;
             ctx->num_nodes = num_nodes;
             ctx->preserve_latency = preserve_latency;
+            ctx->hw_csum_offload = hw_csum_offload;
+            ctx->elem_stat_sample = system_params["ELEM_STAT_SAMPLE"];
 
             ctx->io_ctx = nullptr;
             ctx->coproc_ctx = nullptr;
@@ -716,7 +798,8 @@ int main(int argc, char **argv)
             ctx->rx_watcher = qwatchers[conf.swrxq_idx];
             queue_privs[conf.swrxq_idx] = (void *) ctx;
 
-            ctx->build_element_graph(pipeline_config);
+            if (ctx->build_element_graph(pipeline_config, ctx->elem_graph) != 0)
+                rte_panic("Cannot build the element graph from %s.\n", pipeline_config);
             comp_thread_ctxs.push_back(ctx);
             i++;
         }
@@ -726,7 +809,7 @@ int main(int argc, char **argv)
     {
         comp_thread_context* ctx = (comp_thread_context *) *(comp_thread_ctxs.begin());
         threading::bind_cpu(ctx->loc.core_id);
-        ctx->initialize_graph_global();
+        ctx->initialize_graph_global(ctx->elem_graph);
     }
 
     /* Initialize elements for each NUMA node. */
@@ -746,7 +829,8 @@ int main(int argc, char **argv)
         for (comp_thread_context *ctx : comp_thread_ctxs) {
             if (ctx->loc.node_id == node_id && !node_initialized[node_id]) {
                 threading::bind_cpu(ctx->loc.core_id);
-                ctx->initialize_graph_per_node();
+                if (ctx->initialize_graph_per_node(ctx->elem_graph) != 0)
+                    rte_exit(EXIT_FAILURE, "cannot initialize the element graph at node %u.\n", node_id);
                 node_initialized[node_id] = true;
             }
         }
@@ -777,7 +861,14 @@ int main(int argc, char **argv)
     /* Initialize elements for each computation thread. */
     for (comp_thread_context *ctx : comp_thread_ctxs) {
         threading::bind_cpu(ctx->loc.core_id);
-        ctx->initialize_graph_per_thread();
+        ctx->initialize_graph_per_thread(ctx->elem_graph);
+    }
+
+    /* SIGHUP rebuilds the element graphs from pipeline_config while
+     * running.  Node-local storage is kept across reloads. */
+    if (reload_setup(comp_thread_ctxs, pipeline_config, num_coproc_threads > 0) == 0) {
+        signal(SIGHUP, handle_reload_signal);
+        RTE_LOG(INFO, MAIN, "send SIGHUP to reload the pipeline configuration %s\n", pipeline_config);
     }
 
     /* Let the coprocessor threads to run its loop as we initialized
@@ -787,7 +878,13 @@ int main(int argc, char **argv)
 			coprocessor_threads[node_id].coproc_ctx->loopstart_barrier->proceed();
 		}
 
-    /* Spawn the IO threads. */
+    /* Spawn the IO threads.
+     * With IO_COMP_SPLIT, each comp thread runs its own loop on its core
+     * (as an IO_ROLE_COMP thread) instead of inside the IO thread. */
+    const bool io_comp_split = (system_params["IO_COMP_SPLIT"] != 0);
+    const unsigned num_io_confs = io_thread_confs.size();
+    if (io_comp_split)
+        num_io_threads = 2 * num_io_confs;
     io_threads = new struct spawned_thread[num_io_threads];
     {
         /* per-node data structures */
@@ -797,6 +894,14 @@ int main(int argc, char **argv)
         struct ev_async **node_stat_watchers = new ev_async*[num_nodes];
         rte_atomic16_t **node_master_flags = new rte_atomic16_t*[num_nodes];
         io_thread_context **node_master_ctxs = new io_thread_context*[num_nodes];
+        struct io_node_steal **node_steals = new struct io_node_steal*[num_nodes];
+
+        /* Live statistics: a section per node followed by one per IO thread. */
+        if (system_params["STATS_SHM"] != 0) {
+            shm_segment = shmstats_create(NBA_SHM_STATS_NAME, num_nodes + num_io_threads);
+            if (shm_segment != nullptr)
+                RTE_LOG(INFO, MAIN, "exporting live statistics to shared memory %s\n", NBA_SHM_STATS_NAME);
+        }
 
         for (unsigned node_id = 0; node_id < num_nodes; node_id ++) {
             node_stats[node_id] = (struct io_node_stat *) rte_malloc_socket("io_node_stat", sizeof(struct io_node_stat),
@@ -813,12 +918,29 @@ int main(int argc, char **argv)
                 node_stats[node_id]->port_stats[j].num_invalid_pkts = RTE_ATOMIC64_INIT(0);
             }
             memzero(&node_stats[node_id]->last_total, 1);
+            node_stats[node_id]->rss_rebalance = (system_params["RSS_REBALANCE"] != 0);
+            node_stats[node_id]->rss_threshold = system_params["RSS_REBALANCE_THRESHOLD"];
+            node_stats[node_id]->rss_holdoff = system_params["RSS_REBALANCE_HOLDOFF"];
+            memzero(node_stats[node_id]->rss, NBA_MAX_PORTS);
+            memzero(node_stats[node_id]->thread_busy_cycles, NBA_MAX_CORES);
+            node_stats[node_id]->elem_stat_sample = system_params["ELEM_STAT_SAMPLE"];
+            node_stats[node_id]->num_elems = 0;
+            memzero(node_stats[node_id]->elem_names, NBA_MAX_ELEMENTS);
+            memzero(node_stats[node_id]->elem_stats, NBA_MAX_ELEMENTS);
+            rte_spinlock_init(&node_stats[node_id]->latency_lock);
+            node_stats[node_id]->pkt_latency_hist.reset();
+            node_stats[node_id]->task_latency_hist.reset();
+            node_stats[node_id]->queue_delay_hist.reset();
+            memzero(node_stats[node_id]->elem_totals, NBA_MAX_ELEMENTS);
+            node_stats[node_id]->shm_section = (shm_segment != nullptr) ? &shm_segment->sections[node_id] : nullptr;
             unsigned num_io_threads_in_node = 0;
             for (auto it = io_thread_confs.begin(); it != io_thread_confs.end(); it++) {
                 struct io_thread_conf &conf = *it;
                 if (numa_node_of_cpu(conf.core_id) == (signed) node_id)
                     num_io_threads_in_node ++;
             }
+            if (io_comp_split)
+                num_io_threads_in_node *= 2;
             node_stats[node_id]->num_threads = num_io_threads_in_node;
 
             node_stat_watchers[node_id] = (struct ev_async *) rte_malloc_socket(nullptr, sizeof(struct ev_async),
@@ -829,6 +951,28 @@ int main(int argc, char **argv)
 
             node_master_ctxs[node_id] = nullptr;
 
+            node_steals[node_id] = nullptr;
+            if (system_params["WORK_STEALING"] != 0) {
+                char name[RTE_MEMPOOL_NAMESIZE];
+                node_steals[node_id] = (struct io_node_steal *) rte_malloc_socket("io_node_steal", sizeof(struct io_node_steal),
+                                                                                  CACHE_LINE_SIZE, node_id);
+                assert(node_steals[node_id] != nullptr);
+                snprintf(name, RTE_MEMPOOL_NAMESIZE, "steal_bundles.%u", node_id);
+                node_steals[node_id]->bundle_pool = rte_mempool_create(name, 2 * NBA_STEAL_QUEUES * NBA_STEAL_RING_SIZE - 1,
+                                                                       sizeof(struct io_steal_bundle), 32, 0,
+                                                                       nullptr, nullptr, nullptr, nullptr, node_id, 0);
+                if (node_steals[node_id]->bundle_pool == nullptr)
+                    rte_exit(EXIT_FAILURE, "cannot allocate the steal bundle pool for node %u.\n", node_id);
+                for (k = 0; k < NBA_STEAL_QUEUES; k++) {
+                    struct io_steal_queue *sq = &node_steals[node_id]->queues[k];
+                    snprintf(name, RTE_RING_NAMESIZE, "stealq.%u:%u", node_id, k);
+                    sq->ring = rte_ring_create(name, NBA_STEAL_RING_SIZE, node_id, 0);
+                    if (sq->ring == nullptr)
+                        rte_exit(EXIT_FAILURE, "cannot allocate the steal queue %u for node %u.\n", k, node_id);
+                    rte_atomic32_init(&sq->owner);
+                }
+            }
+
             init_done_flags[node_id] = (bool *) rte_malloc_socket("io_ctx.initflag", sizeof(bool),
                                                                   CACHE_LINE_SIZE, node_id);
             *init_done_flags[node_id] = false;
@@ -873,19 +1017,32 @@ int main(int argc, char **argv)
 
             ctx->num_io_threads = num_io_threads;
             ctx->num_iobatch_size = system_params["IO_BATCH_SIZE"];
+            ctx->num_txbuf_size = RTE_MAX(1l, system_params["TX_BUFFER_SIZE"]);
+            ctx->tx_flush_cycles = rte_get_tsc_hz() / 1000000u * system_params["TX_FLUSH_USEC"];
+            ctx->tx_pending_ports = 0;
+            ctx->tx_csum_ports = tx_csum_ports;
+            ctx->rss_rebalance = (system_params["RSS_REBALANCE"] != 0);
+            ctx->work_stealing = (system_params["WORK_STEALING"] != 0) && !io_comp_split;
+            ctx->node_steal = node_steals[node_id];
+            ctx->idle_poll_mode = system_params["IDLE_POLL"];
+            ctx->rx_intr_ports = rx_intr_ports;
+            ctx->shm_section = (shm_segment != nullptr) ? &shm_segment->sections[num_nodes + i] : nullptr;
+            for (k = 0; k < NBA_MAX_PORTS; k++)
+                ctx->tx_buffers[k].count = 0;
             ctx->mode = conf.mode;
+            ctx->role = io_comp_split ? IO_ROLE_RXTX : IO_ROLE_ALL;
+            ctx->split_rx_ring = nullptr;
+            ctx->split_tx_ring = nullptr;
+            ctx->split_bundle_pool = nullptr;
             ctx->LB_THRUPUT_WINDOW_SIZE = (1 << 16);
 
-            /* drop_queue, tx_queue, prepacket_queue are
+            /* tx_queue, prepacket_queue are
              * one-to-one mapped to IO threads.
              * Multiple computation threads may become the
              * producers of them owned by a single IO thread.
+             * Dropped packets are freed by the thread that drops them.
              */
-            snprintf(ring_name, RTE_RING_NAMESIZE, "dropq.%u:%u@%u",
-                     ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
-            ctx->drop_queue = rte_ring_create(ring_name, 8 * NBA_MAX_COMP_BATCH_SIZE,
-                                              node_id, RING_F_SC_DEQ);
-            assert(NULL != ctx->drop_queue);
+            ctx->drop_buffer.count = 0;
 
             ctx->num_tx_ports = num_ports;
             for (k = 0; k < num_ports; k++) {
@@ -910,6 +1067,8 @@ int main(int argc, char **argv)
                 struct hwrxq rxq = *itq;
                 ctx->rx_hwrings[k] = rxq;
                 ctx->rx_pools[k] = rx_mempools[itq->ifindex][itq->qidx];
+                ctx->node_stat->rss[itq->ifindex].rxq_polled[itq->qidx] = true;
+                ctx->node_stat->rss[itq->ifindex].rxq_owner[itq->qidx] = ctx->loc.local_thread_idx;
                 k++;
             }
             ctx->rx_queue   = queues[conf.swrxq_idx];
@@ -925,8 +1084,110 @@ int main(int argc, char **argv)
                     ctx->loc.core_id, comp_ctx->loc.core_id);
             comp_ctx->io_ctx = ctx;
             ctx->comp_ctx = comp_ctx;
+
+            if (io_comp_split) {
+                unsigned comp_core_id = comp_ctx->loc.core_id;
+                if (comp_core_id == conf.core_id
+                    || (unsigned) numa_node_of_cpu(comp_core_id) != node_id
+                    || !rte_lcore_is_enabled(comp_core_id))
+                    rte_exit(EXIT_FAILURE, "IO_COMP_SPLIT requires the comp thread of io thread @%u "
+                             "to be on a separate enabled core in the same node (got @%u).\n",
+                             conf.core_id, comp_core_id);
+
+                snprintf(ring_name, RTE_RING_NAMESIZE, "splitrx.%u:%u@%u",
+                         ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+                ctx->split_rx_ring = rte_ring_create(ring_name, NBA_SPLIT_RING_SIZE, node_id,
+                                                     RING_F_SP_ENQ | RING_F_SC_DEQ);
+                assert(NULL != ctx->split_rx_ring);
+                snprintf(ring_name, RTE_RING_NAMESIZE, "splittx.%u:%u@%u",
+                         ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+                ctx->split_tx_ring = rte_ring_create(ring_name, NBA_SPLIT_RING_SIZE, node_id,
+                                                     RING_F_SP_ENQ | RING_F_SC_DEQ);
+                assert(NULL != ctx->split_tx_ring);
+                snprintf(mempool_name, RTE_MEMPOOL_NAMESIZE, "splitbundle.%u:%u@%u",
+                         ctx->loc.node_id, ctx->loc.local_thread_idx, ctx->loc.core_id);
+                ctx->split_bundle_pool = rte_mempool_create(mempool_name, 4 * NBA_SPLIT_RING_SIZE - 1,
+                                                            sizeof(struct io_split_bundle), 16, 0,
+                                                            nullptr, nullptr, nullptr, nullptr, node_id, 0);
+                if (ctx->split_bundle_pool == nullptr)
+                    rte_exit(EXIT_FAILURE, "cannot allocate the split bundle pool for io thread @%u.\n",
+                             conf.core_id);
+
+                /* The comp-side context shares the configuration and the
+                 * split rings, but has its own loop and no RX queues. */
+                struct io_thread_context *comp_io_ctx = (struct io_thread_context *) rte_malloc_socket(
+                        "io_thread_conf", sizeof(*comp_io_ctx), CACHE_LINE_SIZE, node_id);
+                memcpy(comp_io_ctx, ctx, sizeof(*ctx));
+                comp_io_ctx->role = IO_ROLE_COMP;
+                comp_io_ctx->loc.core_id = comp_core_id;
+                comp_io_ctx->loc.local_thread_idx = per_node_counts[node_id] ++;
+                comp_io_ctx->loc.global_thread_idx = num_io_confs + i;
+                comp_io_ctx->shm_section = (shm_segment != nullptr)
+                                           ? &shm_segment->sections[num_nodes + num_io_confs + i] : nullptr;
+                comp_io_ctx->num_hw_rx_queues = 0;
+                NEW(node_id, comp_io_ctx->block, CondVar);
+                NEW(node_id, comp_io_ctx->io_lock, Lock);
+                comp_io_ctx->terminate_watcher = (struct ev_async *) rte_malloc_socket(NULL, sizeof(struct ev_async),
+                                                                                       CACHE_LINE_SIZE, node_id);
+                ev_async_init(comp_io_ctx->terminate_watcher, NULL);
+                comp_io_ctx->drop_buffer.count = 0;
+                snprintf(ring_name, RTE_RING_NAMESIZE, "reqring.%u:%u@%u",
+                         comp_io_ctx->loc.node_id, comp_io_ctx->loc.local_thread_idx, comp_io_ctx->loc.core_id);
+                comp_io_ctx->new_packet_request_ring = rte_ring_create(ring_name, rte_align32pow2(num_mbufs),
+                                                                       node_id, RING_F_SC_DEQ);
+                assert(NULL != comp_io_ctx->new_packet_request_ring);
+
+                io_threads[num_io_confs + i].terminate_watcher = comp_io_ctx->terminate_watcher;
+                io_threads[num_io_confs + i].io_ctx = comp_io_ctx;
+                comp_ctx->io_ctx = comp_io_ctx;
+                comp_io_ctx->comp_ctx = comp_ctx;
+                RTE_LOG(INFO, MAIN, "io thread @%u runs its comp thread on @%u\n",
+                        conf.core_id, comp_core_id);
+            }
             i++;
         }
+
+        /* Let the node master of each port rebalance its RSS redirection
+         * table, if all the port's RX queues are polled by a single node. */
+        if (system_params["RSS_REBALANCE"] != 0) {
+            for (port_idx = 0; port_idx < num_ports; port_idx++) {
+                struct rte_eth_dev_info dev_info;
+                unsigned owner_node = num_nodes, num_owner_nodes = 0;
+                for (unsigned node_id = 0; node_id < num_nodes; node_id ++) {
+                    struct io_rss_port_state *rss = &node_stats[node_id]->rss[port_idx];
+                    for (unsigned q = 0; q < num_rxq_per_port; q++) {
+                        if (rss->rxq_polled[q]) {
+                            owner_node = node_id;
+                            num_owner_nodes ++;
+                            break;
+                        }
+                    }
+                }
+                rte_eth_dev_info_get(port_idx, &dev_info);
+                if (num_owner_nodes != 1 || dev_info.reta_size == 0
+                    || dev_info.reta_size > NBA_MAX_RSS_RETA_SIZE
+                    || (dev_info.reta_size & (dev_info.reta_size - 1)) != 0) {
+                    RTE_LOG(WARNING, MAIN, "port %u: RSS rebalancing is not supported (reta_size %u, polled by %u nodes).\n",
+                            port_idx, dev_info.reta_size, num_owner_nodes);
+                    continue;
+                }
+                struct io_rss_port_state *rss = &node_stats[owner_node]->rss[port_idx];
+                struct rte_eth_rss_reta_entry64 reta_conf[NBA_MAX_RSS_RETA_SIZE / RTE_ETH_RETA_GROUP_SIZE];
+                memzero(reta_conf, NBA_MAX_RSS_RETA_SIZE / RTE_ETH_RETA_GROUP_SIZE);
+                for (j = 0; j < dev_info.reta_size / RTE_ETH_RETA_GROUP_SIZE; j++)
+                    reta_conf[j].mask = ~0ull;
+                ret = rte_eth_dev_rss_reta_query(port_idx, reta_conf, dev_info.reta_size);
+                if (ret != 0) {
+                    RTE_LOG(WARNING, MAIN, "port %u: cannot query the RSS redirection table (%d).\n", port_idx, ret);
+                    continue;
+                }
+                for (j = 0; j < dev_info.reta_size; j++)
+                    rss->reta[j] = reta_conf[j / RTE_ETH_RETA_GROUP_SIZE].reta[j % RTE_ETH_RETA_GROUP_SIZE];
+                rss->reta_size = dev_info.reta_size;
+                RTE_LOG(INFO, MAIN, "port %u: RSS rebalancing enabled on node %u (reta_size %u)\n",
+                        port_idx, owner_node, rss->reta_size);
+            }
+        }
     }
 
     /* Notify computation threads to be ready. */
@@ -954,6 +1215,9 @@ int main(int argc, char **argv)
     }
     _exit_cond.unlock();
 
+    shmstats_destroy(NBA_SHM_STATS_NAME, shm_segment);
+    const char *trace_path = getenv("NBA_TRACE_FILE");
+    trace_dump((trace_path != nullptr) ? trace_path : "nba-trace.bin");
     RTE_LOG(NOTICE, MAIN, "terminated.\n");
     return 0;
 }
@@ -985,4 +1249,12 @@ static void handle_signal(int) {
     }
 }
 
+static void handle_trace_signal(int) {
+    trace_toggle();
+}
+
+static void handle_reload_signal(int) {
+    reload_request();
+}
+
 // vim: ts=8 sts=4 sw=4 et
@@ -0,0 +1,499 @@
+/**
+ * A microbenchmark of a single element's _process_batch() on synthetic
+ * packet batches, without NICs or the rest of the element graph.
+ *
+ * It instantiates the element by its name in element_registry,
+ * configures and initializes it as the comp thread does, and runs it
+ * in a tight loop over batches re-generated from a traffic profile.
+ * For each batch size and cache mode it reports ns/packet,
+ * cycles/packet (TSC), IPC and the hardware events given by --events.
+ * In the "cold" mode, the packets and the batch are flushed from the
+ * CPU cache before every call like freshly received packets.
+ * The batching scheme is fixed at compile time, so build this once per
+ * NBA_BATCHING_SCHEME to compare them.
+ *
+ * Example:
+ *   tests/bench_element -l 1 -n 4 -- -e IPlookup -p ipv4 -b 32,64,128
+ *   tests/bench_element -l 1 -n 4 -- -e IPsecESPencap -a 1024 -p ipv4 -f 1024
+ *
+ * Elements that rely on IO or coprocessor thread contexts (e.g., load
+ * balancers) are not supported.
+ */
+#include <nba/core/intrinsic.hh>
+#include <nba/core/checksum.hh>
+#include <nba/core/perfctr.hh>
+#include <nba/framework/config.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/test_utils.hh>
+#include <nba/element/element.hh>
+#include <nba/element/element_map.hh>
+#include <nba/element/annotation.hh>
+#include <nba/element/packet.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/element/nodelocalstorage.hh>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <getopt.h>
+#include <emmintrin.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+#include <rte_byteorder.h>
+
+using namespace std;
+using namespace nba;
+
+enum bench_profile {
+    PROFILE_IPV4 = 0,
+    PROFILE_IPV6,
+    PROFILE_MIXED,      /* alternating IPv4 and IPv6 packets */
+};
+
+enum bench_cache_mode {
+    CACHE_WARM = 1,
+    CACHE_COLD = 2,
+};
+
+static const char *profile_names[] = { "ipv4", "ipv6", "mixed" };
+
+static const char *batching_scheme_names[] = {
+    "traditional", "continuous", "bitvector", "linkedlist",
+};
+
+struct bench_result {
+    uint64_t num_pkts;
+    uint64_t num_passed;
+    uint64_t tsc;
+    uint64_t events[NBA_PERF_MAX_EVENTS];
+};
+
+static struct {
+    const char *element;
+    vector<string> args;
+    enum bench_profile profile;
+    unsigned pkt_size;
+    unsigned num_flows;         /* 0: random destinations */
+    vector<unsigned> batch_sizes;
+    unsigned num_iterations;
+    int cache_modes;
+    int input_port;
+    unsigned num_ports;
+    const char *events;
+    bool csv;
+} opts;
+
+static mt19937_64 rng;
+static uint64_t pkt_seq = 0;
+
+static void init_ipv4(unsigned char *p, unsigned pkt_size, uint64_t seq)
+{
+    struct iphdr *iph = (struct iphdr *) (p + 14);
+    struct udphdr *udph = (struct udphdr *) (p + 14 + sizeof(struct iphdr));
+    *(uint16_t *) (p + 12) = rte_cpu_to_be_16(0x0800);
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->tos = 0;
+    iph->tot_len = rte_cpu_to_be_16(pkt_size - 14);
+    iph->id = rte_cpu_to_be_16((uint16_t) seq);
+    iph->frag_off = 0;
+    iph->ttl = 64;
+    iph->protocol = IPPROTO_UDP;
+    iph->saddr = rte_cpu_to_be_32(0x0a000001u);
+    /* The flows match the tunnels of the IPsec elements. */
+    if (opts.num_flows > 0)
+        iph->daddr = rte_cpu_to_be_32(0x0a000001u + (uint32_t) (seq % opts.num_flows));
+    else
+        iph->daddr = (uint32_t) rng();
+    iph->check = 0;
+    iph->check = ip_fast_csum(iph, iph->ihl);
+    udph->source = rte_cpu_to_be_16(1234);
+    udph->dest = rte_cpu_to_be_16(80);
+    udph->len = rte_cpu_to_be_16(pkt_size - 14 - sizeof(struct iphdr));
+    udph->check = 0;
+}
+
+static void init_ipv6(unsigned char *p, unsigned pkt_size, uint64_t seq)
+{
+    struct ip6_hdr *iph = (struct ip6_hdr *) (p + 14);
+    struct udphdr *udph = (struct udphdr *) (p + 14 + sizeof(struct ip6_hdr));
+    *(uint16_t *) (p + 12) = rte_cpu_to_be_16(0x86dd);
+    iph->ip6_flow = rte_cpu_to_be_32(6u << 28);
+    iph->ip6_plen = rte_cpu_to_be_16(pkt_size - 14 - sizeof(struct ip6_hdr));
+    iph->ip6_nxt = IPPROTO_UDP;
+    iph->ip6_hlim = 64;
+    memset(&iph->ip6_src, 0, sizeof(iph->ip6_src));
+    iph->ip6_src.s6_addr[0] = 0x20;
+    iph->ip6_src.s6_addr[1] = 0x01;
+    iph->ip6_src.s6_addr[15] = 1;
+    if (opts.num_flows > 0) {
+        memcpy(&iph->ip6_dst, &iph->ip6_src, sizeof(iph->ip6_dst));
+        *(uint32_t *) &iph->ip6_dst.s6_addr[12] = rte_cpu_to_be_32(1u + (uint32_t) (seq % opts.num_flows));
+    } else {
+        uint64_t r[2] = { rng(), rng() };
+        memcpy(&iph->ip6_dst, r, sizeof(iph->ip6_dst));
+    }
+    udph->source = rte_cpu_to_be_16(1234);
+    udph->dest = rte_cpu_to_be_16(80);
+    udph->len = iph->ip6_plen;
+    udph->check = 0;
+}
+
+static void init_packet(size_t pkt_idx, Packet *pkt)
+{
+    unsigned char *p = pkt->data();
+    uint64_t seq = pkt_seq ++;
+    const unsigned char dst_mac[6] = { 0x02, 0, 0, 0, 0, 1 };
+    const unsigned char src_mac[6] = { 0x02, 0, 0, 0, 0, 0 };
+    memcpy(p, dst_mac, 6);
+    memcpy(p + 6, src_mac, 6);
+    switch (opts.profile) {
+    case PROFILE_IPV4:
+        init_ipv4(p, opts.pkt_size, seq);
+        break;
+    case PROFILE_IPV6:
+        init_ipv6(p, opts.pkt_size, seq);
+        break;
+    case PROFILE_MIXED:
+        if (seq % 2 == 0)
+            init_ipv4(p, opts.pkt_size, seq / 2);
+        else
+            init_ipv6(p, opts.pkt_size, seq / 2);
+        break;
+    }
+    anno_set(&pkt->anno, NBA_ANNO_IFACE_IN, seq % opts.num_ports);
+}
+
+static void flush_range(const void *ptr, size_t len)
+{
+    uintptr_t p = (uintptr_t) ptr & ~((uintptr_t) CACHE_LINE_SIZE - 1);
+    for (; p < (uintptr_t) ptr + len; p += CACHE_LINE_SIZE)
+        _mm_clflush((const void *) p);
+}
+
+static void flush_batch(PacketBatch *batch, unsigned num_pkts)
+{
+    for (unsigned i = 0; i < num_pkts; i++)
+        flush_range(batch->packets[i], sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM
+                                       + opts.pkt_size);
+    flush_range(batch, sizeof(PacketBatch));
+    _mm_mfence();
+}
+
+static void run_bench(Element *elem, PerfCounterGroup &perf, unsigned batch_size,
+                      enum bench_cache_mode mode, struct bench_result &res)
+{
+    uint64_t ev_begin[NBA_PERF_MAX_EVENTS], ev_end[NBA_PERF_MAX_EVENTS];
+    PacketBatch *batch = nba::testing::create_batch(batch_size, opts.pkt_size, init_packet);
+    memzero(&res, 1);
+    /* Warm up the code and the element state before measuring. */
+    unsigned num_warmups = RTE_MAX(opts.num_iterations / 10, 1u);
+    for (unsigned iter = 0; iter < num_warmups + opts.num_iterations; iter++) {
+        nba::testing::reset_batch(batch, batch_size, opts.pkt_size, init_packet);
+        if (mode == CACHE_COLD)
+            flush_batch(batch, batch_size);
+        perf.read(ev_begin);
+        uint64_t t0 = rte_rdtsc();
+        elem->_process_batch(opts.input_port, batch);
+        uint64_t t1 = rte_rdtsc();
+        perf.read(ev_end);
+        if (iter < num_warmups)
+            continue;
+        res.num_pkts += batch_size;
+        res.tsc += t1 - t0;
+        for (unsigned e = 0; e < perf.size(); e++)
+            res.events[e] += ev_end[e] - ev_begin[e];
+        /* Count the packets not dropped, whatever the output port is. */
+        for (unsigned i = 0; i < batch->count; i++)
+            if (batch->results[i] < PacketDisposition::DROP)
+                res.num_passed ++;
+    }
+    nba::testing::free_batch(batch);
+}
+
+/* Measures the cost of the timing instructions themselves to subtract them. */
+static void calibrate(PerfCounterGroup &perf, struct bench_result &overhead)
+{
+    uint64_t ev_begin[NBA_PERF_MAX_EVENTS], ev_end[NBA_PERF_MAX_EVENTS];
+    const unsigned num_samples = 1000;
+    memzero(&overhead, 1);
+    for (unsigned iter = 0; iter < num_samples; iter++) {
+        perf.read(ev_begin);
+        uint64_t t0 = rte_rdtsc();
+        uint64_t t1 = rte_rdtsc();
+        perf.read(ev_end);
+        overhead.tsc += t1 - t0;
+        for (unsigned e = 0; e < perf.size(); e++)
+            overhead.events[e] += ev_end[e] - ev_begin[e];
+    }
+    overhead.tsc /= num_samples;
+    for (unsigned e = 0; e < perf.size(); e++)
+        overhead.events[e] /= num_samples;
+}
+
+static void print_result(PerfCounterGroup &perf, int cycles_idx, int insts_idx,
+                         unsigned batch_size, enum bench_cache_mode mode,
+                         const struct bench_result &res, const struct bench_result &overhead)
+{
+    double num_batches = (double) res.num_pkts / batch_size;
+    double tsc = (double) res.tsc - overhead.tsc * num_batches;
+    double events[NBA_PERF_MAX_EVENTS];
+    for (unsigned e = 0; e < perf.size(); e++)
+        events[e] = RTE_MAX((double) res.events[e] - overhead.events[e] * num_batches, 0.0);
+    double ns_per_pkt = tsc * 1e9 / rte_get_tsc_hz() / res.num_pkts;
+    double cycles_per_pkt = tsc / res.num_pkts;
+    double ipc = (cycles_idx >= 0 && insts_idx >= 0 && events[cycles_idx] > 0)
+                 ? events[insts_idx] / events[cycles_idx] : 0;
+    double pass_ratio = 100.0 * res.num_passed / res.num_pkts;
+    const char *mode_name = (mode == CACHE_WARM) ? "warm" : "cold";
+    if (opts.csv) {
+        printf("%s,%s,%s,%u,%u,%s,%.2f,%.2f,%.3f,%.1f",
+               opts.element, batching_scheme_names[NBA_BATCHING_SCHEME], profile_names[opts.profile],
+               opts.pkt_size, batch_size, mode_name, ns_per_pkt, cycles_per_pkt, ipc, pass_ratio);
+        for (unsigned e = 0; e < perf.size(); e++)
+            printf(",%.2f", events[e] / res.num_pkts);
+        printf("\n");
+    } else {
+        printf("%7u %6s %10.2f %12.2f %7.3f %7.1f",
+               batch_size, mode_name, ns_per_pkt, cycles_per_pkt, ipc, pass_ratio);
+        for (unsigned e = 0; e < perf.size(); e++)
+            printf(" %14.2f", events[e] / res.num_pkts);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+static void print_usage(const char *prgname)
+{
+    printf("Usage: %s [EAL options] -- -e ELEMENT [options]\n\n", prgname);
+    printf("Options:\n"
+           "  -e, --element=NAME       : The element class name to benchmark.\n"
+           "  -a, --args=A,B,...       : The configuration arguments of the element.\n"
+           "  -p, --profile=PROFILE    : The traffic profile: ipv4 (default), ipv6, or mixed.\n"
+           "  -s, --pkt-size=BYTES     : The packet size including the Ethernet header. (default: 64)\n"
+           "  -f, --flows=N            : Cycle through N destinations (10.0.0.1, 10.0.0.2, ...)\n"
+           "                             instead of random ones. (default: 0)\n"
+           "  -b, --batch-sizes=N,...  : The batch sizes to measure. (default: 32,64,128)\n"
+           "  -n, --iterations=N       : The number of batches per measurement. (default: 10000)\n"
+           "  -c, --cache=MODE         : warm, cold, or both. (default: both)\n"
+           "  -i, --input-port=N       : The input port of the element. (default: 0)\n"
+           "      --num-ports=N        : The number of ports seen by the element. (default: 2)\n"
+           "      --events=LIST        : The hardware events to count per packet.\n"
+           "                             (default: cycles,instructions; see nba/core/perfctr.hh)\n"
+           "      --csv                : Print the results as comma-separated values.\n");
+}
+
+static void parse_list(const char *s, vector<string> &out)
+{
+    string str(s);
+    size_t begin = 0;
+    while (begin <= str.length()) {
+        size_t end = str.find(',', begin);
+        if (end == string::npos)
+            end = str.length();
+        if (end > begin)
+            out.push_back(str.substr(begin, end - begin));
+        begin = end + 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int ret = rte_eal_init(argc, argv);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Invalid EAL parameters.\n");
+    argc -= ret;
+    argv += ret;
+
+    opts.element = nullptr;
+    opts.profile = PROFILE_IPV4;
+    opts.pkt_size = 64;
+    opts.num_flows = 0;
+    opts.num_iterations = 10000;
+    opts.cache_modes = CACHE_WARM | CACHE_COLD;
+    opts.input_port = 0;
+    opts.num_ports = 2;
+    opts.events = "cycles,instructions";
+    opts.csv = false;
+
+    struct option long_opts[] = {
+        {"element", required_argument, NULL, 'e'},
+        {"args", required_argument, NULL, 'a'},
+        {"profile", required_argument, NULL, 'p'},
+        {"pkt-size", required_argument, NULL, 's'},
+        {"flows", required_argument, NULL, 'f'},
+        {"batch-sizes", required_argument, NULL, 'b'},
+        {"iterations", required_argument, NULL, 'n'},
+        {"cache", required_argument, NULL, 'c'},
+        {"input-port", required_argument, NULL, 'i'},
+        {"num-ports", required_argument, NULL, 0},
+        {"events", required_argument, NULL, 0},
+        {"csv", no_argument, NULL, 0},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    while (true) {
+        int optidx = 0;
+        int c = getopt_long(argc, argv, "e:a:p:s:f:b:n:c:i:h", long_opts, &optidx);
+        if (c == -1) break;
+        switch (c) {
+        case 0:
+            if (!strcmp("num-ports", long_opts[optidx].name))
+                opts.num_ports = (unsigned) atoi(optarg);
+            else if (!strcmp("events", long_opts[optidx].name))
+                opts.events = optarg;
+            else if (!strcmp("csv", long_opts[optidx].name))
+                opts.csv = true;
+            break;
+        case 'e':
+            opts.element = optarg;
+            break;
+        case 'a':
+            parse_list(optarg, opts.args);
+            break;
+        case 'p':
+            if (!strcmp("ipv4", optarg))
+                opts.profile = PROFILE_IPV4;
+            else if (!strcmp("ipv6", optarg))
+                opts.profile = PROFILE_IPV6;
+            else if (!strcmp("mixed", optarg))
+                opts.profile = PROFILE_MIXED;
+            else
+                rte_exit(EXIT_FAILURE, "Invalid traffic profile: %s\n", optarg);
+            break;
+        case 's':
+            opts.pkt_size = (unsigned) atoi(optarg);
+            break;
+        case 'f':
+            opts.num_flows = (unsigned) atoi(optarg);
+            break;
+        case 'b': {
+            vector<string> sizes;
+            parse_list(optarg, sizes);
+            for (const string &s : sizes)
+                opts.batch_sizes.push_back((unsigned) atoi(s.c_str()));
+            break; }
+        case 'n':
+            opts.num_iterations = (unsigned) atoi(optarg);
+            break;
+        case 'c':
+            if (!strcmp("warm", optarg))
+                opts.cache_modes = CACHE_WARM;
+            else if (!strcmp("cold", optarg))
+                opts.cache_modes = CACHE_COLD;
+            else if (!strcmp("both", optarg))
+                opts.cache_modes = CACHE_WARM | CACHE_COLD;
+            else
+                rte_exit(EXIT_FAILURE, "Invalid cache mode: %s\n", optarg);
+            break;
+        case 'i':
+            opts.input_port = atoi(optarg);
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            rte_exit(EXIT_FAILURE, "Invalid arguments.\n");
+        }
+    }
+    if (opts.element == nullptr) {
+        print_usage(argv[0]);
+        rte_exit(EXIT_FAILURE, "The element name is required.\n");
+    }
+    if (opts.batch_sizes.empty())
+        opts.batch_sizes = { 32, 64, 128 };
+    for (unsigned batch_size : opts.batch_sizes)
+        if (batch_size == 0 || batch_size > NBA_MAX_COMP_BATCH_SIZE)
+            rte_exit(EXIT_FAILURE, "The batch size must be between 1 and %u.\n",
+                     NBA_MAX_COMP_BATCH_SIZE);
+    if (opts.pkt_size < 64 || opts.pkt_size > NBA_MAX_PACKET_SIZE)
+        rte_exit(EXIT_FAILURE, "The packet size must be between 64 and %u.\n",
+                 NBA_MAX_PACKET_SIZE);
+    if (opts.num_iterations == 0 || opts.num_ports == 0)
+        rte_exit(EXIT_FAILURE, "Invalid number of iterations or ports.\n");
+
+    auto search = element_registry.find(string(opts.element));
+    if (search == element_registry.end())
+        rte_exit(EXIT_FAILURE, "Element \"%s\" does not exist.\n", opts.element);
+
+    /* Mimic a comp thread context of a single-node system. */
+    comp_thread_context *ctx = new comp_thread_context();
+    ctx->loc.node_id = rte_socket_id();
+    ctx->loc.core_id = rte_lcore_id();
+    ctx->loc.local_thread_idx = 0;
+    ctx->loc.global_thread_idx = 0;
+    ctx->num_nodes = 1;
+    ctx->num_tx_ports = opts.num_ports;
+    ctx->num_combatch_size = opts.batch_sizes.back();
+    ctx->node_local_storage = new NodeLocalStorage(ctx->loc.node_id);
+
+    Element *elem = search->second.instantiate();
+    if (elem->configure(ctx, opts.args) != 0)
+        rte_exit(EXIT_FAILURE, "Failed to configure %s.\n", opts.element);
+    if (elem->initialize_global() != 0 || elem->initialize_per_node() != 0
+        || elem->initialize() != 0)
+        rte_exit(EXIT_FAILURE, "Failed to initialize %s.\n", opts.element);
+
+    PerfCounterGroup perf;
+    int cycles_idx = -1, insts_idx = -1;
+    ret = perf.open(opts.events);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open the hardware counters \"%s\": %s\n",
+                opts.events, strerror(-ret));
+    } else {
+        for (unsigned e = 0; e < perf.size(); e++) {
+            if (!strcmp("cycles", perf.event_name(e)))
+                cycles_idx = e;
+            else if (!strcmp("instructions", perf.event_name(e)))
+                insts_idx = e;
+        }
+    }
+    struct bench_result overhead;
+    calibrate(perf, overhead);
+
+    rng.seed(0);  /* for the same traffic across runs */
+    if (opts.csv) {
+        printf("element,scheme,profile,pkt_size,batch_size,cache,ns_per_pkt,cycles_per_pkt,ipc,pass_pct");
+        for (unsigned e = 0; e < perf.size(); e++)
+            printf(",%s_per_pkt", perf.event_name(e));
+        printf("\n");
+    } else {
+        printf("# element %s, %s profile, %u-byte packets, %s destinations, batching scheme %s\n",
+               opts.element, profile_names[opts.profile], opts.pkt_size,
+               (opts.num_flows > 0) ? "cycled" : "random",
+               batching_scheme_names[NBA_BATCHING_SCHEME]);
+        printf("# timing overhead subtracted: %lu cycles per batch%s\n", overhead.tsc,
+               perf.uses_rdpmc() ? "" : " (hardware counters read by syscalls)");
+        printf("%7s %6s %10s %12s %7s %7s", "batch", "cache", "ns/pkt", "cycles/pkt", "IPC", "pass%");
+        for (unsigned e = 0; e < perf.size(); e++)
+            printf(" %14s", perf.event_name(e));
+        printf("\n");
+    }
+    for (unsigned batch_size : opts.batch_sizes) {
+        for (enum bench_cache_mode mode : { CACHE_WARM, CACHE_COLD }) {
+            if (!(opts.cache_modes & mode))
+                continue;
+            struct bench_result res;
+            run_bench(elem, perf, batch_size, mode, res);
+            print_result(perf, cycles_idx, insts_idx, batch_size, mode, res, overhead);
+        }
+    }
+
+    perf.close();
+    delete elem;
+    return 0;
+}
+
+// vim: ts=8 sts=4 sw=4 et
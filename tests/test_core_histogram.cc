@@ -0,0 +1,62 @@
+#include <nba/core/histogram.hh>
+#include <gtest/gtest.h>
+
+using namespace nba;
+
+typedef LogHistogram<5> TestHist;
+
+TEST(CoreHistogramTest, Empty) {
+    TestHist h;
+    EXPECT_EQ(0u, h.count());
+    EXPECT_EQ(0u, h.percentile(50));
+    EXPECT_EQ(0u, h.percentile(99.9));
+}
+
+TEST(CoreHistogramTest, BucketBounds) {
+    /* Small values are exact. */
+    for (uint64_t v = 0; v < TestHist::NUM_SUB_BUCKETS; v++) {
+        EXPECT_EQ(v, TestHist::bucket_of(v));
+        EXPECT_EQ(v, TestHist::bucket_upper(TestHist::bucket_of(v)));
+    }
+    /* Every value falls under its bucket's upper bound within the relative error. */
+    uint64_t values[] = {32, 33, 63, 64, 65, 1000, 123456789, (1ull << 40) + 12345, ~0ull};
+    for (uint64_t v : values) {
+        unsigned b = TestHist::bucket_of(v);
+        ASSERT_LT(b, TestHist::NUM_BUCKETS);
+        uint64_t upper = TestHist::bucket_upper(b);
+        EXPECT_LE(v, upper);
+        EXPECT_LE((double) (upper - v), (double) v / TestHist::NUM_SUB_BUCKETS);
+        if (b > 0) {
+            EXPECT_LT(TestHist::bucket_upper(b - 1), v);
+        }
+    }
+}
+
+TEST(CoreHistogramTest, Percentiles) {
+    TestHist h;
+    for (uint64_t v = 1; v <= 10000; v++)
+        h.record(v);
+    EXPECT_EQ(10000u, h.count());
+    EXPECT_EQ(10000u, h.max());
+    uint64_t p50 = h.percentile(50), p99 = h.percentile(99);
+    EXPECT_GE(p50, 5000u);
+    EXPECT_LE(p50, 5000u + 5000u / TestHist::NUM_SUB_BUCKETS);
+    EXPECT_GE(p99, 9900u);
+    EXPECT_LE(p99, 10000u);
+    EXPECT_EQ(10000u, h.percentile(100));
+}
+
+TEST(CoreHistogramTest, WeightedAndMerge) {
+    TestHist a, b;
+    a.record(10, 99);
+    b.record(100000, 1);
+    a.merge(b);
+    EXPECT_EQ(100u, a.count());
+    EXPECT_EQ(10u, a.percentile(99));
+    EXPECT_EQ(100000u, a.percentile(99.9));
+    a.reset();
+    EXPECT_EQ(0u, a.count());
+    EXPECT_EQ(0u, a.max());
+}
+
+// vim: ts=8 sts=4 sw=4 et
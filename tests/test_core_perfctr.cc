@@ -0,0 +1,60 @@
+#include <nba/core/perfctr.hh>
+#include <gtest/gtest.h>
+
+using namespace nba;
+
+TEST(CorePerfCtrTest, LookupEvents) {
+    uint32_t type;
+    uint64_t config;
+    EXPECT_EQ(0, perf_lookup_event("cycles", 6, &type, &config));
+    EXPECT_EQ((uint32_t) PERF_TYPE_HARDWARE, type);
+    EXPECT_EQ((uint64_t) PERF_COUNT_HW_CPU_CYCLES, config);
+    EXPECT_EQ(0, perf_lookup_event("LLC-misses", 10, &type, &config));
+    EXPECT_EQ((uint32_t) PERF_TYPE_HW_CACHE, type);
+    EXPECT_EQ((uint64_t) (PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)), config);
+    /* Only the given length is compared. */
+    EXPECT_EQ(0, perf_lookup_event("dtlb-misses,cycles", 11, &type, &config));
+    EXPECT_EQ((uint32_t) PERF_TYPE_HW_CACHE, type);
+    EXPECT_EQ(-EINVAL, perf_lookup_event("cycle", 5, &type, &config));
+    EXPECT_EQ(-EINVAL, perf_lookup_event("no-such-event", 13, &type, &config));
+}
+
+TEST(CorePerfCtrTest, RawEvents) {
+    uint32_t type;
+    uint64_t config;
+    EXPECT_EQ(0, perf_lookup_event("r01c2", 5, &type, &config));
+    EXPECT_EQ((uint32_t) PERF_TYPE_RAW, type);
+    EXPECT_EQ(0x01c2u, config);
+    EXPECT_EQ(-EINVAL, perf_lookup_event("r", 1, &type, &config));
+    EXPECT_EQ(-EINVAL, perf_lookup_event("r12xz", 5, &type, &config));
+}
+
+TEST(CorePerfCtrTest, InvalidSpecs) {
+    PerfCounterGroup g;
+    EXPECT_EQ(-EINVAL, g.open(""));
+    EXPECT_EQ(-EINVAL, g.open("cycles,bogus"));
+    EXPECT_EQ(-E2BIG, g.open("cycles,instructions,branches,branch-misses,cache-misses"));
+    EXPECT_EQ(0u, g.size());
+}
+
+TEST(CorePerfCtrTest, CountsIncrease) {
+    PerfCounterGroup g;
+    int ret = g.open("instructions,cycles");
+    if (ret < 0) {
+        /* No PMU access in this environment (e.g., VMs or perf_event_paranoid). */
+        return;
+    }
+    ASSERT_EQ(2, ret);
+    EXPECT_STREQ("instructions", g.event_name(0));
+    EXPECT_STREQ("cycles", g.event_name(1));
+    uint64_t before[NBA_PERF_MAX_EVENTS], after[NBA_PERF_MAX_EVENTS];
+    g.read(before);
+    volatile uint64_t sum = 0;
+    for (unsigned i = 0; i < 100000; i++)
+        sum += i;
+    g.read(after);
+    EXPECT_GT(after[0], before[0]);
+}
+
+// vim: ts=8 sts=4 sw=4 et
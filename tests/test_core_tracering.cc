@@ -0,0 +1,50 @@
+#include <nba/core/tracering.hh>
+#include <gtest/gtest.h>
+
+using namespace nba;
+
+TEST(CoreTraceRingTest, Empty) {
+    struct trace_event buf[8];
+    TraceRing r;
+    r.init(buf, 8);
+    EXPECT_EQ(8u, r.capacity());
+    EXPECT_EQ(0u, r.size());
+    EXPECT_EQ(0u, r.recorded());
+    EXPECT_EQ(0u, r.overwritten());
+}
+
+TEST(CoreTraceRingTest, Ordered) {
+    struct trace_event buf[8];
+    TraceRing r;
+    r.init(buf, 8);
+    for (unsigned i = 0; i < 5; i++)
+        r.push(i, 100 + i, i * 2, 1000 + i);
+    ASSERT_EQ(5u, r.size());
+    for (unsigned i = 0; i < 5; i++) {
+        EXPECT_EQ(i, r.at(i).type);
+        EXPECT_EQ(100 + i, r.at(i).tsc);
+        EXPECT_EQ(i * 2, r.at(i).arg0);
+        EXPECT_EQ(1000 + i, r.at(i).arg1);
+    }
+}
+
+TEST(CoreTraceRingTest, Overwrite) {
+    struct trace_event buf[8];
+    TraceRing r;
+    r.init(buf, 8);
+    for (unsigned i = 0; i < 21; i++)
+        r.push(1, i, 0, 0);
+    EXPECT_EQ(21u, r.recorded());
+    ASSERT_EQ(8u, r.size());
+    EXPECT_EQ(13u, r.overwritten());
+    /* Only the latest events are kept, from the oldest. */
+    for (unsigned i = 0; i < 8; i++)
+        EXPECT_EQ(13u + i, r.at(i).tsc);
+    r.clear();
+    EXPECT_EQ(0u, r.size());
+    r.push(2, 42, 0, 0);
+    ASSERT_EQ(1u, r.size());
+    EXPECT_EQ(42u, r.at(0).tsc);
+}
+
+// vim: ts=8 sts=4 sw=4 et
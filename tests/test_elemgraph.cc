@@ -0,0 +1,474 @@
+#include <cstdint>
+#include <new>
+#include <cstdio>
+#include <cassert>
+#include <vector>
+#include <nba/core/intrinsic.hh>
+#include <nba/framework/config.hh>
+#include <nba/framework/threadcontext.hh>
+#include <nba/framework/elementgraph.hh>
+#include <nba/framework/graphanalysis.hh>
+#include <nba/framework/io.hh>
+#include <nba/framework/test_utils.hh>
+#include <nba/element/element.hh>
+#include <nba/element/annotation.hh>
+#include <nba/element/packet.hh>
+#include <nba/element/packetbatch.hh>
+#include <nba/core/checksum.hh>
+#include <gtest/gtest.h>
+#include <rte_config.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_mempool.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <netinet/ip.h>
+#include "../elements/ip/CheckIPHeader.hh"
+#include "../elements/ip/IPlookup.hh"
+#include "../elements/ip/DecIPTTL.hh"
+/*
+#require <lib/elementgraph.o>
+#require <lib/element.o>
+#require <lib/graphanalysis.o>
+#require <lib/packet.o>
+#require <lib/packetbatch.o>
+#require <lib/computation.o>
+#require <lib/io.o>
+#require <lib/trace.o>
+#require <lib/test_utils.o>
+#require <lib/datablock.o>
+#require "../elements/ip/CheckIPHeader.o"
+#require "../elements/ip/IPlookup.o"
+#require "../elements/ip/ip_route_core.o"
+#require "../elements/ip/IPv4Datablocks.o"
+#require "../elements/ip/DecIPTTL.o"
+*/
+
+using namespace std;
+using namespace nba;
+
+class RTEEnvironment : public ::testing::Environment {
+    int argc;
+    char **argv;
+
+public:
+    RTEEnvironment(int argc, char **argv)
+        : ::testing::Environment(), argc(argc), argv(argv)
+    { }
+
+    void SetUp()
+    {
+        int rc;
+        rc = rte_eal_init(argc, argv);
+        assert(rc >= 0);
+    }
+
+    void TearDown()
+    {
+        return;
+    }
+};
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    RTEEnvironment *env = new RTEEnvironment(argc, argv);
+    ::testing::AddGlobalTestEnvironment(env);
+    return RUN_ALL_TESTS();
+}
+
+/* Passes packets to output 0 or 1 and drops the others,
+ * by the first byte of their data modulo 3. */
+class TestClassifier : public Element {
+public:
+    const char *class_name() const { return "TestClassifier"; }
+    const char *port_count() const { return "1/2"; }
+    int initialize() { return 0; }
+
+    int process(int input_port, Packet *pkt)
+    {
+        unsigned o = pkt->data()[0] % 3;
+        if (o < 2)
+            output(o).push(pkt);
+        else
+            pkt->kill();
+        return 0;
+    }
+};
+
+/* Counts the packets it passes. */
+class TestCounter : public Element {
+public:
+    const char *class_name() const { return "TestCounter"; }
+    const char *port_count() const { return "1/1"; }
+    int initialize() { return 0; }
+
+    int process(int input_port, Packet *pkt)
+    {
+        num_pkts ++;
+        output(0).push(pkt);
+        return 0;
+    }
+
+    unsigned num_pkts = 0;
+};
+
+/* Keeps all batches it receives. */
+class TestSink : public PerBatchElement {
+public:
+    const char *class_name() const { return "TestSink"; }
+    const char *port_count() const { return "1/0"; }
+    int initialize() { return 0; }
+
+    int process_batch(int input_port, PacketBatch *batch)
+    {
+        batches.push_back(batch);
+        return KEPT_BY_ELEMENT;
+    }
+
+    vector<PacketBatch *> batches;
+};
+
+static void test_packetbatch_init(struct rte_mempool *mp, void *arg, void *obj, unsigned idx)
+{
+    new (obj) PacketBatch();
+}
+
+class ElementGraphTest : public ::testing::Test {
+protected:
+    static const unsigned num_pkts = 32;
+
+    static void SetUpTestCase()
+    {
+        batch_pool = rte_mempool_create("test.batch", 63, sizeof(PacketBatch),
+                                        0, 0, nullptr, nullptr,
+                                        test_packetbatch_init, nullptr,
+                                        rte_socket_id(), 0);
+        assert(batch_pool != nullptr);
+        pkt_pool = rte_pktmbuf_pool_create("test.pkt", 63, 0, 0,
+                                           RTE_PKTMBUF_HEADROOM + NBA_MAX_PACKET_SIZE,
+                                           rte_socket_id());
+        assert(pkt_pool != nullptr);
+    }
+
+    virtual void SetUp()
+    {
+        io_ctx = (struct io_thread_context *) rte_zmalloc(nullptr,
+                 sizeof(struct io_thread_context), CACHE_LINE_SIZE);
+        ASSERT_NE(nullptr, io_ctx);
+        io_ctx->port_stats = port_stats;
+        memzero(port_stats, NBA_MAX_PORTS);
+
+        ctx = new comp_thread_context();
+        ctx->loc.node_id = rte_socket_id();
+        ctx->loc.core_id = rte_lcore_id();
+        ctx->loc.local_thread_idx = 0;
+        ctx->elem_stat_sample = 0;
+        ctx->inspector = nullptr;
+        ctx->io_ctx = io_ctx;
+        ctx->batch_freelist.init(batch_pool);
+
+        graph = new ElementGraph(ctx);
+    }
+
+    /* Links the elements in both the graph and its analysis. */
+    void link(Element *from_elem, int output_port, Element *to_elem)
+    {
+        graph->link_element(to_elem, 0, from_elem, output_port);
+        from_elem->link(to_elem);
+    }
+
+    /* Returns the batch of num_pkts packets in the pool. */
+    PacketBatch *alloc_batch(struct rte_mbuf **mbufs, nba::testing::pkt_init_callback_t init_cb)
+    {
+        PacketBatch *batch = nullptr;
+        if (ctx->batch_freelist.get((void **) &batch) != 0)
+            return nullptr;
+        for (unsigned i = 0; i < num_pkts; i++) {
+            batch->packets[i] = mbufs[i] = rte_pktmbuf_alloc(pkt_pool);
+            if (mbufs[i] == nullptr)
+                return nullptr;
+        }
+        nba::testing::reset_batch(batch, num_pkts, 64, init_cb);
+        return batch;
+    }
+
+    virtual void TearDown()
+    {
+        delete graph;  /* This also deletes the elements. */
+        delete ctx;
+        rte_free(io_ctx);
+    }
+
+    static struct rte_mempool *batch_pool;
+    static struct rte_mempool *pkt_pool;
+    struct io_port_stat port_stats[NBA_MAX_PORTS];
+    struct io_thread_context *io_ctx;
+    comp_thread_context *ctx;
+    ElementGraph *graph;
+};
+
+struct rte_mempool *ElementGraphTest::batch_pool = nullptr;
+struct rte_mempool *ElementGraphTest::pkt_pool = nullptr;
+
+class ElementGraphBranchTest : public ElementGraphTest {
+protected:
+    virtual void SetUp()
+    {
+        ElementGraphTest::SetUp();
+        classifier = new TestClassifier();
+        sinks[0] = new TestSink();
+        sinks[1] = new TestSink();
+        graph->add_element(classifier);
+        graph->add_element(sinks[0]);
+        graph->add_element(sinks[1]);
+        link(classifier, 0, sinks[0]);
+        link(classifier, 1, sinks[1]);
+        ASSERT_EQ(0, graph->validate());
+    }
+
+    TestClassifier *classifier;
+    TestSink *sinks[2];
+};
+
+TEST_F(ElementGraphBranchTest, BranchedPacketsAreNotDropped) {
+    struct rte_mbuf *mbufs[num_pkts];
+    PacketBatch *batch = alloc_batch(mbufs, [](size_t pkt_idx, Packet *pkt) {
+        pkt->data()[0] = (unsigned char) pkt_idx;
+    });
+    ASSERT_NE(nullptr, batch);
+
+    graph->enqueue_batch(batch, classifier, 0);
+    graph->flush_tasks();
+
+    /* Only the packets killed by the classifier are dropped. */
+    const unsigned num_dropped = num_pkts / 3;
+    EXPECT_EQ(num_dropped, io_ctx->drop_buffer.count);
+    EXPECT_EQ(num_dropped, port_stats[0].num_sw_drop_pkts);
+    for (unsigned i = 0; i < io_ctx->drop_buffer.count; i++) {
+        struct rte_mbuf *m = io_ctx->drop_buffer.pkts[i];
+        EXPECT_EQ(2u, rte_pktmbuf_mtod(m, unsigned char *)[0] % 3u);
+    }
+
+    /* The others reach their sinks, once and alive. */
+    unsigned num_received = 0;
+    for (unsigned o = 0; o < 2; o++) {
+        ASSERT_EQ(1u, sinks[o]->batches.size());
+        PacketBatch *out_batch = sinks[o]->batches[0];
+        FOR_EACH_PACKET(out_batch) {
+            struct rte_mbuf *m = out_batch->packets[pkt_idx];
+            EXPECT_EQ(o, rte_pktmbuf_mtod(m, unsigned char *)[0] % 3u);
+            EXPECT_EQ(1u, rte_mbuf_refcnt_read(m));
+            for (unsigned i = 0; i < io_ctx->drop_buffer.count; i++)
+                EXPECT_NE(m, io_ctx->drop_buffer.pkts[i]);
+            num_received ++;
+        } END_FOR;
+    }
+    EXPECT_EQ(num_pkts - num_dropped, num_received);
+
+    /* Every mbuf is returned exactly once. */
+    for (unsigned o = 0; o < 2; o++) {
+        PacketBatch *out_batch = sinks[o]->batches[0];
+        FOR_EACH_PACKET(out_batch) {
+            rte_pktmbuf_free(out_batch->packets[pkt_idx]);
+        } END_FOR;
+        graph->free_batch(out_batch, false);
+    }
+    for (unsigned i = 0; i < io_ctx->drop_buffer.count; i++)
+        rte_pktmbuf_free(io_ctx->drop_buffer.pkts[i]);
+    io_ctx->drop_buffer.count = 0;
+    EXPECT_EQ(63u, rte_mempool_count(pkt_pool));
+}
+
+TEST_F(ElementGraphBranchTest, FreeBatchSkipsExcludedSlots) {
+    struct rte_mbuf *mbufs[num_pkts];
+    PacketBatch *batch = alloc_batch(mbufs, [](size_t pkt_idx, Packet *pkt) { });
+    ASSERT_NE(nullptr, batch);
+
+    /* Excluded packets belong to someone else, e.g. other batches. */
+    vector<struct rte_mbuf *> excluded;
+    for (unsigned i = 0; i < num_pkts; i += 4) {
+        excluded.push_back(batch->packets[i]);
+        EXCLUDE_PACKET(batch, i);
+    }
+
+    graph->free_batch(batch);
+    EXPECT_EQ(num_pkts - excluded.size(), io_ctx->drop_buffer.count);
+    EXPECT_EQ(num_pkts - excluded.size(), port_stats[0].num_sw_drop_pkts);
+    for (unsigned i = 0; i < io_ctx->drop_buffer.count; i++) {
+        struct rte_mbuf *m = io_ctx->drop_buffer.pkts[i];
+        ASSERT_NE(nullptr, m);
+        for (struct rte_mbuf *x : excluded)
+            EXPECT_NE(x, m);
+        rte_pktmbuf_free(m);
+    }
+    io_ctx->drop_buffer.count = 0;
+    for (struct rte_mbuf *x : excluded)
+        rte_pktmbuf_free(x);
+    EXPECT_EQ(63u, rte_mempool_count(pkt_pool));
+}
+
+/* Packets cycle through: untagged, 802.1Q-tagged, and truncated IPv4. */
+static void init_tagged_packet(size_t pkt_idx, Packet *pkt)
+{
+    unsigned char *p = pkt->data();
+    unsigned off = 12;
+    if (pkt_idx % 3 == 1) {
+        *(uint16_t *) (p + off) = rte_cpu_to_be_16(0x8100);
+        off += 4;
+    }
+    *(uint16_t *) (p + off) = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+    struct iphdr *iph = (struct iphdr *) (p + off + 2);
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->protocol = IPPROTO_UDP;
+    if (pkt_idx % 3 == 2)
+        pkt->take(64 - 30);  /* Cuts the IPv4 header short. */
+}
+
+TEST_F(ElementGraphTest, HeaderOffsetsFollowTagsAndLength) {
+    struct rte_mbuf *mbufs[num_pkts];
+    PacketBatch *batch = alloc_batch(mbufs, init_tagged_packet);
+    ASSERT_NE(nullptr, batch);
+
+    FOR_EACH_PACKET(batch) {
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+        switch (pkt_idx % 3) {
+        case 0:
+            EXPECT_EQ(NBA_L3_IPV4, pkt->network_type());
+            EXPECT_EQ(14, pkt->network_header_offset());
+            EXPECT_EQ(34, pkt->transport_header_offset());
+            EXPECT_EQ(IPPROTO_UDP, pkt->transport_protocol());
+            break;
+        case 1:
+            EXPECT_EQ(NBA_L3_IPV4, pkt->network_type());
+            EXPECT_EQ(18, pkt->network_header_offset());
+            EXPECT_EQ(38, pkt->transport_header_offset());
+            /* Offsets follow the start of data. */
+            pkt->pull(4);
+            EXPECT_EQ(14, pkt->network_header_offset());
+            EXPECT_EQ(34, pkt->transport_header_offset());
+            pkt->push(4);
+            EXPECT_EQ(18, pkt->network_header_offset());
+            break;
+        case 2:
+            EXPECT_FALSE(pkt->has_network_header());
+            break;
+        }
+    } END_FOR;
+    #if NBA_BATCH_SOA_META
+    const struct batch_meta &meta = batch->load_meta();
+    ASSERT_TRUE(meta.hdrs_valid);
+    FOR_EACH_PACKET(batch) {
+        Packet *pkt = Packet::from_base(batch->packets[pkt_idx]);
+        EXPECT_EQ(pkt->network_header_offset(), meta.l3_offset[pkt_idx]);
+        EXPECT_EQ(pkt->transport_header_offset(), meta.l4_offset[pkt_idx]);
+    } END_FOR;
+    #endif
+
+    for (unsigned i = 0; i < num_pkts; i++)
+        rte_pktmbuf_free(mbufs[i]);
+    graph->free_batch(batch, false);
+    EXPECT_EQ(63u, rte_mempool_count(pkt_pool));
+}
+
+/* Packets cycle through: TTL 64, TTL 1, a bad IP version, and TTL 10. */
+static void init_ipv4_packet(size_t pkt_idx, Packet *pkt)
+{
+    struct ether_hdr *ethh = (struct ether_hdr *) pkt->data();
+    ethh->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+    struct iphdr *iph = (struct iphdr *) (ethh + 1);
+    static const uint8_t ttls[4] = { 64, 1, 64, 10 };
+    iph->version = (pkt_idx % 4 == 2) ? 6 : 4;
+    iph->ihl = 5;
+    iph->tot_len = htons(64 - sizeof(struct ether_hdr));
+    iph->ttl = ttls[pkt_idx % 4];
+    iph->protocol = IPPROTO_UDP;
+    iph->check = 0;
+    iph->check = ip_fast_csum(iph, iph->ihl);
+}
+
+class ElementGraphFuseTest : public ElementGraphTest {
+protected:
+    virtual void SetUp()
+    {
+        ElementGraphTest::SetUp();
+        check = new CheckIPHeader();
+        sink = new TestSink();
+        graph->add_element(check);
+        graph->add_element(sink);
+    }
+
+    void analyze()
+    {
+        GraphAnalyzer ga;
+        ga.analyze(vector<GraphMetaData *>{ check });
+        ASSERT_EQ(0, graph->validate());
+        graph->fuse_linear_groups();
+    }
+
+    CheckIPHeader *check;
+    TestSink *sink;
+};
+
+TEST_F(ElementGraphFuseTest, RouterChainIsFused) {
+    IPlookup *lookup = new IPlookup();
+    DecIPTTL *dec = new DecIPTTL();
+    graph->add_element(lookup);
+    graph->add_element(dec);
+    link(check, 0, lookup);
+    link(lookup, 0, dec);
+    link(dec, 0, sink);
+    analyze();
+
+    /* Without offloading, the whole chain runs in one pass. */
+    EXPECT_EQ(2u, check->get_fused_chain(false).num_fused);
+    EXPECT_EQ(0x5u, check->get_fused_chain(false).batch_loops);
+    /* Otherwise it stops before IPlookup to let it offload. */
+    EXPECT_EQ(0u, check->get_fused_chain(true).num_fused);
+    EXPECT_EQ(0x1u, check->get_fused_chain(true).batch_loops);
+}
+
+#if NBA_FUSE_ELEMENTS == NBA_FUSE_ELEMENTS_ENABLED
+TEST_F(ElementGraphFuseTest, BatchLoopsRunInsideChain) {
+    TestCounter *counter = new TestCounter();
+    DecIPTTL *dec = new DecIPTTL();
+    graph->add_element(counter);
+    graph->add_element(dec);
+    link(check, 0, counter);
+    link(counter, 0, dec);
+    link(dec, 0, sink);
+    analyze();
+    ASSERT_EQ(2u, check->get_fused_chain(false).num_fused);
+
+    struct rte_mbuf *mbufs[num_pkts];
+    PacketBatch *batch = alloc_batch(mbufs, init_ipv4_packet);
+    ASSERT_NE(nullptr, batch);
+    graph->enqueue_batch(batch, check, 0);
+    graph->flush_tasks();
+
+    /* The packets dropped by CheckIPHeader do not reach the next ones. */
+    EXPECT_EQ(num_pkts / 4 * 3, counter->num_pkts);
+    ASSERT_EQ(1u, sink->batches.size());
+    PacketBatch *out_batch = sink->batches[0];
+    unsigned num_received = 0;
+    FOR_EACH_PACKET(out_batch) {
+        Packet *pkt = Packet::from_base(out_batch->packets[pkt_idx]);
+        const struct iphdr *iph = (const struct iphdr *) pkt->network_header();
+        EXPECT_EQ(4u, iph->version);
+        EXPECT_TRUE(iph->ttl == 63 || iph->ttl == 9);
+        EXPECT_EQ(0, ip_fast_csum(iph, iph->ihl));
+        num_received ++;
+    } END_FOR;
+    EXPECT_EQ(num_pkts / 2, num_received);
+
+    /* Every mbuf is returned exactly once. */
+    graph->free_batch(out_batch, false);
+    io_ctx->drop_buffer.count = 0;
+    for (unsigned i = 0; i < num_pkts; i++)
+        rte_pktmbuf_free(mbufs[i]);
+    EXPECT_EQ(63u, rte_mempool_count(pkt_pool));
+}
+#endif
+
+// vim: ts=8 sts=4 sw=4 et